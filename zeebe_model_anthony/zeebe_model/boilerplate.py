@@ -3,6 +3,8 @@ Functions for interfacing with Zeebe's microenvironment model
 """
 
 import os
+import shlex
+import hashlib
 import numpy as np
 import pandas as pd
 from glob import glob
@@ -12,6 +14,14 @@ from glob import glob
 
 resource_dir = os.path.join(os.path.split(__file__)[0], "resources")
 
+# compile cache of the model binaries (c_cached), shared by all tpaths
+cache_dir = os.environ.get(
+    "ZEEBE_MODEL_CACHE",
+    os.path.join(os.path.expanduser("~"), ".cache", "zeebe_model"),
+)
+CACHE_CFLAGS = "-O3 -march=native"
+CACHE_STATS = {"hit": 0, "miss": 0}
+
 
 # data import
 def import_modelrun(folder="."):
@@ -30,7 +40,7 @@ def import_modelrun(folder="."):
     }
     data["pH"] = -np.log10(data["h"] * 1e-6)
     data["dic"] = data["co2"] + data["co3"] + data["hco3"]
-    data["alk"] = data["hco3"] + 2 * data["co3"] + data["boh4"] + data["oh"]
+    data["alk"] = data["hco3"] + 2 * data["co3"] + data.get("boh4", 0) + data["oh"]
 
     with open(folder + "/par.sv4") as f:
         data["par"] = f.read()
@@ -67,9 +77,856 @@ def parse_modelrun(data):
     return pd.DataFrame.from_dict(d).set_index("r"), meta
 
 
-def c_run(path):
-    # open('./a.out', 'a').close()
-    os.system("gcc " + path + " -lm; ./a.out")
+def import_transient(folder=".", periodic=False):
+    """
+    Imports the snapshots of a TRANSIENT run (trans.sv4), or of
+    the periodic light/dark state of a PERIODIC run (peri.sv4).
+
+    Returns
+    -------
+    pd.DataFrame indexed by time [s] and r [mu].
+    Concentrations are in µM.
+    """
+    fname = "peri.sv4" if periodic else "trans.sv4"
+    f = os.path.join(folder, fname)
+    if not os.path.exists(f):
+        raise ValueError(f"No transient output ({fname}) in folder {folder}")
+
+    with open(f) as fh:
+        names = fh.readline().lstrip("#").split()
+    data = pd.DataFrame(np.genfromtxt(f), columns=names)
+    data["pH"] = -np.log10(data["h"] * 1e-6)
+
+    return data.set_index(["t", "r"])
+
+
+def import_sensitivity(folder="."):
+    """
+    Imports the parameter sensitivities of a SENSIT run (sens.sv4).
+
+    Returns
+    -------
+    pd.DataFrame of d(concentration)/d(parameter), indexed by
+    parameter name (RADIUS, CO3UPT, SYMTCUPT, TEMP, SALINITY, PHBULK)
+    and r [mu]. Concentrations are in µM, parameters in the units of
+    the model input.
+    """
+    f = os.path.join(folder, "sens.sv4")
+    if not os.path.exists(f):
+        raise ValueError(f"No sensitivity output (sens.sv4) in folder {folder}")
+
+    with open(f) as fh:
+        names = fh.readline().lstrip("#").split()
+    data = pd.read_csv(f, sep=r"\s+", comment="#", header=None, names=names)
+
+    return data.set_index(["par", "r"])
+
+
+def write_misfit(data, folder="."):
+    """
+    Writes measured profiles for an ADJOINT or FIT run (misfit.dat).
+
+    Parameters
+    ----------
+    data : pd.DataFrame
+        Columns species (as the .sv4 files, or 'ph'), r [mu],
+        value [µM or pH] and sigma (same units).
+    """
+    with open(os.path.join(folder, "misfit.dat"), "w") as f:
+        f.write("# species r value sigma\n")
+        for _, d in data.iterrows():
+            f.write(f"{d['species']} {d['r']:.9e} {d['value']:.9e} {d['sigma']:.9e}\n")
+
+
+def import_gradient(folder="."):
+    """
+    Imports the misfit and its gradient of an ADJOINT run (grad.sv4).
+
+    Returns
+    -------
+    (misfit, pd.Series of d(misfit)/d(parameter) indexed by parameter name)
+    """
+    f = os.path.join(folder, "grad.sv4")
+    if not os.path.exists(f):
+        raise ValueError(f"No gradient output (grad.sv4) in folder {folder}")
+
+    with open(f) as fh:
+        misfit = float(fh.readline().split()[-1])
+    data = pd.read_csv(f, sep=r"\s+", comment="#", header=None,
+                       names=["par", "value", "grad"])
+
+    return misfit, data.set_index("par")["grad"]
+
+
+def write_fitpar(fitpars, folder="."):
+    """
+    Writes the parameters of a FIT run and their bounds (fitpar.dat).
+
+    Parameters
+    ----------
+    fitpars : dict
+        {name: (lo, hi)}, names as in import_sensitivity (RADIUS,
+        CO3UPT, SYMTCUPT, TEMP, SALINITY, PHBULK, CO2UPT, HCO3UPT,
+        VMAX), bounds in the units of the model input.
+    """
+    with open(os.path.join(folder, "fitpar.dat"), "w") as f:
+        f.write("# name lo hi\n")
+        for k, (lo, hi) in fitpars.items():
+            f.write(f"{k} {lo:.9e} {hi:.9e}\n")
+
+
+def import_fit(folder="."):
+    """
+    Imports the result of a FIT run (fit.sv4, fitcov.sv4, fitit.sv4).
+
+    Returns
+    -------
+    dict with
+        misfit : final misfit 1/2 sum(((model - value)/sigma)^2)
+        par : pd.DataFrame of the fitted value, its standard error
+            (sigma) and the bounds, indexed by parameter name
+        cov : pd.DataFrame, covariance of the fitted parameters
+        iterations : pd.DataFrame of misfit, damping mu, time [s] and
+            parameter values per Gauss-Newton iteration
+    """
+    f = os.path.join(folder, "fit.sv4")
+    if not os.path.exists(f):
+        raise ValueError(f"No fit output (fit.sv4) in folder {folder}")
+
+    with open(f) as fh:
+        misfit = float(fh.readline().split()[-1])
+    par = pd.read_csv(f, sep=r"\s+", comment="#", header=None,
+                      names=["par", "value", "sigma", "lo", "hi"])
+
+    f = os.path.join(folder, "fitcov.sv4")
+    with open(f) as fh:
+        names = fh.readline().lstrip("#").split()
+    cov = pd.read_csv(f, sep=r"\s+", comment="#", header=None, names=names)
+
+    f = os.path.join(folder, "fitit.sv4")
+    with open(f) as fh:
+        names = fh.readline().lstrip("#").split()
+    its = pd.read_csv(f, sep=r"\s+", comment="#", header=None, names=names)
+
+    return {
+        "misfit": misfit,
+        "par": par.set_index("par"),
+        "cov": cov.set_index("par"),
+        "iterations": its.set_index("it"),
+    }
+
+
+def import_continuation(folder="."):
+    """
+    Imports the solution branch of a CONTIN run (cont.sv4, contprof.sv4).
+
+    Returns
+    -------
+    (pd.DataFrame of the arclength s, parameter value, tangent
+    component tL, corrector iterations and shell values per point,
+    pd.DataFrame of the profiles of every CTPROF-th point indexed by
+    parameter value and r [mu]). Concentrations are in µM. tL changes
+    sign at turning points.
+    """
+    f = os.path.join(folder, "cont.sv4")
+    if not os.path.exists(f):
+        raise ValueError(f"No continuation output (cont.sv4) in folder {folder}")
+
+    with open(f) as fh:
+        names = fh.readline().lstrip("#").split()
+    points = pd.read_csv(f, sep=r"\s+", comment="#", header=None, names=names)
+    points["pH"] = -np.log10(points["h"] * 1e-6)
+
+    f = os.path.join(folder, "contprof.sv4")
+    with open(f) as fh:
+        names = fh.readline().lstrip("#").split()
+    profiles = pd.DataFrame(np.genfromtxt(f), columns=names)
+    profiles["pH"] = -np.log10(profiles["h"] * 1e-6)
+
+    return points, profiles.set_index([names[0], "r"])
+
+
+def write_batch(scenarios, folder=".", fname="batch.dat"):
+    """
+    Writes the parameter sets of a BATCH run (batch.dat) or of the
+    ROM training / queries (rom.dat, romq.dat).
+
+    Parameters
+    ----------
+    scenarios : pd.DataFrame
+        one row per scenario, columns parameter names of SPAR_INDEX,
+        values in the units of the model input.
+    """
+    with open(os.path.join(folder, fname), "w") as f:
+        f.write("# " + " ".join(scenarios.columns) + "\n")
+        for _, d in scenarios.iterrows():
+            f.write(" ".join(f"{v:.9e}" for v in d.values) + "\n")
+
+
+def write_threads(scenarios, folder="."):
+    """
+    Writes the scenarios of an MTHREAD run (mt.dat): one line of
+    NAME=value arguments per row of scenarios (columns of
+    RUNTIME_PARAMS, ITMAX, SLOWC).
+    """
+    with open(os.path.join(folder, "mt.dat"), "w") as f:
+        for _, d in scenarios.iterrows():
+            f.write(" ".join(f"{k}={v:.9e}" for k, v in d.items()) + "\n")
+
+
+def import_batch(folder="."):
+    """
+    Imports the shell values of a BATCH run (batch.sv4).
+
+    Returns
+    -------
+    pd.DataFrame indexed by scenario (row of batch.dat, from 1) of the
+    Newton iterations it (< 0: not converged), the parameter values
+    and the shell values. Concentrations are in µM.
+    """
+    f = os.path.join(folder, "batch.sv4")
+    if not os.path.exists(f):
+        raise ValueError(f"No batch output (batch.sv4) in folder {folder}")
+
+    with open(f) as fh:
+        names = fh.readline().lstrip("#").split()
+    data = pd.read_csv(f, sep=r"\s+", comment="#", header=None, names=names)
+    data["pH"] = -np.log10(data["h"] * 1e-6)
+
+    return data.set_index("scen")
+
+
+def import_rom(folder="."):
+    """
+    Imports the query results of a ROM run (rom.sv4).
+
+    Returns
+    -------
+    pd.DataFrame indexed by query (row of romq.dat, from 1) of it (0:
+    reduced solution, > 0: Newton iterations of the full solve taken
+    instead), the error estimate est, with ROMVERIFY the error err of
+    the reduced solution, the parameter values and the shell values.
+    Concentrations are in µM.
+    """
+    f = os.path.join(folder, "rom.sv4")
+    if not os.path.exists(f):
+        raise ValueError(f"No ROM output (rom.sv4) in folder {folder}")
+
+    with open(f) as fh:
+        names = fh.readline().lstrip("#").split()
+    data = pd.read_csv(f, sep=r"\s+", comment="#", header=None, names=names)
+    data["pH"] = -np.log10(data["h"] * 1e-6)
+
+    return data.set_index("scen")
+
+
+def import_surrogate(folder="."):
+    """
+    Imports the surrogate table of a SURR run (surr.bin, see surrtab.c).
+
+    Returns
+    -------
+    dict with the parameter names "pars", their bounds "lo", "hi", the
+    output names "outputs", their tolerances "tol", and per grid point
+    the centre "c" and inverse half width "w" of the basis (w = 0:
+    constant) per parameter, the surpluses "alpha" and "leaf" (unrefined
+    points, error estimate). Query with eval_surrogate.
+    """
+    f = os.path.join(folder, "surr.bin")
+    if not os.path.exists(f):
+        raise ValueError(f"No surrogate table (surr.bin) in folder {folder}")
+
+    raw = open(f, "rb").read()
+    nd, no, npt, lmax = np.frombuffer(raw, "i4", 4)
+    off = 16
+
+    def take(dtype, n):
+        nonlocal off
+        a = np.frombuffer(raw, dtype, n, off)
+        off += a.nbytes
+        return a
+
+    def names(n):
+        return [b.split(b"\0")[0].decode() for b in take("S16", n)]
+
+    pars = names(nd)
+    lo, hi = take("f8", nd), take("f8", nd)
+    outputs = names(no)
+    tol = take("f8", no)
+    pt = np.dtype([("pos", "i4", nd), ("leaf", "i4"), ("alpha", "f8", no)])
+    pts = take(pt, npt)
+
+    r = 1 << (lmax - 1)  # grid positions 0..r, levels as sglev()
+    pos = pts["pos"]
+    tz = np.zeros_like(pos)
+    p = pos.copy()
+    while True:
+        even = (p % 2 == 0) & (p > 0)
+        if not even.any():
+            break
+        tz += even
+        p = np.where(even, p // 2, p)
+    lev = np.where(pos == r // 2, 1, np.where((pos == 0) | (pos == r), 2, lmax - tz))
+    w = np.where(lev == 1, 0.0, 2.0 ** (lev - 1))
+
+    return {
+        "pars": pars,
+        "lo": lo,
+        "hi": hi,
+        "outputs": outputs,
+        "tol": pd.Series(tol, index=outputs),
+        "c": pos / r,
+        "w": w,
+        "alpha": pts["alpha"],
+        "leaf": pts["leaf"].astype(bool),
+    }
+
+
+def eval_surrogate(table, x):
+    """
+    Evaluates a surrogate table (import_surrogate), as surreval() of
+    surrtab.c.
+
+    Parameters
+    ----------
+    table : dict
+        from import_surrogate
+    x : pd.DataFrame
+        one row per query, columns the parameters of the table;
+        values outside the table are clamped to it
+
+    Returns
+    -------
+    (values, error estimates), pd.DataFrames indexed as x, columns the
+    outputs of the table
+    """
+    u = (x[table["pars"]].values - table["lo"]) / (table["hi"] - table["lo"])
+    u = np.clip(u, 0.0, 1.0)
+    d = 1.0 - np.abs(u[:, None, :] - table["c"][None]) * table["w"][None]
+    phi = np.clip(d, 0.0, None).prod(axis=2)
+    values = phi @ table["alpha"]
+    cover = (phi > 0.0) & table["leaf"][None]
+    err = np.where(cover[:, :, None], np.abs(table["alpha"])[None], 0.0).max(axis=1)
+
+    return (
+        pd.DataFrame(values, index=x.index, columns=table["outputs"]),
+        pd.DataFrame(err, index=x.index, columns=table["outputs"]),
+    )
+
+
+def c_run(path, defines=None, cflags=None, deps=None):
+    """
+    Compiles path (through the compile cache, c_cached) and runs it in
+    the current directory. Returns the exit status (os.system), see
+    run_status.
+    """
+    return os.system(c_cached(path, defines, cflags, deps))
+
+
+def c_cached(path, defines=None, cflags=None, deps=None):
+    """
+    Binary of path compiled with defines and cflags (default
+    CACHE_CFLAGS), from the compile cache: named by the hash of the
+    source, deps (included files: the nrutil.c copy, ...) and flags,
+    compiled only if missing.
+    A lock file keeps concurrent processes from compiling the same
+    binary twice. Returns the absolute path of the binary.
+    """
+    import fcntl
+    import platform
+
+    if cflags is None:
+        cflags = CACHE_CFLAGS
+    dflags = " " + cflags + "".join(" -D" + d for d in (defines or []))
+    sig = hashlib.sha1(dflags.encode())
+    if "native" in cflags:  # binary for this machine only
+        sig.update(platform.node().encode())
+    for p in [path] + list(deps or []):
+        with open(p, "rb") as f:
+            sig.update(f.read())
+    sig = sig.hexdigest()
+    exe = os.path.join(cache_dir, sig[:2], sig)
+    if os.path.exists(exe):
+        CACHE_STATS["hit"] += 1
+        return exe
+
+    os.makedirs(os.path.dirname(exe), exist_ok=True)
+    with open(exe + ".lock", "w") as lock:
+        fcntl.flock(lock, fcntl.LOCK_EX)
+        if os.path.exists(exe):  # compiled by another process meanwhile
+            CACHE_STATS["hit"] += 1
+            return exe
+        tmp = f"{exe}.{os.getpid()}"
+        if os.system(f"gcc{dflags} {path} -o {tmp} -lm") != 0:
+            raise RuntimeError(f"compiling {path} failed")
+        os.replace(tmp, exe)
+    CACHE_STATS["miss"] += 1
+    return exe
+
+
+def c_build(path, defines=None, cflags=None, exe="a.out", deps=None):
+    """
+    Compiles path to exe unless exe was built from the same source and
+    flags (hash in exe.sig). deps: included files (the nrutil.c copy,
+    ...), part of the hash.
+    Returns True if it compiled.
+    """
+    dflags = "".join(" -D" + d for d in (defines or []))
+    if cflags:
+        dflags = " " + cflags + dflags
+    sig = hashlib.sha1(dflags.encode())
+    for p in [path] + list(deps or []):
+        with open(p, "rb") as f:
+            sig.update(f.read())
+    sig = sig.hexdigest()
+    if os.path.exists(exe) and os.path.exists(exe + ".sig"):
+        with open(exe + ".sig") as f:
+            if f.read() == sig:
+                return False
+    if os.system("gcc" + dflags + " " + path + " -o " + exe + " -lm") != 0:
+        raise RuntimeError(f"compiling {path} failed")
+    with open(exe + ".sig", "w") as f:
+        f.write(sig)
+    return True
+
+
+def build_library(tpath="./py_run/", template=None, defines=None,
+                  cflags="-O2 -shared -fPIC -pthread", species=None):
+    """
+    Builds the solver as a shared library (LIBSOLVDE, C ABI of
+    libsolvde.h), compiled with DEFAULT_PARAMS as defaults. Returns
+    the path of libsolvde.so (libsolvde_<species>.so), see Solver.
+    """
+    lib = "libsolvde.so" if species is None else f"libsolvde_{species}.so"
+    if not os.path.exists(tpath):
+        os.mkdir(tpath)
+    if template is None:
+        template = os.path.join(resource_dir, "solvde42_py_temp.c")
+    make_runfile(DEFAULT_PARAMS, os.path.join(tpath, "libsolvde.c"), template)
+    cp_nrutil(tpath)
+
+    curdir = os.getcwd()
+    os.chdir(tpath)
+    try:
+        c_build("libsolvde.c", ["LIBSOLVDE"] + species_defines(species)
+                + list(defines or []), cflags, exe=lib, deps=["nrutil.c"])
+    finally:
+        os.chdir(curdir)
+    return os.path.abspath(os.path.join(tpath, lib))
+
+
+def build_core(template=None, defines=None, cflags="-O2", species=None):
+    """
+    Builds the extension zeebe_model._core (resources/_core.c on the
+    LIBSOLVDE build of template, DEFAULT_PARAMS as defaults) into
+    cache_dir/core, if it is missing or out of date, and loads it from
+    there (the package directory may be read-only). Returns the module;
+    one module per species set, zeebe_model._core_<species>.
+    """
+    import importlib.util
+    import sys
+    import sysconfig
+
+    import numpy
+
+    bdir = os.path.join(cache_dir, "core")
+    os.makedirs(bdir, exist_ok=True)
+    if template is None:
+        template = os.path.join(resource_dir, "solvde42_py_temp.c")
+    make_runfile(DEFAULT_PARAMS, os.path.join(bdir, "libsolvde.c"), template)
+    cp_nrutil(bdir)
+
+    mod = "_core" if species is None else "_core_" + species
+    exe = os.path.join(bdir, mod + sysconfig.get_config_var("EXT_SUFFIX"))
+    flags = (
+        f"{cflags} -shared -fPIC -pthread"
+        f" -I{sysconfig.get_paths()['include']} -I{numpy.get_include()} -I{bdir}"
+    )
+    built = c_build(
+        os.path.join(resource_dir, "_core.c"),
+        ["LIBSOLVDE", "COREMOD=" + mod] + species_defines(species)
+        + list(defines or []),
+        flags,
+        exe=exe,
+        deps=[os.path.join(bdir, "libsolvde.c"), os.path.join(bdir, "nrutil.c")],
+    )
+    name = "zeebe_model." + mod
+    if name in sys.modules:
+        if built:
+            raise RuntimeError(f"{name} rebuilt: restart Python to load it")
+        return sys.modules[name]
+    spec = importlib.util.spec_from_file_location(name, exe)
+    core = importlib.util.module_from_spec(spec)
+    spec.loader.exec_module(core)
+    sys.modules[name] = core
+    return core
+
+
+def build_daemon(tpath="./py_run/", template=None, defines=None, nthread=None,
+                 cflags="-O2 -pthread", species=None):
+    """
+    Builds the solver daemon (DAEMON build of LIBSOLVDE, protocol in
+    the template, DEFAULT_PARAMS as defaults), nthread workers
+    (default of the template: 4). Returns the path of solvd
+    (solvd_<species>), see Daemon.
+    """
+    exe = "solvd" if species is None else f"solvd_{species}"
+    if not os.path.exists(tpath):
+        os.mkdir(tpath)
+    if template is None:
+        template = os.path.join(resource_dir, "solvde42_py_temp.c")
+    make_runfile(DEFAULT_PARAMS, os.path.join(tpath, "solvd.c"), template)
+    cp_nrutil(tpath)
+
+    curdir = os.getcwd()
+    os.chdir(tpath)
+    try:
+        c_build("solvd.c", ["LIBSOLVDE", "DAEMON"] + species_defines(species)
+                + ([f"DMNTHR={nthread}"] if nthread else []) + list(defines or []),
+                cflags, exe=exe, deps=["nrutil.c"])
+    finally:
+        os.chdir(curdir)
+    return os.path.abspath(os.path.join(tpath, exe))
+
+
+class SolverError(RuntimeError):
+    """
+    A solve failed (native_run, Solver, Daemon); the process and its
+    state go on. Attributes: reason (SOLVER_REASONS), it (Newton
+    iteration), k (mesh point: singular block, or the largest
+    correction for "itmax"; 0: none).
+    """
+
+    def __init__(self, msg, reason, it=0, k=0):
+        super().__init__(msg, reason, it, k)
+        self.msg = msg
+        self.reason = SOLVER_REASONS.get(reason, reason)
+        self.it = it
+        self.k = k
+
+    def __str__(self):
+        return f"{self.msg} ({self.reason}, iteration {self.it}, mesh point {self.k})"
+
+
+# status codes of the solver (SV... in libsolvde.h)
+SOLVER_REASONS = {
+    1: "nomem",
+    2: "singular",
+    3: "itmax",
+    4: "param",
+    5: "fail",
+    6: "cancelled",
+}
+
+
+def run_status(status, tpath="."):
+    """
+    Raises on a non-zero exit status of a model run (os.system):
+    SolverError with the reason, iteration and mesh point the template
+    left in tpath/status.sv4 (nrfail), else RuntimeError (no status
+    file: crash, killed).
+    """
+    if status == 0:
+        return
+    fname = os.path.join(tpath, "status.sv4")
+    if not os.path.exists(fname):
+        raise RuntimeError(f"model run failed (exit status {status})")
+    with open(fname) as f:
+        fields = f.readlines()[1].split(None, 3)
+    msg = fields[3].strip() if len(fields) > 3 else ""
+    raise SolverError(msg, int(fields[0]), int(fields[1]), int(fields[2]))
+
+
+def warn_ignored(params, known):
+    """
+    Warns on the names of params not in known: parameters the solve
+    ignores (misspelt, or compile-time only). UALKBULK of make_params
+    is not used by the template and not reported.
+    """
+    import warnings
+
+    bad = [k for k in params if k not in known and k != "UALKBULK"]
+    if bad:
+        warnings.warn(f"model parameters ignored: {bad}", stacklevel=3)
+
+
+def native_run(params, itmax=400, slowc=0.3, species=None):
+    """
+    Solves in-process through zeebe_model._core (build_core), no
+    compile or files per run. Returns (pd.DataFrame, dict) as
+    parse_modelrun; the profiles share memory with the solver output.
+    Raises SolverError if the solve fails (e.g. itmax). Parameters
+    not in RUNTIME_PARAMS: the defaults of the build, with a warning.
+    """
+    warn_ignored(params, RUNTIME_PARAMS)
+    core = build_core(species=species)
+    par = {k: v for k, v in params.items() if k in RUNTIME_PARAMS}
+    par["ITMAX"] = itmax
+    par["SLOWC"] = slowc
+    try:
+        d = core.solve(par)
+    except core.SolverError as e:
+        raise SolverError(*e.args) from None
+
+    meta = {"it": int(d.pop("it"))}
+    df = pd.DataFrame(d, copy=False).set_index("r")
+    df["pH"] = -np.log10(df["h"] * 1e-6)
+    df["dic"] = df["co2"] + df["co3"] + df["hco3"]
+    df["alk"] = df["hco3"] + 2 * df["co3"] + df.get("boh4", 0) + df["oh"]
+    return df, meta
+
+
+class Solver:
+    """
+    Solves in this process through libsolvde (ctypes): no compile,
+    no files per solve.
+
+    >>> s = Solver(build_library())
+    >>> s.set(PHBULK=8.1, TEMP=23)
+    >>> s.solve()  # Newton iterations
+    >>> df = s.profiles()  # as parse_modelrun, index r
+
+    Parameters
+    ----------
+    lib : str
+        path of libsolvde.so (build_library)
+    params : dict
+        model parameters (RUNTIME_PARAMS, ITMAX, SLOWC), other
+        parameters: the defaults of the build
+    warm : bool
+        start each solve from the last solution (no uptake ramp)
+    """
+
+    def __init__(self, lib, params=None, warm=False):
+        import ctypes
+
+        self._lib = ctypes.CDLL(lib)
+        L = self._lib
+        L.solvde_create.restype = ctypes.c_void_p
+        L.solvde_set.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_double]
+        L.solvde_warm.argtypes = [ctypes.c_void_p, ctypes.c_int]
+        L.solvde_solve.argtypes = [ctypes.c_void_p]
+        L.solvde_error.argtypes = [ctypes.c_void_p] + 3 * [ctypes.c_void_p]
+        L.solvde_points.argtypes = [ctypes.c_void_p]
+        L.solvde_profile.argtypes = [
+            ctypes.c_void_p,
+            ctypes.c_char_p,
+            ctypes.POINTER(ctypes.c_double),
+            ctypes.c_int,
+        ]
+        L.solvde_destroy.argtypes = [ctypes.c_void_p]
+        self._h = L.solvde_create()
+        if not self._h:
+            raise MemoryError("solvde_create")
+        L.solvde_warm(self._h, int(warm))
+        self.set(**(params or {}))
+
+    def set(self, **params):
+        warn_ignored(params, RUNTIME_PARAMS + ["ITMAX", "SLOWC"])
+        for k, v in params.items():
+            if k not in RUNTIME_PARAMS + ["ITMAX", "SLOWC"]:
+                continue  # compile-time parameter of make_params
+            if self._lib.solvde_set(self._h, k.encode(), float(v)) != 0:
+                raise ValueError(f"unknown model parameter {k}")
+
+    def solve(self):
+        """
+        Newton iterations; raises SolverError if the solve fails (the
+        handle keeps the last solution, e.g. for a retry with warm).
+        """
+        import ctypes
+
+        it = self._lib.solvde_solve(self._h)
+        if it < 0:
+            i, k, msg = ctypes.c_int(), ctypes.c_int(), ctypes.c_char_p()
+            rc = self._lib.solvde_error(
+                self._h, ctypes.byref(i), ctypes.byref(k), ctypes.byref(msg)
+            )
+            raise SolverError(msg.value.decode(), rc, i.value, k.value)
+        return it
+
+    def profile(self, name):
+        import ctypes
+
+        n = self._lib.solvde_points(self._h)
+        buf = np.empty(n)
+        m = self._lib.solvde_profile(
+            self._h, name.encode(), buf.ctypes.data_as(ctypes.POINTER(ctypes.c_double)), n
+        )
+        if m < 0:
+            raise ValueError(f"no profile {name}")
+        return buf[:m]
+
+    def profiles(self):
+        """
+        Species profiles of the last solve as a pd.DataFrame indexed
+        by r, with pH, dic and alk as parse_modelrun.
+        """
+        d = {}
+        for k in ["r", "co2", "hco3", "co3", "h", "oh", "boh3", "boh4", "o2", "ca"]:
+            try:
+                d[k] = self.profile(k)
+            except ValueError:
+                pass
+        df = pd.DataFrame(d).set_index("r")
+        df["pH"] = -np.log10(df["h"] * 1e-6)
+        df["dic"] = df["co2"] + df["co3"] + df["hco3"]
+        df["alk"] = df["hco3"] + 2 * df["co3"] + df.get("boh4", 0) + df["oh"]
+        return df
+
+    def close(self):
+        if self._h:
+            self._lib.solvde_destroy(self._h)
+            self._h = None
+
+    def __del__(self):
+        self.close()
+
+
+class Daemon:
+    """
+    Client of the solver daemon (build_daemon): a long-lived process
+    solving the requests of all its clients concurrently, on a Unix
+    socket, warm starts from its recent solutions. No compile, files
+    or process per solve.
+
+    >>> d = Daemon(build_daemon())  # starts it, or Daemon(sock=...)
+    >>> df, meta = d.solve(PHBULK=8.1)  # as native_run
+    >>> i = d.submit(PHBULK=8.2)  # returns at once
+    >>> d.cancel(i)  # or d.result(i)
+
+    Parameters
+    ----------
+    exe : str
+        daemon to start (closed with the client); None: connect to
+        one running on sock
+    sock : str
+        path of the socket
+    timeout : float
+        [s] wait for a started daemon
+
+    One connection: not for several threads at a time; closing it
+    cancels its requests.
+    """
+
+    def __init__(self, exe=None, sock="./solvd.sock", timeout=10.0):
+        import socket
+        import subprocess
+        import time
+
+        self._proc = subprocess.Popen([exe, sock]) if exe else None
+        self._sock = sock
+        t = time.time()
+        while True:
+            self._s = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            try:
+                self._s.connect(sock)
+                break
+            except OSError:
+                self._s.close()
+                if self._proc is None or time.time() - t > timeout:
+                    self.close()
+                    raise
+                time.sleep(0.01)
+        self._f = self._s.makefile("rwb")
+        self._n = 0
+        self._done = {}  # answers read for other requests
+        self._shell = set()
+
+    def _send(self, line):
+        self._n += 1
+        self._f.write(f"{self._n} {line}\n".encode())
+        self._f.flush()
+        return str(self._n)
+
+    def _wait(self, rid):
+        while rid not in self._done:
+            head = self._f.readline().decode().split()
+            if not head:
+                raise ConnectionError("solver daemon closed the connection")
+            if head[1] == "ok":  # answer of a bin request: raw doubles
+                m, n = int(head[3]), len(head) - 4
+                rows = np.frombuffer(self._f.read(8 * m * n)).reshape(m, n)
+                self._done[head[0]] = (int(head[2]), head[4:], rows)
+            else:
+                rc, it, k = (int(v) for v in head[2:5])
+                self._done[head[0]] = SolverError(" ".join(head[5:]), rc, it, k)
+        return self._done.pop(rid)
+
+    def submit(self, shell=False, **params):
+        """
+        Queues a solve at params (RUNTIME_PARAMS, ITMAX, SLOWC; others:
+        the defaults of the build, with a warning), shell: values at
+        r[1] only. Returns the request id for result and cancel.
+        """
+        warn_ignored(params, RUNTIME_PARAMS + ["ITMAX", "SLOWC"])
+        par = " ".join(
+            f"{k}={float(v):.9e}"
+            for k, v in params.items()
+            if k in RUNTIME_PARAMS + ["ITMAX", "SLOWC"]
+        )
+        rid = self._send(f"solve {par} bin" + (" shell" if shell else ""))
+        if shell:
+            self._shell.add(rid)
+        return rid
+
+    def result(self, rid):
+        """
+        Waits for request rid: (pd.DataFrame, dict) as native_run, for
+        shell a pd.Series (name: r) instead of the pd.DataFrame.
+        Raises SolverError if the solve failed or was cancelled.
+        """
+        shell = rid in self._shell
+        self._shell.discard(rid)
+        a = self._wait(rid)
+        if isinstance(a, SolverError):
+            raise a
+        it, names, rows = a
+        df = pd.DataFrame(rows, columns=names).set_index("r")
+        df["pH"] = -np.log10(df["h"] * 1e-6)
+        df["dic"] = df["co2"] + df["co3"] + df["hco3"]
+        df["alk"] = df["hco3"] + 2 * df["co3"] + df.get("boh4", 0) + df["oh"]
+        meta = {"it": it}
+        return (df.iloc[0], meta) if shell else (df, meta)
+
+    def solve(self, shell=False, **params):
+        return self.result(self.submit(shell, **params))
+
+    def cancel(self, rid):
+        """
+        Stops request rid (queued: dropped, running: at its next
+        Newton iteration); its result raises SolverError. False: it
+        had ended already.
+        """
+        return not isinstance(self._wait(self._send(f"cancel {rid}")), SolverError)
+
+    def close(self):
+        if getattr(self, "_s", None) is not None:
+            if hasattr(self, "_f"):
+                self._f.close()
+            self._s.close()
+            self._s = None
+        if getattr(self, "_proc", None) is not None:
+            self._proc.terminate()
+            self._proc.wait()
+            self._proc = None
+            if os.path.exists(self._sock):
+                os.remove(self._sock)
+
+    def __del__(self):
+        self.close()
+
+
+def write_params(params, folder=".", itmax=400, slowc=0.3):
+    """
+    Writes the model parameters read at runtime (params.dat, the
+    RUNTIME_PARAMS of params, ITMAX and SLOWC).
+    """
+    with open(os.path.join(folder, "params.dat"), "w") as f:
+        for k in RUNTIME_PARAMS:
+            if k in params:
+                f.write(f"{k} {params[k]:.9e}\n")  # as make_runfile()
+        f.write(f"ITMAX {itmax:.0f}\nSLOWC {slowc:.2f}\n")
 
 
 def make_runfile(params, outpath="./py_run.c", template=None, itmax=100, slowc=0.3):
@@ -88,10 +945,20 @@ def make_runfile(params, outpath="./py_run.c", template=None, itmax=100, slowc=0
 
 
 def cp_nrutil(tpath="./py_run/"):
-    if not os.path.exists(tpath + "/nrutil.c"):
-        os.system(
-            f"cp {os.path.join(resource_dir, 'nrutil.c')} {os.path.join(tpath, 'nrutil.c')}"
-        )
+    """
+    Copies resources/nrutil.c (included by the model source) to tpath,
+    unless the copy there has the same content: copies of older
+    versions are replaced.
+    """
+    with open(os.path.join(resource_dir, "nrutil.c"), "rb") as f:
+        src = f.read()
+    dst = os.path.join(tpath, "nrutil.c")
+    if os.path.exists(dst):
+        with open(dst, "rb") as f:
+            if f.read() == src:
+                return
+    with open(dst, "wb") as f:
+        f.write(src)
 
 
 # parameter handling
@@ -137,6 +1004,434 @@ def make_params(
     return params
 
 
+# model parameters read by the binary at runtime (ModelParams of the
+# template); the binary is built once with DEFAULT_PARAMS
+RUNTIME_PARAMS = [
+    "RADIUS",
+    "CO3UPT",
+    "CO2UPT",
+    "HCO3UPT",
+    "PHBULK",
+    "DICBULK",
+    "SYMCO2UPT",
+    "SYMHCO3UPT",
+    "SYMTCUPT",
+    "VMAX",
+    "SYMDIST",
+    "REDS",
+    "SALINITY",
+    "TEMP",
+    "BORTBULK",
+    "ALKBULK",
+    "O2BULK",
+    "KS",
+    "DVDIT",
+    "BOH4UPT",
+]
+
+DEFAULT_PARAMS = make_params(
+    RADIUS=250.0,
+    CO3UPT=3.0e-9 / 3600.0,
+    CO2UPT=-2.0e-9 / 3600.0,
+    HCO3UPT=0.0,
+    PHBULK=8.063,
+    DICBULK=2035.0,
+    UALKBULK=2371.0,
+    BORMULT=1.0,
+    SYMCO2UPT=0.0,
+    SYMHCO3UPT=0.0,
+    SYMTCUPT=12e-9 / 3600.0,
+    VMAX=12e-8 / 3600.0,
+    SYMDIST=500.0,
+    REDS=1.0,
+    SALINITY=33.3,
+    TEMP=22.0,
+)
+
+
+# organism presets: one file per organism in preset_dir (NAME value per
+# line, # comments, read by the binary as -p file), loaded at import;
+# PRESET_DEFAULTS: values of the template for parameters not in make_params
+preset_dir = os.path.join(resource_dir, "presets")
+
+PRESET_DEFAULTS = {"ALKBULK": 0.0, "O2BULK": 210.0, "KS": 5.0, "DVDIT": 3.0, "BOH4UPT": 0.0}
+
+
+def read_preset(path):
+    """
+    Reads a preset file as a dict of model parameters.
+    """
+    par = {}
+    with open(path) as f:
+        for line in f:
+            tok = line.split("#")[0].split()
+            if len(tok) >= 2:
+                if tok[0] not in RUNTIME_PARAMS:
+                    raise ValueError(f"{path}: unknown model parameter {tok[0]}")
+                par[tok[0]] = float(tok[1])
+    return par
+
+
+def load_presets(folder=preset_dir):
+    """
+    Adds the presets of folder (*.dat, name: file name) to PRESETS,
+    replacing presets of the same name. Returns PRESETS.
+    """
+    for f in sorted(glob(os.path.join(folder, "*.dat"))):
+        PRESETS[os.path.basename(f)[:-4]] = read_preset(f)
+    return PRESETS
+
+
+PRESETS = {}
+load_presets()
+
+
+def preset(name, **overrides):
+    """
+    Model parameters of preset name (PRESETS) on DEFAULT_PARAMS and
+    PRESET_DEFAULTS, then overrides, e.g. preset("FORAMGSL", PHBULK=8.1).
+    BORTBULK follows an overridden SALINITY as in make_params unless
+    given too.
+    """
+    if name not in PRESETS:
+        raise ValueError(f"unknown preset {name}, one of {', '.join(PRESETS)}")
+    par = dict(DEFAULT_PARAMS)
+    par.update(PRESET_DEFAULTS)
+    par.update(PRESETS[name])
+    par.update(overrides)
+    if "SALINITY" in overrides and "BORTBULK" not in overrides:
+        par["BORTBULK"] = 416 * par["SALINITY"] / 35
+    return par
+
+
+def preset_scenarios(names, **overrides):
+    """
+    Scenarios of several presets (threads, Solver.set), one row per
+    name, columns RUNTIME_PARAMS.
+    """
+    return pd.DataFrame([preset(n, **overrides) for n in names], index=list(names))[
+        RUNTIME_PARAMS
+    ]
+
+
+# species sets (SPSET of the template): -D switches per set, each set a
+# binary of its own; None: the set of the template (as "full")
+SPECIES_SETS = {
+    "carb": [],
+    "boron": ["BORON"],
+    "oxygen": ["BORON", "OXYGEN"],
+    "full": ["BORON", "OXYGEN", "CALCIUM"],
+    "boristp": ["BORON", "BORISTP", "B10B11"],
+    "c13": ["C13ISTP", "CISTP"],
+    "c13boron": ["C13ISTP", "CISTP", "BORON"],
+    "c13oxygen": ["C13ISTP", "CISTP", "BORON", "OXYGEN"],
+    "c13full": ["C13ISTP", "CISTP", "BORON", "OXYGEN", "CALCIUM"],
+}
+
+
+def species_defines(species):
+    """
+    -D switches of a species set (SPECIES_SETS), [] for None.
+    """
+    if species is None:
+        return []
+    if species not in SPECIES_SETS:
+        raise ValueError(
+            f"unknown species set {species}, one of {', '.join(SPECIES_SETS)}"
+        )
+    return ["SPSET"] + SPECIES_SETS[species]
+
+
+def build_species(sets=None, cflags="-O2"):
+    """
+    Compiles the extension modules of the species sets (default: all
+    of SPECIES_SETS, see build_core) ahead of a sweep, so that
+    run(..., species=...) switches sets without compiling. Returns
+    {species: module}.
+    """
+    return {sp: build_core(cflags=cflags, species=sp) for sp in sets or SPECIES_SETS}
+
+
+# reaction network (GENRXN build): resources/networks/*.net -> C kernels
+network_dir = os.path.join(resource_dir, "networks")
+
+
+def read_network(path):
+    """
+    Reads a reaction network (format: see resources/networks/carbonate.net).
+    Returns {"species": {name: dict}, "rates": [dict], "reactions": [dict]};
+    conditions are frozensets of switches, "!X": X not defined. The
+    condition of a reaction includes those of its species.
+    """
+    net = {"species": {}, "rates": [], "reactions": []}
+
+    def where(lineno):
+        return f"{path}:{lineno}"
+
+    def cond(text):
+        return frozenset(text.split())
+
+    def side(text, lineno):
+        terms = []
+        for t in text.split("+"):
+            w = t.split()
+            if not w:
+                continue
+            n = int(w.pop(0)) if w[0].isdigit() else 1
+            if len(w) != 1 or n < 1:
+                raise ValueError(f"{where(lineno)}: bad term {t.strip()}")
+            name = w[0].strip("()")
+            if name not in net["species"]:
+                raise ValueError(f"{where(lineno)}: unknown species {name}")
+            if net["species"][name]["arr"] is None:
+                raise ValueError(f"{where(lineno)}: species {name} has no array")
+            terms.append((name, n, w[0].startswith("(")))
+        return terms
+
+    with open(path) as f:
+        for lineno, line in enumerate(f, 1):
+            line, _, c = line.split("#")[0].partition(" if ")
+            w = line.split()
+            if not w:
+                continue
+            if w[0] == "species":
+                if len(w) != 6:
+                    raise ValueError(f"{where(lineno)}: species: 5 fields")
+                net["species"][w[1]] = {
+                    "eq": "EQ" + w[1],
+                    "arr": None if w[2] == "-" else w[2],
+                    "d": w[3],
+                    "flux": None if w[4] == "-" else w[4],
+                    "bulk": None if w[5] == "-" else w[5],
+                    "cond": cond(c),
+                }
+            elif w[0] == "rate":
+                if len(w) < 3:
+                    raise ValueError(f"{where(lineno)}: rate NAME expression")
+                expr = line.split(None, 2)[2].strip()
+                net["rates"].append({"name": w[1], "expr": expr, "cond": cond(c)})
+            elif w[0] == "reaction":
+                head, _, eq = line.partition(":")
+                head = head.split()
+                lhs, sep, rhs = eq.partition("<=>")
+                if len(head) != 3 or not sep:
+                    raise ValueError(f"{where(lineno)}: reaction kf kb : A <=> B")
+                r = {
+                    "kf": head[1],
+                    "kb": None if head[2] == "-" else head[2],
+                    "lhs": side(lhs, lineno),
+                    "rhs": side(rhs, lineno),
+                    "cond": cond(c),
+                }
+                for n, _, _ in r["lhs"] + r["rhs"]:
+                    r["cond"] |= net["species"][n]["cond"]
+                net["reactions"].append(r)
+            else:
+                raise ValueError(f"{where(lineno)}: unknown keyword {w[0]}")
+    return net
+
+
+def _wrap(cond, lines):
+    """lines under #if of cond (frozenset of switches, !X: not defined)"""
+    if not cond:
+        return lines
+    c = " && ".join(
+        f"!defined({s[1:]})" if s.startswith("!") else f"defined({s})"
+        for s in sorted(cond, key=lambda s: s.lstrip("!"))
+    )
+    return [f"#if {c}"] + lines + ["#endif"]
+
+
+def _sum(lhs, terms):
+    """
+    C statement lhs(sum of terms); terms [(cond, " + text")], those of
+    one condition grouped, the condition common to all around it.
+    """
+    groups = {}
+    for c, t in terms:
+        groups.setdefault(c, []).append(t)
+    merged = True
+    while merged:  # same terms under X and !X: without X
+        merged = False
+        for c1, c2 in [(a, b) for a in groups for b in groups if a != b]:
+            x = sorted(c1 ^ c2, key=len)
+            if len(x) == 2 and x[1] == "!" + x[0] and groups[c1] == groups[c2]:
+                t = groups.pop(c1)
+                del groups[c2]
+                groups.setdefault(c1 & c2, []).extend(t)
+                merged = True
+                break
+    common = frozenset.intersection(*groups)
+    groups = {c - common: t for c, t in groups.items()}
+    head = groups.pop(frozenset(), [" + 0.0"])
+    head[0] = head[0][3:] if head[0][1] == "+" else "-" + head[0][3:]
+    out = ["   " + lhs + "".join(head)]
+    for c, ts in groups.items():
+        out += _wrap(c, ["      " + "".join(ts)])
+    if groups:
+        out.append("      );")
+    else:
+        out[-1] += ");"
+    return _wrap(common, out)
+
+
+def _merge(lines):
+    """joins #endif and #if of the same condition"""
+    out, stack, closed = [], [], None
+    for line in lines:
+        if line.startswith("#if ") and out and out[-1] == "#endif" and line == closed:
+            out.pop()
+            stack.append(line)
+            continue
+        if line.startswith("#if "):
+            stack.append(line)
+        elif line == "#endif":
+            closed = stack.pop()
+        out.append(line)
+    return out
+
+
+def gen_network(net, source="network"):
+    """
+    C source of the reaction kernels of net (read_network): rxnrates(),
+    rxnjac(), rxnres(), rxnleft() and rxnright(), included by the
+    template built with GENRXN (see difeq()). Straight-line code, per
+    species set only the preprocessor conditions of the network.
+    """
+    sp = net["species"]
+    rx = net["reactions"]
+
+    def stoich(r, name):
+        return sum(m for n, m, mod in r["rhs"] if n == name and not mod) - sum(
+            m for n, m, mod in r["lhs"] if n == name and not mod
+        )
+
+    def factors(side, p):  # of the mass action product at point p
+        return [f"{sp[n]['arr']}[{p}]" for n, m, _ in side for _ in range(m)]
+
+    def prod(side, p):
+        return "*".join(factors(side, p))
+
+    def term(v, text):  # " + text", " - 2.*text", ...
+        c = f"{abs(v)}.*" if abs(v) != 1 else ""
+        return (" + " if v > 0 else " - ") + c + text
+
+    def species(r):
+        return [n for n, _, _ in r["lhs"] + r["rhs"]]
+
+    rows = [n for n in sp if any(stoich(r, n) for r in rx)]
+
+    L = [
+        "/* ----------------------------------------------------------------",
+        "",
+        f"   reaction kernels of {source}, generated by",
+        "   boilerplate.write_network(): do not edit. Included by",
+        "   solvde42_py_temp.c built with GENRXN, see difeq().",
+        "",
+        "   ---------------------------------------------------------------- */",
+        "",
+    ]
+    for r in net["rates"]:
+        L += _wrap(r["cond"], [f"CTX double {r['name']};"])
+    L += ["", "void rxnrates()\t/* new rate constants, end of initk() */", "{"]
+    for r in net["rates"]:
+        L += _wrap(r["cond"], [f"   {r['name']} = {r['expr']};"])
+    L += ["}", ""]
+
+    # --- Jacobian: d(hh/D_a g_a)/dy_b at k-1 and k ---
+    L += [
+        "void rxnjac(k,indexv,s)\t/* reactions: d/dy at k-1 and k */",
+        "int k,indexv[];",
+        "double **s;",
+        "{",
+    ]
+    for a in rows:
+        L += _wrap(sp[a]["cond"], [f"   double w{sp[a]['arr']};"])
+    L.append("")
+    for a in rows:
+        L += _wrap(sp[a]["cond"], [f"   w{sp[a]['arr']} = hh/{sp[a]['d']};"])
+    for a in rows:
+        L += ["", f"   /* ----- {a} ----- */", ""]
+        cols = [n for n in sp if any(stoich(r, a) and n in species(r) for r in rx)]
+        for b in cols:
+            for p, col in (("k-1", "indexv"), ("k", "NE+indexv")):
+                terms = []
+                for r in rx:
+                    v = stoich(r, a)
+                    dirs = ((r["kf"], r["lhs"], 1), (r["kb"], r["rhs"], -1))
+                    for kr, side, sgn in dirs:
+                        nb = sum(m for n, m, _ in side if n == b)
+                        if v == 0 or kr is None or nb == 0:
+                            continue
+                        f = factors(side, p)
+                        f.remove(f"{sp[b]['arr']}[{p}]")  # d/dy_b: nb y_b^(nb-1)
+                        t = term(sgn * v * nb, "*".join([kr] + f))
+                        terms.append((r["cond"], t))
+                if terms:
+                    s = f"s[N2+{sp[a]['eq']}][{col}[{sp[b]['eq']}]]"
+                    L += _sum(f"{s} = w{sp[a]['arr']}*(", terms)
+    L += ["}", ""]
+
+    # --- residual: hh/D_a (g_a(k-1) + g_a(k)), q: net rates ---
+    L += [
+        "void rxnres(k,jsf,s)\t/* reactions: residual at k-1 and k */",
+        "int k,jsf;",
+        "double **s;",
+        "{",
+    ]
+    for i, r in enumerate(rx, 1):
+        L += _wrap(r["cond"], [f"   double q{i};"])
+    L.append("")
+    for i, r in enumerate(rx, 1):
+        q = ""
+        for kr, side, sgn in ((r["kf"], r["lhs"], ""), (r["kb"], r["rhs"], " - ")):
+            if kr is None:
+                continue
+            if side:
+                q += f"{sgn}{kr}*({prod(side, 'k-1')} + {prod(side, 'k')})"
+            else:  # zero order, both points
+                q += f"{sgn}2.*{kr}"
+        L += _wrap(r["cond"], [f"   q{i} = {q};"])
+    L.append("")
+    for a in rows:
+        terms = [
+            (r["cond"], term(stoich(r, a), f"q{i}"))
+            for i, r in enumerate(rx, 1)
+            if stoich(r, a)
+        ]
+        L += _sum(f"s[N2+{sp[a]['eq']}][jsf] += hh/{sp[a]['d']}*(", terms)
+    L += ["}", ""]
+
+    # --- boundary rows: plain flux (left), bulk value (right) ---
+    for fn, what, key, row, val in (
+        ("rxnleft", "left boundary: fluxes", "flux", "NRB+{}", "y[N2+{}][1]"),
+        ("rxnright", "right boundary: bulk values", "bulk", "{}", "y[{}][M]"),
+    ):
+        L += [f"void {fn}(jsf,s,y)\t/* {what} */", "int jsf;", "double **s,**y;", "{"]
+        for n, v in sp.items():
+            if v[key] is not None:
+                eq = v["eq"]
+                c = f"   s[{row.format(eq)}][jsf] = {val.format(eq)} - {v[key]};"
+                L += _wrap(v["cond"], [c])
+        L += ["}", ""]
+    return "\n".join(_merge(L))
+
+
+def write_network(network="carbonate", outpath="rxnnet.c"):
+    """
+    Generates the kernels of network (name in resources/networks or
+    path of a .net file) into outpath, the include file of a GENRXN
+    build (RXNFILE, default "rxnnet.c"). Returns outpath.
+    """
+    path = network
+    if not os.path.exists(path):
+        path = os.path.join(network_dir, network + ".net")
+    src = gen_network(read_network(path), os.path.basename(path))
+    with open(outpath, "w") as f:
+        f.write(src)
+    return outpath
+
+
 # run model
 def run(
     params,
@@ -145,6 +1440,12 @@ def run(
     template=None,
     itmax=400,
     slowc=0.3,
+    defines=None,
+    cflags=None,
+    sollib=None,
+    native=False,
+    species=None,
+    network=None,
 ):
     """
     Runs the model with the given parameter dict.
@@ -161,22 +1462,347 @@ def run(
         the boundary layer, try decreasing this number. IF you
         decrease this number, you should also increase itmax
         as convergence will be slower.
+    defines : list of str
+        compile-time switches of the template passed to gcc as
+        -D flags, e.g. ["AUTOMESH"]
+    cflags : str
+        gcc options, default CACHE_CFLAGS ("-O3 -march=native")
+    sollib : str
+        directory of a solution library (SOLLIB): the run starts from
+        the nearest stored solution and adds its own
+    native : bool
+        solve in-process through zeebe_model._core (native_run): no
+        files in tpath, meta holds only the Newton iterations "it".
+        Not with template, defines, cflags, sollib or network.
+    species : str
+        species set of SPECIES_SETS (e.g. "carb", "c13full"), None:
+        the set of the template. Each set has a binary of its own
+        (compile cache, _core_<species>), compiled on first use or by
+        build_species(); runs switching sets do not recompile.
+    network : str
+        reaction network (name in resources/networks, e.g. "carbonate",
+        or path of a .net file): the reactions of difeq() from kernels
+        generated from it (write_network, GENRXN build) instead of the
+        hand-written code.
+
+    The binary comes from the compile cache (c_cached, cache_dir): one
+    per rendered source, defines and cflags. It reads params, itmax and
+    slowc at runtime (params.dat). Templates without runtime parameters
+    (ModelParams) are rendered per run, i.e. cached per parameter set.
+    Parameters the binary does not read are ignored with a warning.
+    A failed solve raises SolverError (run_status), as native_run does.
     """
+    if native:
+        if template or defines or cflags or sollib or network:
+            raise ValueError("native: no template, defines, cflags, sollib, network")
+        return native_run(params, itmax=itmax, slowc=slowc, species=species)
+
     if not os.path.exists(tpath):
         os.mkdir(tpath)
+    if sollib is not None:
+        path = os.path.abspath(sollib)
+        defines = ["SOLLIB", "SLDIR=" + shlex.quote(f'"{path}"')] + list(
+            defines or []
+        )
+    defines = species_defines(species) + list(defines or [])
+    deps = []
+    if network is not None:
+        deps = [write_network(network, os.path.join(tpath, "rxnnet.c"))]
+        defines = ["GENRXN"] + defines
 
     if template is None:
         template = os.path.join(resource_dir, "solvde42_py_temp.c")
-    make_runfile(
-        params, os.path.join(tpath, modelname), template, itmax=itmax, slowc=slowc
+    with open(template, "r") as f:
+        text = f.read()
+    runtime = "ModelParams" in text
+    warn_ignored(
+        params,
+        [k for k in params if "**" + k + "**" in text]
+        + (RUNTIME_PARAMS if runtime else []),
     )
+    if runtime:
+        build = dict(DEFAULT_PARAMS)
+        build.update({k: v for k, v in params.items() if k not in RUNTIME_PARAMS})
+        make_runfile(build, os.path.join(tpath, modelname), template)
+        write_params(params, tpath, itmax=itmax, slowc=slowc)
+    else:
+        make_runfile(
+            params, os.path.join(tpath, modelname), template, itmax=itmax, slowc=slowc
+        )
 
     cp_nrutil(tpath)
+    for f in glob(os.path.join(tpath, "*.sv4")):  # species of other sets
+        os.remove(f)
 
     curdir = os.getcwd()
 
     os.chdir(tpath)
-    c_run(modelname)
-    os.chdir(curdir)
+    try:
+        deps = [os.path.basename(d) for d in deps] + ["nrutil.c"]
+        if runtime:
+            exe = c_cached(modelname, defines, cflags, deps)
+            status = os.system(exe + " -p params.dat")
+        else:
+            status = c_run(modelname, defines, cflags, deps)
+    finally:
+        os.chdir(curdir)
+    run_status(status, tpath)
 
     return parse_modelrun(tpath)
+
+
+def fit(params, data, fitpars, tpath="./py_run/", defines=None, **kwargs):
+    """
+    Fits model parameters to measured profiles (FIT run).
+
+    The model is solved for params, then the parameters in fitpars
+    are adjusted within their bounds by damped Gauss-Newton steps
+    (derivatives from the converged solution, each step started from
+    the previous solution).
+
+    Parameters
+    ----------
+    params : dict
+        start values, as for run
+    data : pd.DataFrame
+        measured profiles, see write_misfit
+    fitpars : dict
+        {name: (lo, hi)} of the fitted parameters, see write_fitpar
+    defines : list of str
+        further compile-time switches, e.g. ["SENSIT"]
+    kwargs
+        passed to run
+
+    Returns
+    -------
+    (result of import_fit, profiles at the fitted parameters as run)
+    """
+    if not os.path.exists(tpath):
+        os.mkdir(tpath)
+    write_misfit(data, tpath)
+    write_fitpar(fitpars, tpath)
+
+    profiles = run(params, tpath=tpath, defines=["FIT"] + list(defines or []),
+                   **kwargs)
+
+    return import_fit(tpath), profiles
+
+
+# parameter indices of the SPSHIFT section of the template
+SPAR_INDEX = {
+    "RADIUS": "SPRAD",
+    "CO3UPT": "SPCO3",
+    "SYMTCUPT": "SPSYM",
+    "TEMP": "SPTEMP",
+    "SALINITY": "SPSAL",
+    "PHBULK": "SPPH",
+    "CO2UPT": "SPCO2",
+    "HCO3UPT": "SPHCO3",
+    "VMAX": "SPVMAX",
+}
+
+
+def continuation(params, par, end, tpath="./py_run/", defines=None, **kwargs):
+    """
+    Follows the solution from params[par] to end (CONTIN run).
+
+    Pseudo-arclength continuation: each point is started from the
+    previous one, turning points of the branch are passed.
+
+    Parameters
+    ----------
+    params : dict
+        start values, as for run
+    par : str
+        continued parameter, one of SPAR_INDEX
+    end : float
+        end value of par, in the units of the model input
+    defines : list of str
+        further compile-time switches, e.g. ["SENSIT"]
+    kwargs
+        passed to run
+
+    Returns
+    -------
+    (result of import_continuation, profiles at par = end as run)
+    """
+    if par not in SPAR_INDEX:
+        raise ValueError(f"CONTIN: unknown parameter {par}")
+
+    defines = ["CONTIN", f"CTPAR={SPAR_INDEX[par]}", f"CTEND={end:.9e}"] + list(
+        defines or []
+    )
+    profiles = run(params, tpath=tpath, defines=defines, **kwargs)
+
+    return import_continuation(tpath), profiles
+
+
+def batch(params, scenarios, tpath="./py_run/", nlane=None, defines=None,
+          cflags="-O3 -march=native", **kwargs):
+    """
+    Solves the model for many parameter sets (BATCH run).
+
+    The model is solved for params, then for each scenario from the
+    converged solution, several scenarios at a time in the SIMD lanes
+    of the CPU (hence the default cflags).
+
+    Parameters
+    ----------
+    params : dict
+        base values, as for run
+    scenarios : pd.DataFrame
+        parameter sets, see write_batch
+    nlane : int
+        scenarios per sweep (default of the template: 8)
+    defines : list of str
+        further compile-time switches, e.g. ["BTPROF"]
+    kwargs
+        passed to run
+
+    Returns
+    -------
+    (result of import_batch, profiles at params as run)
+    """
+    bad = [c for c in scenarios.columns if c not in SPAR_INDEX]
+    if bad:
+        raise ValueError(f"BATCH: unknown parameters {bad}")
+    if not os.path.exists(tpath):
+        os.mkdir(tpath)
+    write_batch(scenarios, tpath)
+
+    defines = ["BATCH"] + ([f"NLANE={nlane}"] if nlane else []) + list(
+        defines or []
+    )
+    profiles = run(params, tpath=tpath, defines=defines, cflags=cflags, **kwargs)
+
+    return import_batch(tpath), profiles
+
+
+def rom(params, training, queries, tpath="./py_run/", verify=False,
+        defines=None, **kwargs):
+    """
+    Reduced-order model (ROM run): full solves of the training
+    scenarios, then the queries in their POD basis; a query outside
+    the training box or with a large error estimate is solved in full.
+
+    Parameters
+    ----------
+    params : dict
+        base values, as for run
+    training, queries : pd.DataFrame
+        parameter sets, see write_batch; the same columns
+    verify : bool
+        also solve every query in full (err column of import_rom)
+    defines : list of str
+        further compile-time switches, e.g. ["ROMTOL=1e-3"]
+    kwargs
+        passed to run
+
+    Returns
+    -------
+    (result of import_rom, profiles at params as run)
+    """
+    if list(training.columns) != list(queries.columns):
+        raise ValueError("ROM: training and queries differ in parameters")
+    bad = [c for c in training.columns if c not in SPAR_INDEX]
+    if bad:
+        raise ValueError(f"ROM: unknown parameters {bad}")
+    if not os.path.exists(tpath):
+        os.mkdir(tpath)
+    write_batch(training, tpath, "rom.dat")
+    write_batch(queries, tpath, "romq.dat")
+
+    defines = ["ROM"] + (["ROMVERIFY"] if verify else []) + list(defines or [])
+    profiles = run(params, tpath=tpath, defines=defines, **kwargs)
+
+    return import_rom(tpath), profiles
+
+
+def surrogate(params, ranges, tpath="./py_run/", defines=None, **kwargs):
+    """
+    Builds a surrogate table of the shell values (SURR run): the model
+    is solved on an adaptive sparse grid over the parameter box and the
+    interpolant is written to surr.bin, to be queried by
+    eval_surrogate or surrtab.c (C, shared library).
+
+    Parameters
+    ----------
+    params : dict
+        base values, as for run
+    ranges : dict
+        parameter name (of SPAR_INDEX) -> (lower, upper)
+    defines : list of str
+        further compile-time switches, e.g. ["SGTOL=1e-4"]
+    kwargs
+        passed to run
+
+    Returns
+    -------
+    (result of import_surrogate, profiles at params as run)
+    """
+    bad = [c for c in ranges if c not in SPAR_INDEX]
+    if bad:
+        raise ValueError(f"SURR: unknown parameters {bad}")
+    if not os.path.exists(tpath):
+        os.mkdir(tpath)
+    write_batch(pd.DataFrame(ranges, index=["lo", "hi"]), tpath, "surr.dat")
+
+    defines = ["SURR"] + list(defines or [])
+    profiles = run(params, tpath=tpath, defines=defines, **kwargs)
+
+    return import_surrogate(tpath), profiles
+
+
+def threads(params, scenarios, tpath="./py_run/", nthread=None, defines=None,
+            cflags="-O2 -pthread", **kwargs):
+    """
+    Solves the model for many parameter sets in threads of one process
+    (MTHREAD run), each scenario an independent solve from params.
+
+    Parameters
+    ----------
+    params : dict
+        base values, as for run
+    scenarios : pd.DataFrame
+        one row per scenario, columns of RUNTIME_PARAMS (and ITMAX,
+        SLOWC), values replacing those of params
+    nthread : int
+        threads (default of the template: 4)
+    defines : list of str
+        further compile-time switches
+    kwargs
+        passed to run
+
+    Returns
+    -------
+    (list of the results of parse_modelrun per scenario, None for a
+    failed one (reason, iteration, mesh point in mt.sv4), profiles
+    at params as run)
+    """
+    bad = [c for c in scenarios.columns if c not in RUNTIME_PARAMS + ["ITMAX", "SLOWC"]]
+    if bad:
+        raise ValueError(f"MTHREAD: unknown parameters {bad}")
+    if not os.path.exists(tpath):
+        os.mkdir(tpath)
+    write_threads(scenarios, tpath)
+
+    defines = ["MTHREAD"] + ([f"MTNTHR={nthread}"] if nthread else []) + list(
+        defines or []
+    )
+    profiles = run(params, tpath=tpath, defines=defines, cflags=cflags, **kwargs)
+
+    status = pd.read_csv(
+        os.path.join(tpath, "mt.sv4"),
+        sep=r"\s+",
+        comment="#",
+        header=None,
+        names=["scen", "rc", "it", "k", "t"],
+        index_col="scen",
+    )
+    results = [
+        parse_modelrun(os.path.join(tpath, "mt", str(i + 1)))
+        if status.loc[i + 1, "rc"] == 0
+        else None
+        for i in range(len(scenarios))
+    ]
+    return results, profiles
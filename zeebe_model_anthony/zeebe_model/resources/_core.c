@@ -0,0 +1,185 @@
+/* ----------------------------------------------------------------
+
+   _core.c: CPython extension zeebe_model._core, the solver in the
+   process of Python (LIBSOLVDE build of the template, libsolvde.c:
+   rendered by boilerplate.build_core(), which compiles this file).
+
+     from zeebe_model import _core
+     d = _core.solve({"PHBULK": 8.1, "TEMP": 23.})
+
+   d: "r" and the species (as the .sv4 files) -> 1-d arrays of the
+   mesh points, "it": Newton iterations (0-d). The arrays are the
+   rows of the solution y, not copies: they share one buffer, freed
+   with the last array. The GIL is released during the solve, i.e.
+   Python threads solve concurrently (one thread per solve, see
+   solvde_solve()). Parameters as mpread(), others: the defaults of
+   the build. A failed solve raises _core.SolverError (a
+   RuntimeError), args: message, reason (SV... of libsolvde.h),
+   Newton iteration, mesh point; the process goes on.
+   COREMOD: name of the module, one per species set (SPSET), e.g.
+   -DCOREMOD=_core_c13full.
+
+   ---------------------------------------------------------------- */
+
+#define PY_SSIZE_T_CLEAN
+#define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+#include <Python.h>
+#include <numpy/arrayobject.h>
+
+#include "libsolvde.c"	/* after Python.h: short macros (M, N2) */
+
+#ifndef COREMOD
+#define COREMOD _core
+#endif
+#define CORESTR(n) CORESTR_(n)
+#define CORESTR_(n) #n
+#define COREINIT(n) COREINIT_(n)
+#define COREINIT_(n) PyInit_##n
+
+static PyObject *coreerr;	/* SolverError			*/
+
+typedef struct {	/* solution owned by the arrays		*/
+   int m;
+   double *r,**y;
+} CORESOL;
+
+static void corefree(CORESOL *cs)
+{
+   free_dmatrix(cs->y,1,NE,1,MMAX);
+   free_dvector(cs->r,1,MMAX);
+   free(cs);
+}
+
+static void coredel(PyObject *cap)	/* capsule: last array gone */
+{
+   corefree((CORESOL *)PyCapsule_GetPointer(cap,NULL));
+}
+
+static int coreadd(PyObject *d,PyObject *cap,const char *name,double *v,
+                   npy_intp m)	/* d[name]: array on v, base cap */
+{
+   PyObject *a;
+
+   a = PyArray_SimpleNewFromData(1,&m,NPY_DOUBLE,v);
+   if(a == NULL) return(-1);
+   Py_INCREF(cap);
+   if(PyArray_SetBaseObject((PyArrayObject *)a,cap) < 0) {
+      Py_DECREF(a);
+      return(-1);
+   }
+   PyArray_CLEARFLAGS((PyArrayObject *)a,NPY_ARRAY_WRITEABLE);
+   if(PyDict_SetItemString(d,name,a) < 0) {
+      Py_DECREF(a);
+      return(-1);
+   }
+   Py_DECREF(a);
+   return(0);
+}
+
+static PyObject *core_solve(PyObject *self,PyObject *args)
+{
+   int a,it,rc,k;
+   double v;
+   const char *name,*msg;
+   char *sp;
+   Py_ssize_t pos=0;
+   PyObject *par,*key,*val,*d,*cap,*o;
+   SOLVDE *hd;
+   CORESOL *cs;
+
+   if(!PyArg_ParseTuple(args,"O!:solve",&PyDict_Type,&par)) return(NULL);
+   if((hd = solvde_create()) == NULL) return(PyErr_NoMemory());
+   while(PyDict_Next(par,&pos,&key,&val)) {
+      if((name = PyUnicode_AsUTF8(key)) == NULL) goto fail;
+      v = PyFloat_AsDouble(val);
+      if(v == -1.0 && PyErr_Occurred()) goto fail;
+      if(solvde_set(hd,name,v) != 0) {
+         PyErr_Format(PyExc_KeyError,"unknown model parameter %s",name);
+         goto fail;
+      }
+   }
+
+   Py_BEGIN_ALLOW_THREADS
+   it = solvde_solve(hd);
+   Py_END_ALLOW_THREADS
+   if(it < 0 || hd->m == 0) {
+      rc = solvde_error(hd,&it,&k,&msg);
+      if((o = Py_BuildValue("(siii)",msg,rc,it,k)) != NULL) {
+         PyErr_SetObject(coreerr,o);
+         Py_DECREF(o);
+      }
+      goto fail;
+   }
+
+   if((cs = (CORESOL *)malloc(sizeof(CORESOL))) == NULL) {
+      solvde_destroy(hd);
+      return(PyErr_NoMemory());
+   }
+   cs->m = hd->m;		/* solution: to the arrays */
+   cs->r = hd->r;
+   cs->y = hd->y;
+   hd->r = NULL;
+   hd->y = NULL;
+   solvde_destroy(hd);
+   if((cap = PyCapsule_New(cs,NULL,coredel)) == NULL) {
+      corefree(cs);
+      return(NULL);
+   }
+
+   if((d = PyDict_New()) == NULL) {
+      Py_DECREF(cap);
+      return(NULL);
+   }
+   if(coreadd(d,cap,"r",&cs->r[1],cs->m) < 0) goto faild;
+   for(a=1; a <= N2; a++) {
+      sp = spname(a);
+      if(strcmp(sp,"unused") == 0) continue;
+      if(coreadd(d,cap,sp,&cs->y[a][1],cs->m) < 0) goto faild;
+   }
+   if((o = PyArray_SimpleNew(0,NULL,NPY_INT)) == NULL) goto faild;
+   *(int *)PyArray_DATA((PyArrayObject *)o) = it;
+   if(PyDict_SetItemString(d,"it",o) < 0) {
+      Py_DECREF(o);
+      goto faild;
+   }
+   Py_DECREF(o);
+   Py_DECREF(cap);
+   return(d);
+
+faild:
+   Py_DECREF(d);
+   Py_DECREF(cap);
+   return(NULL);
+fail:
+   solvde_destroy(hd);
+   return(NULL);
+}
+
+static PyMethodDef coremethods[] = {
+   {"solve",core_solve,METH_VARARGS,
+    "solve(params) -> dict of arrays: r, species profiles, it"},
+   {NULL,NULL,0,NULL}
+};
+
+static struct PyModuleDef coremodule = {
+   PyModuleDef_HEAD_INIT,CORESTR(COREMOD),
+   "The solver in-process (LIBSOLVDE build), see solve().",-1,coremethods
+};
+
+PyMODINIT_FUNC COREINIT(COREMOD)(void)
+{
+   PyObject *m;
+
+   import_array();
+   if((m = PyModule_Create(&coremodule)) == NULL) return(NULL);
+   coreerr = PyErr_NewExceptionWithDoc(
+      "zeebe_model." CORESTR(COREMOD) ".SolverError",
+      "solve failed, args: message, reason, iteration, mesh point",
+      PyExc_RuntimeError,NULL);
+   if(coreerr == NULL || PyModule_AddObjectRef(m,"SolverError",coreerr) < 0) {
+      Py_XDECREF(coreerr);
+      Py_DECREF(m);
+      return(NULL);
+   }
+   return(m);
+}
@@ -0,0 +1,54 @@
+/* ----------------------------------------------------------------
+
+   libsolvde.h: C ABI of the solver as a shared library (LIBSOLVDE
+   build of solvde42_py_temp.c, see the comment there)
+
+     cc -O2 -shared -fPIC -pthread -DLIBSOLVDE run.c -o libsolvde.so -lm
+
+   The handle is opaque; only int, double and pointers cross the
+   interface (ctypes, cffi, Julia ccall, C++ extern "C"). Parameters
+   are the model parameters of mpread() (RADIUS, PHBULK, TEMP, ...,
+   ITMAX, SLOWC), in the units of the model input. Profiles are
+   written to buffers of the caller, solvde_points() values each.
+   A failed solve keeps the process and the handle (its status in
+   solvde_error(), the last solution in solvde_profile()).
+
+   ---------------------------------------------------------------- */
+
+#ifndef LIBSOLVDE_H
+#define LIBSOLVDE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct SOLVDE SOLVDE;
+
+#define SVOK    0	/* reasons: solvde_solve() -reason, solvde_error() */
+#define SVNOMEM 1	/* allocation failure, no thread		*/
+#define SVSING  2	/* singular matrix				*/
+#define SVITMAX 3	/* too many iterations (ITMAX)			*/
+#define SVPARAM 4	/* model parameters				*/
+#define SVFAIL  5	/* other					*/
+#define SVCANCEL 6	/* cancelled, solvde_cancel()			*/
+
+SOLVDE *solvde_create(void);		/* NULL: no memory		*/
+int  solvde_set(SOLVDE *h,const char *name,double v);	/* -1: unknown	*/
+void solvde_warm(SOLVDE *h,int on);	/* start from the last solution	*/
+int  solvde_solve(SOLVDE *h);		/* Newton iterations, < 0: -reason */
+void solvde_cancel(SOLVDE *h);		/* other thread: stop the solve	*/
+int  solvde_error(SOLVDE *h,int *it,int *k,const char **msg);
+					/* reason of the last solve (SVOK),
+					   iteration, mesh point, message;
+					   pointers may be NULL		*/
+int  solvde_points(SOLVDE *h);		/* of the last solve, 0: none	*/
+int  solvde_profile(SOLVDE *h,const char *name,double *buf,int n);
+					/* "r" or species, values written,
+					   -1: unknown name, no solution */
+void solvde_destroy(SOLVDE *h);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -2,11 +2,19 @@
 #include <stdlib.h> // To make it work on Mac OSX / Linux
 #include <stdio.h>
 
+#ifdef NRFAIL
+void NRFAIL();	/* of the caller: takes the error over if it can,
+		   i.e. does not return (no exit)		*/
+#endif
+
 void nrerror(error_text)
 char error_text[];
 {
 /* 6/93 dwg	void exit();   */
 
+#ifdef NRFAIL
+	NRFAIL(error_text);
+#endif
 	fprintf(stderr,"Numerical Recipes run-time error...\n");
 	fprintf(stderr,"%s\n",error_text);
 	fprintf(stderr,"...now exiting to system...\n");
@@ -83,6 +83,9 @@ Notation:
 
 #include <stdio.h>
 #include <math.h>
+#include <time.h>
+#include <string.h>
+#define NRFAIL nrfail	/* nrerror(): status of the solve first, see nrfail() */
 #include "nrutil.c"
 
 #define SQ(x) ((x)*(x))
@@ -96,6 +99,25 @@ Notation:
 /* -------- run options --------------- */
 
 #define INITA	       /* init arrays        */
+#define UAUTOMESH      /* RBULK and mesh from reaction-diffusion lengths */
+#define UEQFAR         /* AUTOMESH: mesh ends in the equilibrium far field, eqfar() */
+#define UISTPDEC       /* C13ISTP/BORISTP: isotopologues solved after main */
+#define ULININIT       /* initial guess: linearised r.-d. modes, lininit() */
+#define UQOICONV       /* stop solvde on converged shell quantities */
+#define UTRANSIENT     /* time-dependent run after light switch, transient() */
+#define UPERIODIC      /* periodic light/dark state (shooting), periodic() */
+#define USENSIT        /* parameter sensitivities of the solution, sensit() */
+#define UADJOINT       /* misfit gradient w.r.t. parameters, adjoint() */
+#define UFIT           /* fit parameters to measured profiles, fit() */
+#define UCONTIN        /* continuation in one parameter, contin() */
+#define UBATCH         /* many parameter sets in SIMD lanes, batch() */
+#define UROM           /* reduced-order model (POD) of many parameter sets, rom() */
+#define USURR          /* sparse-grid surrogate table of shell values, surr() */
+#define USOLLIB        /* warm start from a library of solutions, sllook() */
+#define UMTHREAD       /* scenarios in threads of one process, mthread() */
+#define ULIBSOLVDE     /* shared library, no main(), see solvde_create() */
+#define UDAEMON        /* LIBSOLVDE: solver daemon on a Unix socket, dmwork() */
+#define UGENRXN        /* reactions of difeq() from a network, RXNFILE */
 #define UPTAKE
 #define REACTION
 #define UANASOL    1   /* analytical solution */
@@ -123,6 +145,10 @@ Notation:
 #define NOK5
 */
 
+#ifdef EQFAR	/* see eqfar(); not with C13ISTP, BORISTP, GENRXN, CLPL, AGG ! */
+#define AUTOMESH
+#endif
+
 /* ------------------------------------------------------------------------ */
 
 
@@ -148,11 +174,15 @@ Notation:
 
 /* OXYGEN  can only be included if BORON is on!			*/
 /* CALCIUM can only be included if BORON and OXYGEN is on!	*/
+/* SPSET: species set from the -D flags of the build (BORON,	*/
+/* OXYGEN, CALCIUM, C13ISTP, CISTP, BORISTP, B10B11), one binary */
+/* per set, see spsets in boilerplate.py. Without: the set here. */
 
-
+#ifndef SPSET
 #define BORON		/* BORTBULK, after SALINITY	*/
 #define OXYGEN		/* O2BULK,   see FORAMS		*/
 #define CALCIUM
+#endif
 
 
 #ifdef BORON
@@ -162,17 +192,21 @@ Notation:
 #define F13_CO3		   /*  CO3UPT for calc.*/
 #define UF13_HCO3      /* HCO3UPT for calc.*/
 
+#ifndef SPSET
 #define UBORISTP
 #define B10B11		/* 10B and 11B are variables, not 11B and total B */
+#endif
 #ifdef BORISTP
 #define BSTAND 4.0014	/* (Hemming & Hanson,92), SRM 951 NBS */
 #define D11BSEA 39.5    /* delta 11B value of sea water */
 #define EPSB ((1.0194-1.)*1.e3)	/* Kakihana et al., 1977	*/
 #endif
 
+#ifndef SPSET
 #define UC13ISTP		/* include 13C Isotopes	        */
 #define UCISTP		/* off: total C and 13C		*/
 			/* on :     12C and 13C		*/
+#endif
 
 #ifdef C13ISTP
 #ifdef SYMTCIN
@@ -229,44 +263,76 @@ Notation:
 #endif
 
 
+#if defined (MTHREAD) || defined (LIBSOLVDE)	/* solver state per thread */
+#include <pthread.h>
+#include <setjmp.h>	/* nrfail()					*/
+#include <sys/stat.h>	/* mkdir()					*/
+#define CTX __thread
+#else
+#define CTX
+#endif
+
+/* -----  model parameters: the defaults below (**NAME**: set by
+          boilerplate.make_runfile), at runtime from mpread():
+          -p file (NAME value per line) and NAME=value arguments,
+          i.e. one binary for all parameter sets                 ----- */
+
+typedef struct {
+   double radius,co3upt,co2upt,hco3upt,phbulk,dicbulk,
+          symco2upt,symhco3upt,symtcupt,vmax,symdist,reds,
+          salinity,temp,bortbulk,alkbulk,o2bulk,ks,dvdit,boh4upt,slowc;
+   int itmax;
+} ModelParams;
+
+CTX ModelParams mp = {
+   **RADIUS**, **CO3UPT**, **CO2UPT**, **HCO3UPT**,
+   **PHBULK**, **DICBULK**,
+   **SYMCO2UPT**, **SYMHCO3UPT**, **SYMTCUPT**, **VMAX**,
+   **SYMDIST**, **REDS**,
+   **SALINITY**, **TEMP**, **BORTBULK**,
+   0.0, 210., 5., 3.0, 0.0,	/* ALKBULK (0: DICBULK), O2BULK, KS, DVDIT,
+				   BOH4UPT: set by presets, see mpread() */
+   **SLOWC**, **ITMAX**
+};
+
 /* Added 25/01/2017 by Branson and Holland! */
-#define RADIUS **RADIUS**      /* radius of foram [mu] diatoms */
+#define RADIUS SPAR(mp.radius,SPRAD)      /* radius of foram [mu] diatoms */
   /*  UPTAKE at the shell :           */
-#define CO3UPT   **CO3UPT**  /* .75/3.25 direct calcification */
-#define CO2UPT  **CO2UPT** /* 3+2[mol CO2 / s / foram] respiration */
+#define CO3UPT   SPAR(mp.co3upt,SPCO3)  /* .75/3.25 direct calcification */
+#define CO2UPT  SPAR(mp.co2upt,SPCO2) /* 3+2[mol CO2 / s / foram] respiration */
 #define TCO2UPT CO2UPT
-#define HCO3UPT **HCO3UPT**
+#define HCO3UPT SPAR(mp.hco3upt,SPHCO3)
 #define O2UPT (-CO2UPT)
 #define CAUPT   CO3UPT
 #define OHUPT 0.0
 #define HUPT  (0.0e-20)
-#define BOH4UPT 0.0   /* (1.0e-9/3600.*6.8e-5) */
+#define BOH4UPT mp.boh4upt   /* (1.0e-9/3600.*6.8e-5) */
 #define REDF  1.0   /* Redfield ratio O2=R*CO2 foram resp.*/
         /* see: O2UPT at the shell  */
-#define PHBULK  **PHBULK**    /* 8.2 /8.16      */
-#define DICBULK **DICBULK**       /* 2167.      */
+#define PHBULK  SPAR(mp.phbulk,SPPH)    /* 8.2 /8.16      */
+#define DICBULK mp.dicbulk       /* 2167.      */
 // #define UALKBULK **UALKBULK**    /* 2723.      */
 
 /*  UPTAKE of symbionts : 16.2 = 18 (gross) - 1.8 (symb. resp.)*/
 #define SYMBIONTS/*----     1. set CO2 and HCO3- uptake     --------*/
-#define SYMCO2UPT **SYMCO2UPT**  /* CO2  uptake by symbionts */
-#define SYMHCO3UPT  **SYMHCO3UPT**  /* HCO3 uptake by symbionts */
+#define SYMCO2UPT mp.symco2upt  /* CO2  uptake by symbionts */
+#define SYMHCO3UPT  mp.symhco3upt  /* HCO3 uptake by symbionts */
 #define SYMHUPT SYMHCO3UPT    /* H    uptake by symbionts */
 
 #define MIMECO2SYM/*----   2. MIME: set total carbon  uptake     ---*/
-#define SYMTCUPT **SYMTCUPT**
-#define VMAX **VMAX**    /* Michaelis-Menten max upt. for CO2 */
-#define KS 5.         /* [mumol/l] Michaelis-Menten half sat. */
-#define DVDIT 3.0   /* increase of uptake per iteration */
-#define SYMRAD (RADIUS+**SYMDIST**)   /* 500/200 outer radius for symbiont distribution */
+#define SYMTCUPT SPAR(mp.symtcupt,SPSYM)
+#define VMAX SPAR(mp.vmax,SPVMAX)    /* Michaelis-Menten max upt. for CO2 */
+#define KS mp.ks         /* [mumol/l] Michaelis-Menten half sat. */
+#define DVDIT mp.dvdit   /* increase of uptake per iteration */
+#define SYMRAD (RADIUS+mp.symdist)   /* 500/200 outer radius for symbiont distribution */
 #define SYMO2UPT (-(SYMCO2UPT+SYMHCO3UPT))
-#define REDS **REDS**    /* Redfield ratio symbiont photosynth.  */
-#define O2BULK 210.  /* [mumol/kg] Joergensen, 1985 */
+#define REDS mp.reds    /* Redfield ratio symbiont photosynth.  */
+#define O2BULK mp.o2bulk  /* 210. [mumol/kg] Joergensen, 1985 */
 
-#define SALINITY **SALINITY**
-#define TEMP **TEMP**
+#define SALINITY SPAR(mp.salinity,SPSAL)
+#define TEMP SPAR(mp.temp,SPTEMP)
 
-#define BORTBULK **BORTBULK** /* [mumol/kg], DOE94  */
+#define BORTBULK mp.bortbulk /* [mumol/kg], DOE94  */
 
 
 #ifdef CLPL
@@ -277,8 +343,12 @@ Notation:
 #ifdef AGG
 #define RBULK AGGRADIUS
 #else
+#ifdef AUTOMESH
+#define RBULK rbulkam                   /* set by automesh()  */
+#else
 #define RBULK (RADIUS*(double)BULKFAC)  /* "bulk radius" [mu] */
 #endif
+#endif
 #define CO2ATM 355.0                    /* [ppmv] */
 #define CABULK (10.3*1000.)             /* [mumol/kg]
 						Stumm and Morgan 1981 */
@@ -440,6 +510,13 @@ Notation:
 #ifdef CLPL
 #define M (int)(BULKFAC*4)
 #endif
+#ifdef AUTOMESH		 /* not with CLPL or AGG !		*/
+#undef M
+#define M mgrid		 /* number of mesh points, see automesh()*/
+#define MMAX 4000	 /* size of the mesh arrays		*/
+#else
+#define MMAX M
+#endif
 #define NSJ (2*NE+1)
 #define NCJ (NE-NB+1)
 #define NCK (M+1)
@@ -449,17 +526,236 @@ Notation:
 #define IMAX2 (IMAX-2)
 
 #define CONV 5.0e-6  /* convergence criterion def. = 5.0e-6 */
-#define SLOWC **SLOWC**    /* fraction of correction def. = 1.0 */
-#define ITMAX **ITMAX**     /* def. = 30 max. number of iterations */
+#define SLOWC mp.slowc    /* fraction of correction def. = 1.0 */
+#define ITMAX mp.itmax     /* def. = 30 max. number of iterations */
 
                    /*  Diatom-Michaelis-Menten for CO2 */
 /* #define MIMECO2DIA  */
 #define VMAXDIA 0.2    /* 0.2 [mol/kg/mu] Michaelis-Menten */
 #define KSDIA 2.0      /* [mumol/kg] Michaelis-Menten half sat. */
 
+#ifdef AUTOMESH		/* see automesh()				*/
+#define AMTOL  0.1	/* far-field truncation (RADIUS or SYMRAD)/RBULK */
+#define AMPPL  10.	/* mesh intervals per boundary layer thickness	*/
+#define AMGROW 1.05	/* max. ratio of neighbouring mesh intervals	*/
+#define AMNFAR 100	/* min. number of intervals RADIUS ... RBULK	*/
+#define AMNSYM 50	/* min. number of intervals in symbiont halo	*/
+#define AMLEQ  1.0	/* [mu] shorter r.-d. lengths: local equilibrium*/
+#define EQNL   7.	/* EQFAR: interface, r.-d. lengths beyond the halo */
+#define NSYMK(k) (symlen/(r[k]-r[k-1])) /* share of halo uptake	*/
+#else
+#define NSYMK(k) ((double)nsymrad)
+#endif
+
+#ifdef TRANSIENT
+#define TIMESTEP
+#endif
+#ifdef PERIODIC
+#define TIMESTEP
+#endif
+
+#ifdef TIMESTEP		/* see bdfstep(); not with CLPL or AGG !	*/
+#define TRV0 0.0	/* symbiont uptake / vmaxco2 in the dark	*/
+#define TRV1 1.0	/* symbiont uptake / vmaxco2 in the light	*/
+#define TRDT0 1.e-3	/* [s] first time step				*/
+#define TRDTMIN 1.e-8	/* [s] min. time step				*/
+#define TRDTMAX 600.	/* [s] max. time step				*/
+#define TRTOL 1.e-3	/* local error per step / bulk			*/
+#endif
+
+#ifdef TRANSIENT	/* see transient(): dark for t < 0		*/
+#define NTROUT 7	/* number of output times			*/
+#define TROUT {1.,10.,60.,300.,600.,1800.,3600.} /* [s] output times	*/
+#endif
+
+#ifdef PERIODIC		/* see periodic(): light first, then dark	*/
+#define PDPER   86400.	/* [s] period					*/
+#define PDLIGHT 43200.	/* [s] light per period				*/
+#define PDTOL   1.e-6	/* max. |c(PDPER) - c(0)| / bulk		*/
+#define PDCONV  1.e-9	/* solvde conv. of the time steps		*/
+#define PDEPS   1.e-4	/* max. perturbation / bulk (sensitivity)	*/
+#define PDNEWT  10	/* max. Newton iterations			*/
+#define PDNCYC  20	/* max. plain cycles				*/
+#define PDRHO   0.2	/* contraction per cycle above: shooting	*/
+#define PDKRYL  20	/* max. GMRES iterations per Newton iteration	*/
+#define PDKTOL  1.e-2	/* GMRES: rel. residual				*/
+#define NPDOUT  24	/* snapshots per period				*/
+#define PDNSTEP 20000	/* max. time steps per period			*/
+#endif
+
+#ifdef SENSIT
+#define SPSHIFT		/* parameters shifted at runtime, spdrdp()	*/
+#endif
+#ifdef ADJOINT
+#define SPSHIFT
+#define MISFIT		/* measured profiles, misread()			*/
+#endif
+#ifdef FIT
+#define SPSHIFT
+#define MISFIT
+#endif
+#ifdef CONTIN
+#define SPSHIFT
+#endif
+#ifdef BATCH
+#define SPSHIFT
+#endif
+#ifdef ROM
+#define SPSHIFT
+#endif
+#ifdef SURR
+#define SPSHIFT
+#endif
+
+#ifdef MISFIT		/* see misread()				*/
+#define MISFILE "misfit.dat"	/* data: species r value sigma	*/
+#define NMISMAX 10000	/* max. number of data			*/
+#endif
+
+#ifdef FIT		/* see fit()					*/
+#define FITFILE "fitpar.dat"	/* fitted parameters: name lo hi	*/
+#define FITIT   20	/* max. Gauss-Newton iterations			*/
+#define FITTOL  1.e-4	/* rel. decrease of the misfit per iteration	*/
+#define FITMU   1.e-3	/* initial Levenberg-Marquardt damping		*/
+#define FITNMU  8	/* max. damping increases per iteration		*/
+#define FITSTEP 0.5	/* max. rel. parameter change per step		*/
+#endif
+
+#ifdef CONTIN		/* see contin()					*/
+#ifndef CTPAR		/* -DCTPAR=SPSYM -DCTEND=...: other parameter	*/
+#define CTPAR   SPPH	/* parameter (index, see SPSHIFT)		*/
+#define CTEND   8.6	/* end value					*/
+#endif
+#define CTDS    0.02	/* first arclength step (scaled variables)	*/
+#define CTDSMIN 1.e-6	/* min. arclength step				*/
+#define CTDSMAX 1.0	/* max. arclength step				*/
+#define CTTOL   CONV	/* corrector: mean |dy|/scalv, as solvde()	*/
+#define CTNEWT  6	/* max. corrector iterations			*/
+#define CTNMAX  2000	/* max. number of points			*/
+#define CTPROF  10	/* profiles of every CTPROF-th point		*/
+#endif
+
+#ifdef BATCH		/* see batch(); -DBTSERIAL: solvde() per scenario */
+#define BTFILE  "batch.dat"	/* scenarios: parameter names, values	*/
+#ifndef NLANE
+#define NLANE   8	/* scenarios per sweep (2 AVX2 registers)	*/
+#endif
+#define BTCHUNK 200	/* mesh points per difeq() pass of a lane	*/
+#define BTPTOL  0.1	/* min. pivot / row norm, else new pivots	*/
+#endif
+
+#ifdef ROM		/* see rom(); -DROMVERIFY: solvde() per query too */
+#define ROMFILE  "rom.dat"	/* training scenarios, as BTFILE	*/
+#define ROMQFILE "romq.dat"	/* queries, the same parameters	*/
+#define ROMEPS  1.e-6	/* POD: min. rms amplitude of a mode / scalv	*/
+#define ROMMAX  40	/* max. POD modes				*/
+#define ROMNV   32	/* validation intervals of the estimate	*/
+#define ROMIT   20	/* max. Gauss-Newton iterations		*/
+#define ROMCONV 1.e-10	/* Gauss-Newton: rms change of y / scalv	*/
+#define ROMRATE 0.2	/* slower convergence: new Jacobian		*/
+#define ROMTOL  1.e-2	/* trust region: max. estimate est		*/
+#define ROMBOX  0.0	/* trust region: training box, rel. margin	*/
+#endif
+
+#ifdef SURR		/* see surr(); query: surrtab.c			*/
+#define SGFILE  "surr.dat"	/* parameter names, lower, upper values */
+#define SGTAB   "surr.bin"	/* table					*/
+#define SGTOL   1.e-3	/* surplus: rel. tolerance (concentrations / bulk) */
+#define SGDTOL  1.e-3	/* surplus: tolerance of pH and delta values	*/
+#define SGLMAX  8	/* max. level per parameter (>= 2)		*/
+#define SGR (1 << (SGLMAX-1))	/* grid positions 0..SGR		*/
+#define SGNMAX  2000	/* max. number of grid points (solves)		*/
+#define SGNVAL  16	/* random validation points (solves)		*/
+#define SGNOUT  (N2+3)	/* outputs: pH, shell values, d13C, d11B	*/
+#endif
+
+#if defined (SOLLIB) || defined (DAEMON)	/* key of a solution	*/
+#define SLNKEY  14	/* normalised parameters, see sllkey()		*/
+#define SLUPT   1.e-13	/* [mol/s] uptakes: unit of the key		*/
+#endif
+
+#ifdef SOLLIB		/* see sllook(); not with TIMESTEP !		*/
+#include <sys/stat.h>	/* mkdir()					*/
+#ifndef SLDIR
+#define SLDIR   "sollib"	/* library (-DSLDIR=\"path\")		*/
+#endif
+#ifndef SLTAG
+#define SLTAG   "default"	/* organism preset: part of the class	*/
+#endif
+#define SLMAXD  10.	/* max. key distance of a warm start		*/
+#define SLDUP   1.e-9	/* key distance: same entry, not stored	*/
+#define SLTAIL  1024	/* new entries merged into the tree at		*/
+#define SLPATH  1024	/* paths in the library, with SLDIR		*/
+#endif
+
+#ifdef MTHREAD		/* see mthread(); not with SOLLIB, CBNS !	*/
+#define MTFILE  "mt.dat"	/* scenarios: NAME=value arguments per line */
+#define MTDIR   "mt"	/* output files of scenario i: MTDIR/i		*/
+#ifndef MTNTHR
+#define MTNTHR  4	/* threads (-DMTNTHR=n)				*/
+#endif
+#define MTSTACK (64 << 20)	/* [bytes] stack of a solve		*/
+#endif
+
+#ifdef LIBSOLVDE	/* see solvde_create(); not with CBNS, MTHREAD !	*/
+#define LBNULL  "/dev/null"	/* output files of a solve		*/
+#define LBSTACK (64 << 20)	/* [bytes] stack of a solve		*/
+#endif
+
+#ifdef DAEMON		/* see dmwork(); with LIBSOLVDE only !		*/
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <signal.h>
+#define DMSOCK  "solvd.sock"	/* socket (argv[1] of the daemon)	*/
+#ifndef DMNTHR
+#define DMNTHR  4	/* workers: solver handles (-DDMNTHR=n)		*/
+#endif
+#define DMNKEEP 32	/* recent solutions kept as warm starts		*/
+#define DMMAXD  10.	/* max. key distance of a warm start (sllkey())	*/
+#endif
+
+#ifdef SPSHIFT		/* see spdrdp(); not with CLPL, AGG, TIMESTEP !	*/
+#define NSPAR  9	/* parameters, shifted at runtime by SPAR():	*/
+#define SPRAD  1	/*   RADIUS					*/
+#define SPCO3  2	/*   CO3UPT					*/
+#define SPSYM  3	/*   SYMTCUPT					*/
+#define SPTEMP 4	/*   TEMP					*/
+#define SPSAL  5	/*   SALINITY					*/
+#define SPPH   6	/*   PHBULK					*/
+#define SPCO2  7	/*   CO2UPT					*/
+#define SPHCO3 8	/*   HCO3UPT					*/
+#define SPVMAX 9	/*   VMAX					*/
+#define SPREL  1.e-5	/* rel. parameter step of dR/dp			*/
+#define SPUPT  1.e-12	/* [mol/s] step scale of zero uptakes		*/
+#define SPAR(p,i) ((p) + sdp[i])
+#else
+#define SPAR(p,i) (p)
+#endif
+
+#ifdef QOICONV		/* see qoival()					*/
+#define QOITOL  1.e-6	/* rel. tolerance (concentrations / bulk)	*/
+#define QOIDTOL 1.e-4	/* [permil] tolerance of delta values		*/
+#define NQOI (N2+4)	/* max. number of quantities of interest	*/
+#endif
+
+#ifdef LININIT		/* see lininit(); not with CLPL !		*/
+#define LIKMIN 1.e-3	/* kappa*(RBULK-RADIUS) below: conserved mode	*/
+#define LIFLOOR 0.01	/* min. initial concentration / bulk		*/
+#endif
+
+#ifdef ISTPDEC		/* see istpsub()				*/
+#define ISTPIT 5	/* max. number of main/isotopologue passes	*/
+#define DIFEQ difeqs
+#define MSUB(j) msub[j]
+#else
+#define DIFEQ difeq
+#define MSUB(j) (j)
+#endif
+
 /* ===================== global (begin) ==================== */
 
-FILE *fppara,*fpr,*fpanasol,
+CTX FILE *fppara,*fpr,*fpanasol,
      *fpco2,*fpco3,*fph,*fphco3,*fpoh,
      *fpdco2,*fpdco3,*fpdh,*fpdhco3,*fpdoh,
      *fpscale,*fpequi,*fpks,
@@ -499,7 +795,7 @@ FILE *fppara,*fpr,*fpanasol,
 #endif
      ;
 
-int debug02=0,ir,nsymrad
+CTX int debug02=0,ir,nsymrad
 #if defined (FORAMSYM2) || defined (CLPL)
      ,nsymradmin
 #endif
@@ -509,9 +805,36 @@ int debug02=0,ir,nsymrad
 #ifdef CBNSLOOP
     ,icl,n
 #endif
+#ifdef AUTOMESH
+    ,mgrid
+#endif
+#ifdef ISTPDEC
+    ,istpst	/* 0: main (1. pass), 1: isotopologues, 2: main	*/
+    ,nsub,msub[NE+1],*ivfull	/* subsystem -> full system	*/
+#endif
+#ifdef PERIODIC
+    ,pdnst,pdq[PDNSTEP]	/* recorded steps of a cycle: number, order */
+#endif
+#ifdef MISFIT
+    ,nmis,misa[NMISMAX+1]	/* data: number, species (< 0: pH)	*/
+#endif
+#ifdef SPSHIFT
+    ,spwarm=0	/* solvde from a converged solution: no ramp	*/
+#endif
+#ifdef SOLLIB
+    ,slwarm=0	/* initial guess from the library: no ramp	*/
+#endif
+#ifdef LIBSOLVDE
+    ,lbwarm=0	/* last solution of the handle: no ramp		*/
+#endif
+#ifdef ROM
+    ,rmnq,rmnb,rmnv	/* POD modes, sampled / validation intervals	*/
+    ,*rmblk	/* intervals: sampled, then validation		*/
+#endif
+    ,itsol	/* number of iterations of the last solvde call	*/
      ;
 
-double
+CTX double
        aux1,aux2,aux3,dt,h2obulk,surface,
        co2bulk,co3bulk,hco3bulk,dicbulk,dr,phbulk,hbulk,hco3bulk,ohbulk,
        co2flux,hflux,hco3flux,co3flux,ohflux, /* fluxes (left boundary) */
@@ -521,13 +844,13 @@ double
        km1s,
        k12,k21,k13,k31,k23,k32,kp4,km4,kp5h,km5h,km6,kp6,
        kp1s,Kh2co3,kh2co3,kw,ohminus,dummy,tmp,tmp1,tmp2,tmp3,tmp4,
-       alk[M+1],ata[M+1],ef[M+1],
-       co2[M+1],hplus[M+1],hco3[M+1],co3[M+1],oh[M+1],h2o[M+1],
-       r[M+1]
+       alk[MMAX+1],ata[MMAX+1],ef[MMAX+1],
+       co2[MMAX+1],hplus[MMAX+1],hco3[MMAX+1],co3[MMAX+1],oh[MMAX+1],h2o[MMAX+1],
+       r[MMAX+1]
 #ifdef C13ISTP
-      ,cco2[M+1],cco2bulk,cco2conv1,dcco2,cco2flux,cco2fluxs
-      ,hcco3[M+1],hcco3bulk,hcco3conv1,dhcco3,hcco3flux,hcco3fluxs
-      ,cco3[M+1],cco3bulk,cco3conv1,dcco3,cco3flux,cco3fluxs
+      ,cco2[MMAX+1],cco2bulk,cco2conv1,dcco2,cco2flux,cco2fluxs
+      ,hcco3[MMAX+1],hcco3bulk,hcco3conv1,dhcco3,hcco3flux,hcco3fluxs
+      ,cco3[MMAX+1],cco3bulk,cco3conv1,dcco3,cco3flux,cco3fluxs
       ,kp1scc,km1scc,kp4cc,km4cc,kp5cc,km5cc,tmp1cc,tmp2cc,tmp4cc
       ,alpha,alpha5,alphac,alphahc
       ,eps1,eps2,eps3,eps4,eps5,eps6	/* fractionation  between
@@ -551,17 +874,17 @@ double
  #endif
 #endif
 #ifdef OXYGEN
-      ,o2[M+1],o2bulk,o2conv1,do2,o2flux,o2fluxs
+      ,o2[MMAX+1],o2bulk,o2conv1,do2,o2flux,o2fluxs
 #endif
 #ifdef BORON
-      ,boh3[M+1],boh4[M+1],boh3bulk,boh4bulk,dboh3,dboh4,
+      ,boh3[MMAX+1],boh4[MMAX+1],boh3bulk,boh4bulk,dboh3,dboh4,
        boh3flux,boh4flux,boh3fluxs,boh4fluxs,
        kp7,km7,Kbor,kbdum
 #ifdef BORONRC4
        ,bortmp = 88
 #endif
 #ifdef BORISTP
-      ,bboh3[M+1],bboh4[M+1],bboh3bulk,bboh4bulk,dbboh3,dbboh4,
+      ,bboh3[MMAX+1],bboh4[MMAX+1],bboh3bulk,bboh4bulk,dbboh3,dbboh4,
        bboh3flux,bboh4flux,bboh3fluxs,bboh4fluxs,
        kp7bb,km7bb,
        d11boh3bulk,d11boh4bulk,btmp,alphab,alphabp,d11boh4upt,
@@ -569,27 +892,157 @@ double
 #endif
 #endif
 #ifdef CALCIUM
-      ,ca[M+1],cabulk,dca,caflux,cafluxs
+      ,ca[MMAX+1],cabulk,dca,caflux,cafluxs
 #endif
 #ifdef CLPL
-      ,difcofm[N2+1][M+1],fdrain,dumdr
+      ,difcofm[N2+1][MMAX+1],fdrain,dumdr
 #endif
 #ifdef AGG
       ,c0,co2upt,symco2upt,symo2upt,agguptvol
+#endif
+#ifdef AUTOMESH
+      ,rbulkam,symlen,lrd[N2+1],dlrd[N2+1]
+#ifdef EQFAR
+      ,eqrb	/* RBULK / r[M]: mesh ends at the interface	*/
+#endif
+#endif
+#ifdef TIMESTEP
+      ,trdt=0.0	/* gam*dt of the BDF step, 0: steady state	*/
+      ,**trhat	/* BDF history c^				*/
+#endif
+#ifdef PERIODIC
+      ,pddt[PDNSTEP],pdv[PDNSTEP]	/* step size, uptake	*/
+#endif
+#ifdef SPSHIFT
+      ,sdp[NSPAR+1]	/* parameter shifts, see SPAR()		*/
+#endif
+#ifdef MISFIT
+      ,misr[NMISMAX+1],misd[NMISMAX+1],miss[NMISMAX+1]	/* r value sigma */
+#endif
+#ifdef ROM
+      ,***rmphi	/* POD modes [point][variable][mode]		*/
+      ,**rmyb,**rmw	/* base solution, row weights [interval][row] */
 #endif
       ;
 
 
 #ifdef MIMECO2SYM
-      double dummyd,vmaxco2=VMAX,vmaxit
+      CTX double dummyd,vmaxco2,vmaxit
+#ifdef TIMESTEP
+      ,vmaxtr		/* vmaxco2 in the light, see bdfstep()	*/
+#endif
 #ifdef C13ISTP
       ,d13co2phyt,d13co2phytkm1,d13hco3phyt,d13hco3phytkm1,dumf,dumfkm1
       ,z,zkm1,dz_dx
 #endif
       ;
 #endif
-      int co2negflag = 0;
+      CTX int co2negflag = 0;
+
+/* -----  status of the last solve: solvde() and pinvs() return the
+          reason, nrerror() (svfail(), nrutil.c) sets it, see nrfail() ----- */
+
+#define SVOK    0	/* converged					*/
+#define SVNOMEM 1	/* allocation failure (nrutil.c)		*/
+#define SVSING  2	/* singular matrix (PINVS, BTPINVS, LUDCMP)	*/
+#define SVITMAX 3	/* too many iterations (ITMAX)			*/
+#define SVPARAM 4	/* model parameters, see mpread()		*/
+#define SVFAIL  5	/* other					*/
+#define SVCANCEL 6	/* cancelled (LIBSOLVDE: solvde_cancel())	*/
+
+      CTX int svrc=SVOK	/* reason					*/
+    ,svit	/* Newton iteration (0: not in solvde())		*/
+    ,svk	/* mesh point: singular block (M+1: right boundary),
+		   largest correction (ITMAX); 0: none			*/
+     ;
+      CTX char svmsg[128];	/* message (nrerror())			*/
+
+
+#ifdef LIBSOLVDE
+typedef struct SOLVDE {	/* handle of the library, see solvde_create() */
+   ModelParams mp;
+   int warm,rc,m;	/* warm starts, iterations, points of the last solve */
+   double *r,**y;	/* last solution				*/
+   int svrc,svit,svk;	/* status of the last solve, see solvde_error()	*/
+   char svmsg[128];
+   volatile int cancel;	/* solvde_cancel(): checked by solvde()		*/
+} SOLVDE;
+
+CTX SOLVDE *lbcur;	/* handle of the solve in this thread	*/
+CTX int lbkeep=0,lbknck;	/* thread solves again (dmwork()): arrays
+			   of lbmain() kept, c[] for NCK = lbknck	*/
+CTX double **lbky=NULL,**lbks,***lbkc;
+#endif
+
+#if defined (MTHREAD) || defined (LIBSOLVDE)
+CTX char ctxdir[256];	/* output directory of the thread, see mthread() */
+
+FILE *ctxopen(name,mode)	/* fopen(), files written: in ctxdir */
+char *name,*mode;
+{
+   char buf[1024];
+
+#ifdef LIBSOLVDE
+   if(lbcur != NULL && mode[0] != 'r') return(fopen(LBNULL,mode));
+#endif
+   if(ctxdir[0] == '\0' || mode[0] == 'r' || name[0] == '/')
+      return(fopen(name,mode));
+   snprintf(buf,sizeof(buf),"%s/%s",ctxdir,name);
+   return(fopen(buf,mode));
+}
+#else
+#define ctxopen fopen
+#endif
+
+#if defined (MTHREAD) || defined (LIBSOLVDE)
+CTX jmp_buf ctxjmp;	/* nrfail(): back to mtsolve(), lbrun()	*/
+CTX int ctxjmpon=0;
+#endif
+
+void nrfail(msg)	/* nrerror(): status of the solve; in a thread of
+			   mthread() or the library the solve ends here,
+			   back to mtsolve(), lbrun() (its memory and open
+			   files are not freed), the process goes on; else
+			   nrerror() exits, the status in status.sv4 (read
+			   by boilerplate.run())			*/
+char msg[];
+{
+   FILE *fp;
+
+   if(msg != svmsg) {		/* nrutil.c: allocation */
+      svrc = SVNOMEM;
+      svit = svk = 0;
+      snprintf(svmsg,sizeof(svmsg),"%s",msg);
+   }
+#if defined (MTHREAD) || defined (LIBSOLVDE)
+   if(ctxjmpon) longjmp(ctxjmp,1);
+#endif
+   if((fp = ctxopen("status.sv4","w")) != NULL) {
+      fprintf(fp,"# rc it k msg\n%d %d %d %s\n",svrc,svit,svk,svmsg);
+      fclose(fp);
+   }
+}
+
+void svfail(rc,msg)	/* failure outside solvde(): status, nrerror() */
+int rc;
+char *msg;
+{
+   svrc = rc;
+   svit = svk = 0;
+   snprintf(svmsg,sizeof(svmsg),"%s",msg);
+   nrerror(svmsg);
+}
+
+void svdump(),svabort();	/* failed solve, before solvde()	*/
 
+#ifdef GENRXN	/* reaction kernels generated from a network file (.net) by
+		   boilerplate.write_network(): rxnjac(), rxnres(), rxnleft(),
+		   rxnright(), rxnrates(); not with NOCO2 ... NOOH, CARTEST */
+#ifndef RXNFILE
+#define RXNFILE "rxnnet.c"
+#endif
+#include RXNFILE
+#endif
 
 /* ===================== global (end)   ==================== */
 
@@ -1607,6 +2060,22 @@ void initc()
 
 #endif /* DICBULK */
 
+#ifndef ALKBULK
+  if(mp.alkbulk > 0.0) {	/* ALK at runtime (presets): DIC from ALK */
+     alkbulk = mp.alkbulk;
+#ifdef BORON
+     co2bulk = (alkbulk-kw/hbulk+hbulk-kbdum*BORTBULK/(kbdum+hbulk)) /
+               (k1d/hbulk+2.*k1d*k2d/hbulk/hbulk);
+#else
+     co2bulk = (alkbulk-kw/hbulk+hbulk) /
+               (k1d/hbulk+2.*k1d*k2d/hbulk/hbulk);
+#endif
+     dicbulk  = co2bulk / a0;
+     hco3bulk = a1 * dicbulk;
+     co3bulk  = a2 * dicbulk;
+  }
+#endif
+
 #ifdef ALKBULK
 
   alkbulk  = ALKBULK;
@@ -2267,8 +2736,9 @@ void initk()
 #ifdef MIMECO2SYM
    /* if defined SYMTCUPT < VMAX 		*/
    /*   set vmaxco2 = SYMTCUPT.			*/
-   /* (else vmaxco2 = VMAX, see initializ. above)*/
+   /* (else vmaxco2 = VMAX)			*/
 
+   vmaxco2 = VMAX;
    if(SYMTCUPT < VMAX)
 		vmaxco2 = SYMTCUPT;
 #ifdef LDAT
@@ -2537,9 +3007,305 @@ void initk()
 
 #endif  /* PRINT  */
 
+#ifdef GENRXN
+   rxnrates();	/* new rate constants of the network */
+#endif
+
 }   /* --- end of initk --- */
 
 
+#ifdef AUTOMESH
+void automesh()
+{
+
+/* ======= choose RBULK, M and mesh from reaction-diffusion lengths ======= */
+
+   /* L_j = sqrt(D_j/k_j): reaction-diffusion length of species j,
+      k_j = first order loss rate of j at bulk concentrations (initk()).
+      Around the shell a perturbation of j decays ~ RADIUS/r exp(-(r-RADIUS)/L_j),
+      i.e. the boundary layer has the thickness
+                  delta_j = 1 / (1/RADIUS + 1/L_j).
+      Species without reaction (O2, Ca++) and all conserved
+      quantities (DIC, ALK) decay ~ RADIUS/r: delta = RADIUS is the
+      diffusive scale of the uptake. Species with L_j < AMLEQ
+      are in local equilibrium and are not resolved.
+
+      mesh:  spacing delta_min/AMPPL at the shell, growing by AMGROW
+             up to (RBULK-RADIUS)/AMNFAR, in the symbiont halo
+             not larger than (SYMRAD-RADIUS)/AMNSYM.
+      RBULK: the truncation of the 1/r far field (c = bulk at RBULK)
+             shifts the profiles by ~ RADIUS/RBULK (SYMRAD/RBULK
+             with symbionts) -> RBULK = RADIUS/AMTOL.
+      EQFAR: the mesh ends EQNL x max(L_j) beyond the halo (the
+             shell), where the reactions are at equilibrium, see
+             eqfar(); same spacing, fewer points.             */
+
+   int j,k,kref;
+   double kj[N2+1],dj[N2+1],dlmin,h0,hmax,hsym,rsym,dx,fac,rend;
+#ifdef EQFAR
+   double lmax=0.0;
+#endif
+   char *spn[N2+1];
+   clock_t clk;
+
+   clk = clock();
+
+   for(j=1; j<=N2; j++){
+      kj[j]  = 0.0;
+      dj[j]  = 0.0;
+      spn[j] = "";
+   }
+
+   dj[EQCO2]  = dco2;   kj[EQCO2]  = kp1s + kp4*ohbulk;   spn[EQCO2]  = "CO2";
+   dj[EQHCO3] = dhco3;  kj[EQHCO3] = km1s*hbulk+km4+km5h; spn[EQHCO3] = "HCO3-";
+   dj[EQCO3]  = dco3;   kj[EQCO3]  = kp5h*hbulk;          spn[EQCO3]  = "CO3--";
+   dj[EQHP]   = dh;     kj[EQHP]   = km1s*hco3bulk + kp5h*co3bulk + km6*ohbulk;
+   spn[EQHP]  = "H+";
+   dj[EQOH]   = doh;    kj[EQOH]   = kp4*co2bulk + km6*hbulk;
+   spn[EQOH]  = "OH-";
+#ifdef C13ISTP
+   dj[EQCCO2]  = dcco2;  kj[EQCCO2]  = kp1scc + kp4cc*ohbulk;
+   dj[EQHCCO3] = dhcco3; kj[EQHCCO3] = km1scc*hbulk+km4cc+km5cc;
+   dj[EQCCO3]  = dcco3;  kj[EQCCO3]  = kp5cc*hbulk;
+   spn[EQCCO2] = "13CO2"; spn[EQHCCO3] = "H13CO3-"; spn[EQCCO3] = "13CO3--";
+#endif
+#ifdef BORON
+   dj[EQBOH3] = dboh3;  spn[EQBOH3] = "B(OH)3";
+   dj[EQBOH4] = dboh4;  spn[EQBOH4] = "B(OH)4-";
+#ifdef BORONRC4
+   kj[EQOH]  += kp7*boh3bulk;
+   kj[EQBOH3] = kp7*ohbulk;
+   kj[EQBOH4] = km7;
+#endif
+#ifdef BORONRC3
+   kj[EQHP]  += km7*boh4bulk;
+   kj[EQBOH3] = kp7;
+   kj[EQBOH4] = km7*hbulk;
+#endif
+#ifdef BORISTP
+   dj[EQBBOH3] = dbboh3; spn[EQBBOH3] = "11B(OH)3";
+   dj[EQBBOH4] = dbboh4; spn[EQBBOH4] = "11B(OH)4-";
+#ifdef BORONRC4
+   kj[EQBBOH3] = kp7bb*ohbulk;
+   kj[EQBBOH4] = km7bb;
+#endif
+#ifdef BORONRC3
+   kj[EQBBOH3] = kp7bb;
+   kj[EQBBOH4] = km7bb*hbulk;
+#endif
+#endif
+#endif
+#if defined (OXYGEN) && !defined (BORISTP)
+   dj[EQO2] = do2;  spn[EQO2] = "O2";
+#endif
+#if defined (CALCIUM) && !defined (BORISTP)
+   dj[EQCA] = dca;  spn[EQCA] = "Ca++";
+#endif
+
+   /* ----- reaction-diffusion lengths and boundary layers ----- */
+
+   dlmin = RADIUS;
+   for(j=1; j<=N2; j++){
+      if(kj[j] > 0.0){
+         lrd[j]  = sqrt(dj[j]/kj[j]);
+         dlrd[j] = 1./(1./RADIUS + 1./lrd[j]);
+      } else {
+         lrd[j]  = -1.0;		/* no reaction */
+         dlrd[j] = RADIUS;
+      }
+      if((lrd[j] < 0.0 || lrd[j] >= AMLEQ) && dlrd[j] < dlmin)
+         dlmin = dlrd[j];
+   }
+
+   /* ----- RBULK ----- */
+
+   rbulkam = RADIUS/AMTOL;
+   rsym    = RADIUS;
+#ifdef SYMBIONTS
+   rsym    = SYMRAD;
+   if(SYMRAD/AMTOL > rbulkam) rbulkam = SYMRAD/AMTOL;
+#endif
+   rend = rbulkam;			/* end of the mesh */
+#ifdef EQFAR
+   for(j=1; j<=N2; j++) if(lrd[j] > lmax) lmax = lrd[j];
+   if(rsym + EQNL*lmax < rbulkam) rend = rsym + EQNL*lmax;
+#endif
+
+   /* ----- mesh: graded at the shell, capped in the halo ----- */
+
+   h0   = dlmin/AMPPL;
+   hmax = (rbulkam - RADIUS)/(double)AMNFAR;
+   hsym = (rsym - RADIUS)/(double)AMNSYM;
+   if(hsym <= 0.0 || hsym > hmax) hsym = hmax;
+   if(h0 > hsym) h0 = hsym;
+
+   do {
+     r[1] = RADIUS;
+     dx   = h0;
+     for(k=1; r[k] < rend && k < MMAX; k++){
+        if(r[k] < rsym && dx > hsym) dx = hsym;
+        if(dx > hmax) dx = hmax;
+        r[k+1] = r[k] + dx;
+        dx    *= AMGROW;
+     }
+     if(r[k] < rend){	/* MMAX too small: coarsen, caps too */
+        fprintf(fppara,"automesh: MMAX %d reached, h0 %e -> %e\n",
+                MMAX,h0,2.*h0);
+        h0 *= 2.;
+        if(hsym < h0) hsym = h0;
+        if(hmax < h0) hmax = h0;
+     }
+   } while(r[k] < rend);
+   mgrid = k;
+
+   /* stretch the mesh slightly, such that r[M] = RBULK (EQFAR: the
+      interface) */
+
+   fac = (rend - RADIUS)/(r[mgrid] - RADIUS);
+   kref = 1;
+   for(k=2; k<=mgrid; k++){
+      r[k] = RADIUS + (r[k] - RADIUS)*fac;
+      if(r[k] - r[k-1] < 0.99*hmax) kref = k;
+   }
+#ifdef EQFAR
+   eqrb = rbulkam/r[mgrid];
+#endif
+
+   clk = clock() - clk;
+
+   fprintf(fppara,"=====================");
+   fprintf(fppara,"============= automesh start =============== \n");
+   fprintf(fppara,"species   k [1/s]      L_rd [mu]    delta [mu]\n");
+   for(j=1; j<=N2; j++)
+      fprintf(fppara,"%-9s %e %e %e %s\n",spn[j],kj[j],lrd[j],dlrd[j],
+              (lrd[j] >= 0.0 && lrd[j] < AMLEQ) ? "(equilibrium)" : "");
+   fprintf(fppara,"delta_min       [mu]       %e \n",dlmin);
+   fprintf(fppara,"RBULK           [mu]       %e \n",rbulkam);
+#ifdef EQFAR
+   fprintf(fppara,"EQFAR interface [mu]       %e (L_rd max %e) \n",
+           r[mgrid],lmax);
+#endif
+   fprintf(fppara,"M mesh points              %d \n",mgrid);
+   fprintf(fppara,"h at the shell  [mu]       %e \n",r[2]-r[1]);
+   fprintf(fppara,"h in the halo   [mu]       %e \n",hsym);
+   fprintf(fppara,"h far field     [mu]       %e \n",r[mgrid]-r[mgrid-1]);
+   fprintf(fppara,"refinement zone [mu]       %e - %e \n",r[1],r[kref]);
+   fprintf(fppara,"automesh cpu time [s]      %e \n",
+           (double)clk/CLOCKS_PER_SEC);
+   fprintf(fppara,"=====================");
+   fprintf(fppara,"============= automesh end =============== \n");
+
+}   /* --- end of automesh --- */
+#endif
+
+
+#ifdef EQFAR
+void eqrobin(a,nu,dj,cb,w,jsf,indexv,s,y)	/* row a: Phi, see eqfar() */
+int a,jsf,indexv[];
+double nu[],dj[],cb[],w,**s,**y;
+{
+   int b;
+
+   s[a][jsf] = 0.0;
+   for(b=1; b <= N2; b++) {
+      if(nu[b] == 0.0) continue;
+      s[a][NE+indexv[b]]    = nu[b]*dj[b];
+      s[a][NE+indexv[N2+b]] = nu[b]*dj[b]*w;
+      s[a][jsf] += nu[b]*dj[b]*(y[b][M] - cb[b] + w*y[N2+b][M]);
+   }
+}
+
+void eqmass(a,p,q,u,cb,jsf,indexv,s,y)	/* row a: c_p c_q / c_u as in */
+int a,p,q,u,jsf,indexv[];		/* the bulk (u = 0: c_p c_q)	*/
+double cb[],**s,**y;
+{
+   s[a][NE+indexv[p]] = y[q][M]/(cb[p]*cb[q]);
+   s[a][NE+indexv[q]] = y[p][M]/(cb[p]*cb[q]);
+   s[a][jsf] = y[p][M]*y[q][M]/(cb[p]*cb[q]) - 1.0;
+   if(u > 0) {
+      s[a][NE+indexv[u]] = -1.0/cb[u];
+      s[a][jsf] += 1.0 - y[u][M]/cb[u];
+   }
+}
+
+void eqfar(jsf,indexv,s,y)	/* right boundary at the interface r[M] */
+int jsf,indexv[];
+double **s,**y;
+{
+
+/* ============== equilibrium far field: r[M] ... RBULK ============== */
+
+   /* No sources and the reactions at equilibrium: the D-weighted
+      conserved quantities, in which the reaction terms cancel,
+          Phi = sum_j nu_j D_j c_j
+          DIC:   nu = 1 for CO2, HCO3-, CO3--
+          ALK:   nu = 1, 2, 1, -1, 1 for HCO3-, CO3--, OH-, H+, B(OH)4-
+          B_T:   nu = 1 for B(OH)3, B(OH)4-;  O2, Ca++ alone,
+      solve Phi'' + 2/r Phi' = 0:  Phi = A + B/r, Phi = bulk at
+      RBULK. At r = r[M] this is the Robin condition
+          Phi - Phi_bulk + r (1 - r/RBULK) Phi' = 0.
+      The species follow from mass action, K1, K2, Kw and KB being
+      the ratios of the bulk values (initk()).  Rows: DIC (CO2),
+      K1 (HCO3-), K2 (CO3--), ALK (H+), Kw (OH-), B_T (B(OH)3),
+      KB (B(OH)4-), O2, Ca++.                                      */
+
+   int a,b;
+   double w,nu[N2+1],dj[N2+1],cb[N2+1];
+
+   for(a=1; a <= N2; a++) {
+      for(b=1; b <= NE; b++) s[a][NE+indexv[b]] = 0.0;
+      nu[a] = dj[a] = cb[a] = 0.0;
+   }
+   dj[EQCO2]  = dco2;   cb[EQCO2]  = co2bulk;
+   dj[EQHCO3] = dhco3;  cb[EQHCO3] = hco3bulk;
+   dj[EQCO3]  = dco3;   cb[EQCO3]  = co3bulk;
+   dj[EQHP]   = dh;     cb[EQHP]   = hbulk;
+   dj[EQOH]   = doh;    cb[EQOH]   = ohbulk;
+#ifdef BORON
+   dj[EQBOH3] = dboh3;  cb[EQBOH3] = boh3bulk;
+   dj[EQBOH4] = dboh4;  cb[EQBOH4] = boh4bulk;
+#endif
+#ifdef OXYGEN
+   dj[EQO2]   = do2;    cb[EQO2]   = o2bulk;
+#endif
+#ifdef CALCIUM
+   dj[EQCA]   = dca;    cb[EQCA]   = cabulk;
+#endif
+   w = r[M]*(1.0 - r[M]/RBULK);
+
+   nu[EQCO2] = nu[EQHCO3] = nu[EQCO3] = 1.0;		/* DIC */
+   eqrobin(EQCO2,nu,dj,cb,w,jsf,indexv,s,y);
+   nu[EQCO2] = 0.0;					/* ALK */
+   nu[EQCO3] = 2.0;
+   nu[EQOH]  = 1.0;
+   nu[EQHP]  = -1.0;
+#ifdef BORON
+   nu[EQBOH4] = 1.0;
+#endif
+   eqrobin(EQHP,nu,dj,cb,w,jsf,indexv,s,y);
+   for(a=1; a <= N2; a++) nu[a] = 0.0;
+#ifdef BORON
+   nu[EQBOH3] = nu[EQBOH4] = 1.0;			/* B_T */
+   eqrobin(EQBOH3,nu,dj,cb,w,jsf,indexv,s,y);
+   nu[EQBOH3] = nu[EQBOH4] = 0.0;
+   eqmass(EQBOH4,EQBOH4,EQHP,EQBOH3,cb,jsf,indexv,s,y);	/* KB */
+#endif
+#ifdef OXYGEN
+   nu[EQO2] = 1.0;
+   eqrobin(EQO2,nu,dj,cb,w,jsf,indexv,s,y);
+   nu[EQO2] = 0.0;
+#endif
+#ifdef CALCIUM
+   nu[EQCA] = 1.0;
+   eqrobin(EQCA,nu,dj,cb,w,jsf,indexv,s,y);
+#endif
+   eqmass(EQHCO3,EQHCO3,EQHP,EQCO2,cb,jsf,indexv,s,y);	/* K1 */
+   eqmass(EQCO3,EQCO3,EQHP,EQHCO3,cb,jsf,indexv,s,y);	/* K2 */
+   eqmass(EQOH,EQHP,EQOH,0,cb,jsf,indexv,s,y);		/* Kw */
+}
+#endif
+
+
 #ifdef CLPL
 void initdm()
 {
@@ -2963,221 +3729,4200 @@ void inita()
 
 
 
-/* =========================================================
-   =========================================================
-
-             Numerical Recipes   (begin)
-
-   =========================================================
-   ========================================================= */
-
+/* -----   store data: y -> global arrays used by difeq   ----- */
 
-void solvde(itmax,conv,slowc,scalv,indexv,ne,nb,m,y,c,s)
-       /* ----- 6/93 dwg Numerical Recipes: float -> double ----- */
-int itmax,ne,nb,m;
-double conv,slowc,scalv[],**y,***c,**s;
-int indexv[];
+void ystorek(j,y)	/* mesh point j */
+int j;
+double **y;
 {
-	int ic1,ic2,ic3,ic4,it,j,j1,j2,j3,j4,j5,j6,j7,j8,j9;
-	int jc1,jcf,jv,k,k1,k2,km,kp,nvars,*kmax,*ivector();
-	double err,errj,fac,vmax,vz,*ermax,*dvector(),x;
-	void pinvs(),difeq(),red(),bksub(),nrerror(),free_dvector(),
-		free_ivector();
-	kmax=ivector(1,ne);
-	ermax=dvector(1,ne);
-	k1=1;
-	k2=m;
-	nvars=ne*m;
-	j1=1;
-	j2=nb;
-	j3=nb+1;
-	j4=ne;
-	j5=j4+j1;
-	j6=j4+j2;
-	j7=j4+j3;
-	j8=j4+j4;
-	j9=j8+j1;
-	ic1=1;
-	ic2=ne-nb;
-	ic3=ic2+1;
-	ic4=ne;
-	jc1=1;
-	jcf=ic3;
-	for (it=1;it<=itmax;it++) {
-
-/* -----   store data: -> difeq   ----- */
-
-          for(j=1; j <= M; j++) {
-            co2[j] = y[EQCO2][j];
-           hco3[j] = y[EQHCO3][j];
+     co2[j] = y[EQCO2][j];
+    hco3[j] = y[EQHCO3][j];
 #ifdef EQCO3
-            co3[j] = y[EQCO3][j];
-          hplus[j] = y[EQHP][j];
-             oh[j] = y[EQOH][j];
+     co3[j] = y[EQCO3][j];
+   hplus[j] = y[EQHP][j];
+      oh[j] = y[EQOH][j];
 #endif
 #ifdef C13ISTP
-           cco2[j] = y[EQCCO2][j];
-          hcco3[j] = y[EQHCCO3][j];
-           cco3[j] = y[EQCCO3][j];
+    cco2[j] = y[EQCCO2][j];
+   hcco3[j] = y[EQHCCO3][j];
+    cco3[j] = y[EQCCO3][j];
 #endif
 #ifdef OXYGEN
-             o2[j] = y[EQO2][j];
+      o2[j] = y[EQO2][j];
 #endif
 #ifdef BORON
-           boh3[j] = y[EQBOH3][j];
-           boh4[j] = y[EQBOH4][j];
+    boh3[j] = y[EQBOH3][j];
+    boh4[j] = y[EQBOH4][j];
 #ifdef BORISTP
-           bboh3[j] = y[EQBBOH3][j];
-           bboh4[j] = y[EQBBOH4][j];
+    bboh3[j] = y[EQBBOH3][j];
+    bboh4[j] = y[EQBBOH4][j];
 #endif
 #endif
 #ifdef CALCIUM
-             ca[j] = y[EQCA][j];
+      ca[j] = y[EQCA][j];
 #endif
-          }
+}
 
-		co2negflag = 0;
-		for(j=1;j<=M;j++){
-		 	if(y[EQCO2][j] < 0.0) co2negflag = 1;
-		}
-      #ifdef PRINT
-		if(co2negflag == 1)
-			printf("\n ! too bad - CO2 is negative !\n");
-      #endif
-#ifdef MIMECO2SYM
-		/* set vmaxit: linear increase with step of iteration (it)*/
-		/* to avoid negative values of co2. Neg. values occur	*/
-		/* if the initial uptake is too large.			*/
-		/* Vmax(it) = a * it					*/
-		/* slope: a = dV/d(it)					*/
+void ystore(y)
+double **y;
+{
+   int j;
 
-		if(it <= (int)(vmaxco2*1.e9*3600./DVDIT))
-			vmaxit = DVDIT*(double)(it*1.e-9/3600.);
-		if(it >  (int)(vmaxco2*1.e9*3600./DVDIT))
-			vmaxit = vmaxco2;
+   for(j=1; j <= M; j++) ystorek(j,y);
+}
 
-      #ifdef PRINT
-		printf("\n-----  before iteration ------\n");
-		printf("%d co2negflag\n",co2negflag);
-		printf("%d it\n",it);
-		printf("%e vmaxit\n",vmaxit*3600.);
-      #endif  /* PRINT */
+#if defined (LININIT) || defined (ROM)
+void jacobi(a,n,d,v)	/* eigenvalues d, eigenvectors v of sym. a */
+double **a,d[],**v;
+int n;
+{
+   int i,j,p,q,sweep;
+   double off,th,t,c,s,tau,apq,app,aqq;
+
+   for(i=1; i <= n; i++) {
+      for(j=1; j <= n; j++) v[i][j] = (i == j) ? 1.0 : 0.0;
+   }
+   for(sweep=1; sweep <= 50; sweep++) {
+      off = 0.0;
+      for(p=1; p < n; p++)
+         for(q=p+1; q <= n; q++) off += fabs(a[p][q]);
+      if(off == 0.0) break;
+      for(p=1; p < n; p++)
+      for(q=p+1; q <= n; q++) {
+         if(a[p][q] == 0.0) continue;
+         app = a[p][p];
+         aqq = a[q][q];
+         apq = a[p][q];
+         th = 0.5*(aqq-app)/apq;
+         t  = 1.0/(fabs(th)+sqrt(th*th+1.0));
+         if(th < 0.0) t = -t;
+         c = 1.0/sqrt(t*t+1.0);
+         s = t*c;
+         tau = s/(1.0+c);
+         a[p][p] = app - t*apq;
+         a[q][q] = aqq + t*apq;
+         a[p][q] = a[q][p] = 0.0;
+         for(j=1; j <= n; j++) {
+            if(j == p || j == q) continue;
+            th = a[j][p];
+            t  = a[j][q];
+            a[j][p] = a[p][j] = th - s*(t  + tau*th);
+            a[j][q] = a[q][j] = t  + s*(th - tau*t);
+         }
+         for(j=1; j <= n; j++) {
+            th = v[j][p];
+            t  = v[j][q];
+            v[j][p] = th - s*(t  + tau*th);
+            v[j][q] = t  + s*(th - tau*t);
+         }
+      }
+   }
+   for(i=1; i <= n; i++) d[i] = a[i][i];
+}
 #endif
 
-		k=k1;
-		difeq(k,k1,k2,j9,ic3,ic4,indexv,ne,s,y);
-		pinvs(ic3,ic4,j5,j9,jc1,k1,c,s);
-#if defined (CLPL) && defined (DRAIN)
-		calldifeq = 1;
-		fdrain = 0.0;
-		for (k=k1+1;k<=k2;k++) {
-			difeq(k,k1,k2,j9,ic1,ic4,indexv,ne,s,y);
-		}
-		calldifeq = 2;
-		printf("calldifeq %d %e \n",calldifeq,fdrain);
-		for (k=k1+1;k<=k2;k++) {
-			kp=k-1;
-			difeq(k,k1,k2,j9,ic1,ic4,indexv,ne,s,y);
-			red(ic1,ic4,j1,j2,j3,j4,j9,ic3,jc1,jcf,kp,c,s);
-			pinvs(ic1,ic4,j3,j9,jc1,k,c,s);
-		}
+#ifdef LININIT
+/* ----------------------------------------------------------------
+
+   initial guess: reaction-diffusion equations linearised at bulk
+
+     u = y - y_bulk:   u'' + 2/r u' = G u + g(r)
+
+   G (reactions) and g (symbiont halo sources) are taken from difeq()
+   at the bulk state, the shell fluxes from its left b.c. rows.
+   G is symmetrised by a diagonal scaling X (detailed balance) and
+   diagonalised (jacobi): decoupled modes w = E^T X^-1 u with
+   reaction-diffusion lengths 1/sqrt(mu). Each mode f = r w solves
+
+     f'' - mu f = r g_m(r),   w'(R) = F_m,   w(RBULK) = 0
+
+   with the free-space Green's function exp(-kappa|r-rho|)/(2 kappa)
+   (|r-rho|/2 for conserved quantities) and exponentials decaying
+   from the shell and from RBULK.
+   The solution does not depend on the guess, the point where
+   solvde() stops does: its error is the mean correction of all
+   NE*M unknowns, and the shell values converge last. E.g. d13C of
+   the shell (C13ISTP, CISTP): 5.8289 with LININIT, 5.8172 without
+   at CONV = 5e-6, both 5.8225 at CONV = 5e-10.
+
+   ---------------------------------------------------------------- */
+
+void lininit(indexv,y)
+int indexv[];
+double **y;
+{
+   int a,b,k,m,set[N2+1],chg;
+   double **s,**yb,**gg,**sy,**ev,**gm,mu[N2+1],x[N2+1],flx[N2+1],
+          fm[N2+1],*il,*ir,*f,*fp,al,be,ka,e,ekh,fr,rr,rm,dk,tmp;
+   void difeq();
+
+   s  = dmatrix(1,NE,1,NSJ);
+   yb = dmatrix(1,NE,1,M);
+   gg = dmatrix(1,N2,1,N2);
+   sy = dmatrix(1,N2,1,N2);
+   ev = dmatrix(1,N2,1,N2);
+   gm = dmatrix(1,N2,1,M);
+   il = dvector(1,M);
+   ir = dvector(1,M);
+   f  = dvector(1,M);
+   fp = dvector(1,M);
+
+   /* --- bulk state --- */
+
+   for(k=1; k <= M; k++)
+      for(a=1; a <= N2; a++) {
+         yb[a][k]    = y[a][M];
+         yb[N2+a][k] = 0.0;
+      }
+   ystore(yb);
+#ifdef MIMECO2SYM
+   vmaxit = vmaxco2;
+#endif
+
+   /* --- shell fluxes: left b.c. rows --- */
+
+   difeq(1,1,M,NSJ,NRB+1,NE,indexv,NE,s,yb);
+   for(a=1; a <= N2; a++) flx[a] = -s[NRB+a][NSJ];
+
+   /* --- G: interval at RBULK (no sources) --- */
+
+   difeq(M,1,M,NSJ,1,NE,indexv,NE,s,yb);
+   dk = r[M] - r[M-1];
+   for(a=1; a <= N2; a++) {
+      for(b=1; b <= N2; b++)
+         gg[a][b] = -(s[N2+a][indexv[b]] + s[N2+a][NE+indexv[b]])/dk;
+      rm = s[N2+a][NSJ]/dk;	/* defect of the bulk state */
+      for(k=2; k <= M; k++) gm[a][k] = rm;
+   }
+
+   /* --- g: sources per interval --- */
+
+   for(k=2; k <= M; k++) {
+      difeq(k,1,M,NSJ,1,NE,indexv,NE,s,yb);
+      dk = r[k] - r[k-1];
+      for(a=1; a <= N2; a++) gm[a][k] -= s[N2+a][NSJ]/dk;
+   }
+
+   /* --- symmetrise: x_b^2 / x_a^2 = G_ba / G_ab --- */
+
+   for(a=1; a <= N2; a++) set[a] = 0;
+   for(m=1; m <= N2; m++) {
+      if(set[m]) continue;
+      x[m] = 1.0;
+      set[m] = 1;
+      do {
+         chg = 0;
+         for(a=1; a <= N2; a++) {
+            if(!set[a]) continue;
+            for(b=1; b <= N2; b++) {
+               if(set[b] || gg[a][b]*gg[b][a] <= 0.0) continue;
+               x[b] = x[a]*sqrt(gg[b][a]/gg[a][b]);
+               set[b] = chg = 1;
+            }
+         }
+      } while(chg);
+   }
+   for(a=1; a <= N2; a++)
+      for(b=1; b <= N2; b++) sy[a][b] = gg[a][b]*x[b]/x[a];
+   for(a=1; a <= N2; a++)
+      for(b=1; b < a; b++)
+         sy[a][b] = sy[b][a] = 0.5*(sy[a][b] + sy[b][a]);
+   jacobi(sy,N2,mu,ev);
+
+   /* --- modes --- */
+
+   for(a=1; a <= N2; a++)
+      for(k=1; k <= M; k++) {
+         y[a][k]    = 0.0;
+         y[N2+a][k] = 0.0;
+      }
+
+   for(m=1; m <= N2; m++) {
+      if(mu[m] < 0.0) mu[m] = 0.0;
+      ka = sqrt(mu[m]);
+      fm[m] = 0.0;
+      for(a=1; a <= N2; a++) fm[m] += ev[a][m]*flx[a]/x[a];
+      for(k=2; k <= M; k++) {	/* r * source of the mode */
+         tmp = 0.0;
+         for(a=1; a <= N2; a++) tmp += ev[a][m]*gm[a][k]/x[a];
+         f[k] = 0.5*(r[k]+r[k-1])*tmp;
+      }
+      if(ka*(r[M]-r[1]) > LIKMIN) {
+         /* f_p = -(I_L + I_R)/(2 kappa), f_p' = (I_L - I_R)/2 */
+         il[1] = 0.0;
+         for(k=2; k <= M; k++) {
+            dk  = r[k] - r[k-1];
+            ekh = exp(-ka*dk);
+            il[k] = ekh*il[k-1] + f[k]*(1.0-ekh)/ka;
+         }
+         ir[M] = 0.0;
+         for(k=M-1; k >= 1; k--) {
+            dk  = r[k+1] - r[k];
+            ekh = exp(-ka*dk);
+            ir[k] = ekh*ir[k+1] + f[k+1]*(1.0-ekh)/ka;
+         }
+         e  = exp(-ka*(r[M]-r[1]));
+         rr = r[1];
+         fr = -(il[M] + ir[M])/2./ka;			/* f_p(RBULK) */
+         tmp = RADIUS*fm[m] + ir[1]/2. - ir[1]/2./ka/rr
+               + fr*e*(ka - 1.0/rr);
+         al = tmp/(-ka - 1.0/rr - e*e*(ka - 1.0/rr));
+         be = -fr - al*e;
+         for(k=1; k <= M; k++) {
+            e  = exp(-ka*(r[k]-r[1]));
+            ekh = exp(-ka*(r[M]-r[k]));
+            tmp   = -(il[k] + ir[k])/2./ka + al*e + be*ekh;
+            fp[k] = (il[k] - ir[k])/2. - ka*al*e + ka*be*ekh;
+            f[k]  = tmp;
+         }
+      } else {
+         /* conserved: f_p = (r G0L - G1L + G1R - r G0R)/2 */
+         il[1] = ir[1] = 0.0;		/* G0L, G1L */
+         for(k=2; k <= M; k++) {
+            il[k] = il[k-1] + f[k]*(r[k]-r[k-1]);
+            ir[k] = ir[k-1] + f[k]*0.5*(r[k]*r[k]-r[k-1]*r[k-1]);
+         }
+         rr = r[1];
+         for(k=1; k <= M; k++) {	/* G0R = G0L(M)-G0L, ... */
+            tmp   = 0.5*(r[k]*il[k] - ir[k] + (ir[M]-ir[k])
+                        - r[k]*(il[M]-il[k]));
+            fp[k] = 0.5*(il[k] - (il[M]-il[k]));
+            f[k]  = tmp;
+         }
+         al = rr*(fp[1] - f[1]/rr - rr*fm[m]);
+         be = -(f[M] + al)/r[M];
+         for(k=1; k <= M; k++) {
+            f[k]  += al + be*r[k];
+            fp[k] += be;
+         }
+      }
+      /* w = f/r, w' = (f' - f/r)/r,  u = X E w */
+      for(k=1; k <= M; k++) {
+         al = f[k]/r[k];
+         be = (fp[k] - al)/r[k];
+         for(a=1; a <= N2; a++) {
+            y[a][k]    += x[a]*ev[a][m]*al;
+            y[N2+a][k] += x[a]*ev[a][m]*be;
+         }
+      }
+   }
+
+   /* --- y = y_bulk + u  (not below LIFLOOR * bulk) --- */
+
+   for(k=1; k <= M; k++)
+      for(a=1; a <= N2; a++) {
+         y[a][k] += yb[a][k];
+         if(y[a][k] < LIFLOOR*yb[a][k]) y[a][k] = LIFLOOR*yb[a][k];
+      }
+
+   fprintf(fppara,"--- linearised initial guess (LININIT) --- \n");
+   fprintf(fppara,"mode  mu [1/mu^2]   L [mu]\n");
+   for(m=1; m <= N2; m++)
+      fprintf(fppara,"%2d    %e  %e \n",m,mu[m],
+              mu[m] > 0.0 ? 1.0/sqrt(mu[m]) : -1.0);
+
+   free_dvector(fp,1,M);
+   free_dvector(f,1,M);
+   free_dvector(ir,1,M);
+   free_dvector(il,1,M);
+   free_dmatrix(gm,1,N2,1,M);
+   free_dmatrix(ev,1,N2,1,N2);
+   free_dmatrix(sy,1,N2,1,N2);
+   free_dmatrix(gg,1,N2,1,N2);
+   free_dmatrix(yb,1,NE,1,M);
+   free_dmatrix(s,1,NE,1,NSJ);
+}
+#endif
+
+#ifdef QOICONV
+/* ----------------------------------------------------------------
+
+   quantities of interest for the goal-oriented stopping criterion:
+   surface concentrations, d13C of the shell, d11B(OH)4 at the shell
+   and the CO2 fraction of the symbiont C uptake. w[i] = 1/tolerance,
+   concentrations relative to bulk (species without bulk value: to
+   the shell value, species zero everywhere: w = 0, not a quantity).
+
+   ---------------------------------------------------------------- */
+
+int qoival(y,q,w)
+double **y,q[],w[];
+{
+   int a,n=0;
+   double ty;
+#if defined (MIMECO2SYM) && !defined (CLPL) && !defined (AGG)
+   int k;
+   double fco2=0.0;
+#endif
+
+   for(a=1; a <= N2; a++) {
+      q[++n] = y[a][1];
+      ty = fabs(y[a][M]);			/* bulk: typical value */
+      if(ty == 0.0) ty = fabs(y[a][1]);
+      w[n] = (ty > 0.0) ? 1.0/(QOITOL*ty) : 0.0;
+   }
+#if defined (C13ISTP) && defined (F13_CO3)
+   if(CO3UPT != 0.0) {
+#ifdef CISTP
+      q[++n] = (alphac*y[EQCCO3][1]/y[EQCO3][1]/RSTAND - 1.)*1000.;
 #else
-		for (k=k1+1;k<=k2;k++) {
-			kp=k-1;
-			difeq(k,k1,k2,j9,ic1,ic4,indexv,ne,s,y);
-			red(ic1,ic4,j1,j2,j3,j4,j9,ic3,jc1,jcf,kp,c,s);
-			pinvs(ic1,ic4,j3,j9,jc1,k,c,s);
-		}
+      q[++n] = (alphac*y[EQCCO3][1]/(y[EQCO3][1]-y[EQCCO3][1])
+               /RSTAND - 1.)*1000.;
+#endif
+      w[n]   = 1.0/QOIDTOL;
+   }
+#endif
+#ifdef BORISTP
+   q[++n] = ((y[EQBBOH4][1]/y[EQBOH4][1])/BSTAND - 1.)*1000.;
+   w[n]   = 1.0/QOIDTOL;
+#endif
+#if defined (MIMECO2SYM) && !defined (CLPL) && !defined (AGG)
+   for(k=2; k <= nsymrad; k++)
+      fco2 += y[EQCO2][k]/(KS+y[EQCO2][k])/NSYMK(k);
+   q[++n] = fco2;
+   w[n]   = 1.0/QOITOL;
+#endif
+   return(n);
+}
 #endif
-		k=k2+1;
-		difeq(k,k1,k2,j9,ic1,ic2,indexv,ne,s,y);
-		red(ic1,ic2,j5,j6,j7,j8,j9,ic3,jc1,jcf,k2,c,s);
-		pinvs(ic1,ic2,j7,j9,jcf,k2+1,c,s);
-		bksub(ne,nb,jcf,k1,k2,c);
-		err=0.0;
-		for (j=1;j<=ne;j++) {
-			jv=indexv[j];
-			errj=vmax=0.0;
-			km=0;
-			for (k=k1;k<=k2;k++) {
-				vz=fabs(c[j][1][k]);
-				if (vz > vmax) {
-					 vmax=vz;
-					 km=k;
-				}
-				errj += vz;
-			}
-			err += errj/scalv[jv];
-			ermax[j]=c[j][1][km]/scalv[jv];
-			kmax[j]=km;
-		}
-		err /= nvars;
-		fac=(err > slowc ? slowc/err : 1.0);
-              /* set new values */
 
-		for (jv=1;jv<=ne;jv++) {
-			j=indexv[jv];
-			for (k=k1;k<=k2;k++)
-				y[j][k] -= fac*c[jv][1][k];
-		}
+#if defined (TIMESTEP) || defined (SPSHIFT) || defined (LIBSOLVDE)
+char *spname(a)		/* species name (as the .sv4 files) */
+int a;
+{
+   if(a == EQCO2)   return("co2");
+   if(a == EQHCO3)  return("hco3");
+   if(a == EQCO3)   return("co3");
+   if(a == EQHP)    return("h");
+   if(a == EQOH)    return("oh");
+#ifdef C13ISTP
+   if(a == EQCCO2)  return("cco2");
+   if(a == EQHCCO3) return("hcco3");
+   if(a == EQCCO3)  return("cco3");
+#endif
+#ifdef BORON
+   if(a == EQBOH3)  return("boh3");
+   if(a == EQBOH4)  return("boh4");
+#ifdef BORISTP
+   if(a == EQBBOH3) return("bboh3");
+   if(a == EQBBOH4) return("bboh4");
+#endif
+#endif
+#ifdef OXYGEN
+   if(a == EQO2)    return("o2");
+#endif
+#ifdef CALCIUM
+   if(a == EQCA)    return("ca");
+#endif
+   return("unused");
+}
+#endif
 
-#ifdef NOHPLUS
-          for (k=k1;k<=k2;k++) y[4][k] = hplus[k];  /* diagnostic */
+#ifdef TIMESTEP
+/* ----------------------------------------------------------------
+
+   time stepping (TRANSIENT, PERIODIC): method of lines in r (the
+   relaxation scheme of difeq) and variable-step BDF (order 1,
+   then 2) in time
+
+     c'' + 2/r c' = g(c) + (c - c^)/(gam dt D)
+
+   BDF2:  gam = (1+w)/(1+2w),  c^ = ((1+w)^2 c_n - w^2 c_n-1)/(1+2w),
+          w = dt_n/dt_n-1;  BDF1: gam = 1, c^ = c_n.
+   Every step (bdfstep()) is a solvde() call started from the
+   extrapolated predictor, i.e. the difeq Jacobian blocks plus the
+   diagonal 1/(gam dt D) and the same block elimination. The local
+   error is estimated from the predictor-corrector difference.
+
+   ---------------------------------------------------------------- */
+
+double dspec(a)		/* diffusion coefficient of species a */
+int a;
+{
+   if(a == EQCO2)   return(dco2);
+   if(a == EQHCO3)  return(dhco3);
+   if(a == EQCO3)   return(dco3);
+   if(a == EQHP)    return(dh);
+   if(a == EQOH)    return(doh);
+#ifdef C13ISTP
+   if(a == EQCCO2)  return(dcco2);
+   if(a == EQHCCO3) return(dhcco3);
+   if(a == EQCCO3)  return(dcco3);
+#endif
+#ifdef BORON
+   if(a == EQBOH3)  return(dboh3);
+   if(a == EQBOH4)  return(dboh4);
+#ifdef BORISTP
+   if(a == EQBBOH3) return(dbboh3);
+   if(a == EQBBOH4) return(dbboh4);
 #endif
+#endif
+#ifdef OXYGEN
+   if(a == EQO2)    return(do2);
+#endif
+#ifdef CALCIUM
+   if(a == EQCA)    return(dca);
+#endif
+   return(1.0);
+}
 
-      #ifdef PRINT
-		printf("\n%8s %9s %9s\n","Iter.","Error","FAC");
-		printf("%6d %12.6f %11.6f\n",it,err,fac);
-      #endif /* PRINT */
-#ifdef PRINT
-		printf("%8s %8s %14s\n","Var.","Kmax","Max. Error");
-		for (j=1;j<=ne;j++)
-			printf("%6d %9d %14.6f \n",indexv[j],kmax[j],ermax[j]);
+void trterm(k,jsf,indexv,s,y)	/* time derivative, interval k */
+int k,jsf,indexv[];
+double **s,**y;
+{
+   int a;
+   double fac;
+
+   for(a=1; a <= N2; a++) {
+      fac = hh/trdt/dspec(a);
+      s[N2+a][jsf] -= fac*(y[a][k-1] - trhat[a][k-1]
+                          + y[a][k]   - trhat[a][k]);
+      s[N2+a][   indexv[a]] -= fac;
+      s[N2+a][NE+indexv[a]] -= fac;
+   }
+}
+
+void trout(fp,t,y)
+FILE *fp;
+double t,**y;
+{
+   int a,k;
+
+   for(k=1; k <= M; k++) {
+      fprintf(fp,"%e %e",t,r[k]);
+      for(a=1; a <= N2; a++) fprintf(fp," %e",y[a][k]);
+      fprintf(fp,"\n");
+   }
+}
+
+double bdfstep(q,dt,dtold,conv,yn,yo,indexv,scalv,y,c,s)
+int q,indexv[];			/* q: BDF order, yn: c_n, yo: c_n-1 */
+double dt,dtold,conv,**yn,**yo,scalv[],**y,***c,**s;
+{
+   int a,k;
+   double w,gam,e,err=0.0;
+   int solvde();
+
+   w   = (q == 2) ? dt/dtold : 0.0;
+   gam = (q == 2) ? (1.+w)/(1.+2.*w) : 1.0;
+   for(a=1; a <= NE; a++)
+      for(k=1; k <= M; k++)
+         y[a][k] = yn[a][k] + w*(yn[a][k] - yo[a][k]);
+   for(a=1; a <= N2; a++)
+      for(k=1; k <= M; k++)
+         trhat[a][k] = (q == 2) ?
+            (SQ(1.+w)*yn[a][k] - w*w*yo[a][k])/(1.+2.*w) : yn[a][k];
+   trdt = gam*dt;
+
+   if(solvde(ITMAX,conv,SLOWC,scalv,indexv,NE,NB,M,y,c,s) != SVOK) {
+      if(dt <= TRDTMIN) svabort(y);
+      return(1.e30);		/* corrector failed: rejected, smaller step */
+   }
+
+   /* --- local error: predictor-corrector difference --- */
+
+   for(a=1; a <= N2; a++)
+      for(k=1; k <= M; k++) {
+         e = fabs(y[a][k] - yn[a][k] - w*(yn[a][k] - yo[a][k]))
+             /fabs(yn[a][M])/(double)(q+1);
+         if(e > err) err = e;
+      }
+   return(err);
+}
 #endif
 
+#ifdef TRANSIENT
+/* ----------------------------------------------------------------
+
+   transient mode: at t = 0 the symbiont uptake switches from TRV0
+   to TRV1 (x vmaxco2). Snapshots at TROUT -> trans.sv4
+   (t r species).
+
+   ---------------------------------------------------------------- */
+
+void transient(indexv,scalv,y,c,s)
+int indexv[];
+double scalv[],**y,***c,**s;
+{
+   int a,k,q=1,iout=0,hit,nstep=0,nrej=0,nit=0;
+   double tout[NTROUT] = TROUT,t=0.0,dt=TRDT0,dtold=0.0,
+          err,fac,**yn,**yo;
+   FILE *fptr;
+
+   yn = dmatrix(1,NE,1,M);	/* c_n   */
+   yo = dmatrix(1,NE,1,M);	/* c_n-1 */
+   trhat = dmatrix(1,N2,1,M);
+
+#ifdef ISTPDEC
+   for(a=1; a <= NE; a++) msub[a] = a;	/* full system */
+   ivfull = indexv;
+#endif
 #ifdef MIMECO2SYM
-		if (err < conv && vmaxit >= vmaxco2) {
-			free_dvector(ermax,1,ne);
-			free_ivector(kmax,1,ne);
-			return;
-		}
+   vmaxco2 = TRV1*vmaxtr;		/* light switch at t = 0 */
+#endif
+
+   fptr = ctxopen("trans.sv4","w");
+   fprintf(fptr,"# t r");
+   for(a=1; a <= N2; a++) fprintf(fptr," %s",spname(a));
+   fprintf(fptr,"\n");
+   trout(fptr,t,y);
+
+   for(a=1; a <= NE; a++)
+      for(k=1; k <= M; k++) yn[a][k] = yo[a][k] = y[a][k];
+
+   while(iout < NTROUT) {
+      hit = 0;
+      if(t + dt >= tout[iout]) {
+         dt  = tout[iout] - t;
+         hit = 1;
+      }
+
+      err = bdfstep(q,dt,dtold,CONV,yn,yo,indexv,scalv,y,c,s);
+      nit += itsol;
+
+      fac = 0.9*pow(TRTOL/(err > 1.e-30 ? err : 1.e-30),1./(double)(q+1));
+      if(fac > 2.0) fac = 2.0;
+      if(fac < 0.2) fac = 0.2;
+
+      if(err > TRTOL && dt > TRDTMIN) {		/* reject */
+         nrej++;
+         dt *= fac;
+         continue;
+      }
+
+      /* --- accept --- */
+
+      nstep++;
+      t += dt;
+      for(a=1; a <= NE; a++)
+         for(k=1; k <= M; k++) {
+            yo[a][k] = yn[a][k];
+            yn[a][k] = y[a][k];
+         }
+      dtold = dt;
+      q = 2;
+      if(hit) trout(fptr,tout[iout++],y);
+      dt *= fac;
+      if(dt > TRDTMAX) dt = TRDTMAX;
+   }
+   fclose(fptr);
+   trdt = 0.0;		/* back to steady state */
+
+   fprintf(fppara,"--- transient (TRANSIENT) --- \n");
+   fprintf(fppara,"symbiont uptake  %e -> %e x vmaxco2 \n",TRV0,TRV1);
+   fprintf(fppara,"end time [s]     %e \n",t);
+   fprintf(fppara,"steps            %d (rejected %d) \n",nstep,nrej);
+   fprintf(fppara,"Newton iter.     %d \n",nit);
+
+   free_dmatrix(trhat,1,N2,1,M);
+   free_dmatrix(yo,1,NE,1,M);
+   free_dmatrix(yn,1,NE,1,M);
+}
+#endif
+
+#ifdef PERIODIC
+/* ----------------------------------------------------------------
+
+   periodic light/dark state: symbiont uptake TRV1 x vmaxco2 for
+   0 < t < PDLIGHT, TRV0 x vmaxco2 until PDPER. Fixed point of the
+   cycle map  P: c(0) -> c(PDPER). First plain cycling, c <- P(c):
+   with diffusion times (RBULK^2/D) well below the period each
+   cycle contracts |F| = |P(c) - c| by a large factor. Only if
+   a cycle contracts by less than PDRHO (slow modes, e.g. a long
+   period of the chemistry) it goes on with shooting, Newton on
+   F(c) = 0:
+
+     (P' - I) dc = -F
+
+   solved by GMRES without forming P'. P'v is the sensitivity of the
+   cycle map in the direction v: a second integration from c + eps v
+   over the (recorded) time steps of the base cycle, pdcycle(), i.e.
+   the same discrete map and no step size noise. Variables are
+   scaled by the bulk values. Modes which decay within a cycle have
+   eigenvalues ~ 0 of P', GMRES needs about one iteration per slow
+   mode. Initial guess: steady state at the mean uptake (main).
+   Snapshots (NPDOUT per period) of the periodic state -> peri.sv4
+   (t r species). On return y is the periodic state at t = 0 (=
+   PDPER, end of the dark phase): the profiles of the .sv4 files.
+
+   ---------------------------------------------------------------- */
+
+int pdcycle(rep,fptr,indexv,scalv,y,c,s)   /* one period: y -> y */
+int rep,indexv[];		/* rep: replay the recorded steps */
+FILE *fptr;			/* snapshots (NULL: none)	   */
+double scalv[],**y,***c,**s;
+{
+   int a,k,i,q=1,iout=1,hit,nit=0;
+   double t=0.0,tb,dt=TRDT0,dtold=0.0,err,fac,**yn,**yo;
+
+   yn = dmatrix(1,NE,1,M);	/* c_n   */
+   yo = dmatrix(1,NE,1,M);	/* c_n-1 */
+   for(a=1; a <= NE; a++)
+      for(k=1; k <= M; k++) yn[a][k] = yo[a][k] = y[a][k];
+
+   if(rep) {
+      for(i=0; i < pdnst; i++) {
+#ifdef MIMECO2SYM
+         vmaxco2 = pdv[i];
+#endif
+         if(bdfstep(pdq[i],pddt[i],dtold,PDCONV,yn,yo,indexv,scalv,y,c,s)
+            >= 1.e30) svabort(y);	/* accepted before */
+         nit += itsol;
+         for(a=1; a <= NE; a++)
+            for(k=1; k <= M; k++) {
+               yo[a][k] = yn[a][k];
+               yn[a][k] = y[a][k];
+            }
+         dtold = pddt[i];
+      }
+   }
+   else {
+      if(fptr != NULL) trout(fptr,t,y);
+      pdnst = 0;
+      while(t < PDPER) {
+         tb = (double)iout*PDPER/(double)NPDOUT;	/* next snapshot */
+         if(t < PDLIGHT && PDLIGHT < tb) tb = PDLIGHT;
+         hit = 0;
+         if(t + dt >= tb) {
+            dt  = tb - t;
+            hit = 1;
+         }
+#ifdef MIMECO2SYM
+         vmaxco2 = (t < PDLIGHT ? TRV1 : TRV0)*vmaxtr;
+#endif
+         err = bdfstep(q,dt,dtold,PDCONV,yn,yo,indexv,scalv,y,c,s);
+         nit += itsol;
+
+         fac = 0.9*pow(TRTOL/(err > 1.e-30 ? err : 1.e-30),1./(double)(q+1));
+         if(fac > 2.0) fac = 2.0;
+         if(fac < 0.2) fac = 0.2;
+         if(err > TRTOL && dt > TRDTMIN) {	/* reject */
+            dt *= fac;
+            continue;
+         }
+
+         /* --- accept and record --- */
+
+         if(pdnst >= PDNSTEP)
+            svfail(SVFAIL,"PERIODIC: too many time steps, increase PDNSTEP");
+         pdq[pdnst]  = q;
+         pddt[pdnst] = dt;
+#ifdef MIMECO2SYM
+         pdv[pdnst]  = vmaxco2;
+#endif
+         pdnst++;
+         t = hit ? tb : t + dt;
+         for(a=1; a <= NE; a++)
+            for(k=1; k <= M; k++) {
+               yo[a][k] = yn[a][k];
+               yn[a][k] = y[a][k];
+            }
+         dtold = dt;
+         q = 2;
+         dt *= fac;
+         if(dt > TRDTMAX) dt = TRDTMAX;
+         if(hit && t == (double)iout*PDPER/(double)NPDOUT) {
+            if(fptr != NULL) trout(fptr,t,y);
+            iout++;
+         }
+         if(hit && t == PDLIGHT) {	/* uptake switch: restart */
+            q  = 1;
+            dt = TRDT0;
+         }
+      }
+   }
+
+   free_dmatrix(yo,1,NE,1,M);
+   free_dmatrix(yn,1,NE,1,M);
+   return(nit);
+}
+
+void periodic(indexv,scalv,y,c,s)
+int indexv[];
+double scalv[],**y,***c,**s;
+{
+   int a,i,j,k,l,n=N2*M,it,nk=0,ncyc=0,nit=0,shoot=0,nnewt=0;
+   double cb[N2+1],**yb,**v,**hg,*x,*pb,*d,*g,*cs,*sn,
+          res=0.0,resold=0.0,beta,eps,tmp,lam;
+   FILE *fptr;
+
+   yb = dmatrix(1,NE,1,M);	/* initial state, full y */
+   v  = dmatrix(1,PDKRYL+1,1,n);	/* Krylov basis		 */
+   hg = dmatrix(1,PDKRYL+1,1,PDKRYL);	/* Hessenberg	 */
+   x  = dvector(1,n);		/* c(0) / bulk		 */
+   pb = dvector(1,n);		/* c(PDPER) / bulk	 */
+   d  = dvector(1,n);
+   g  = dvector(1,PDKRYL+1);
+   cs = dvector(1,PDKRYL);
+   sn = dvector(1,PDKRYL);
+   trhat = dmatrix(1,N2,1,M);
+
+#ifdef ISTPDEC
+   for(a=1; a <= NE; a++) msub[a] = a;	/* full system */
+   ivfull = indexv;
+#endif
+
+   for(a=1; a <= N2; a++) cb[a] = fabs(y[a][M]);
+   for(a=1; a <= NE; a++)
+      for(k=1; k <= M; k++) yb[a][k] = y[a][k];
+   for(a=1; a <= N2; a++)
+      for(k=1; k <= M; k++) x[(a-1)*M+k] = y[a][k]/cb[a];
+
+   fprintf(fppara,"--- periodic state (PERIODIC) --- \n");
+   fprintf(fppara,"period, light [s] %e %e \n",PDPER,PDLIGHT);
+   fprintf(fppara,"symbiont uptake   %e / %e x vmaxco2 (light/dark) \n",
+           TRV1,TRV0);
+
+   for(it=1; it <= PDNCYC+PDNEWT; it++) {
+
+      /* --- base cycle: adaptive steps, recorded --- */
+
+      for(a=1; a <= NE; a++)
+         for(k=1; k <= M; k++) y[a][k] = yb[a][k];
+      fptr = ctxopen("peri.sv4","w");
+      fprintf(fptr,"# t r");
+      for(a=1; a <= N2; a++) fprintf(fptr," %s",spname(a));
+      fprintf(fptr,"\n");
+      nit += pdcycle(0,fptr,indexv,scalv,y,c,s);
+      fclose(fptr);
+      ncyc++;
+
+      res = 0.0;
+      for(a=1; a <= N2; a++)
+         for(k=1; k <= M; k++) {
+            l = (a-1)*M+k;
+            pb[l] = y[a][k]/cb[a];
+            d[l]  = x[l] - pb[l];		/* -F */
+            if(fabs(d[l]) > res) res = fabs(d[l]);
+         }
+      fprintf(fppara,"%s %2d  max|c(PDPER)-c(0)|/bulk %e  steps %d \n",
+              shoot ? "Newton" : "cycle ",it,res,pdnst);
+      if(res < PDTOL) break;
+      if(it > PDNCYC || (it > 1 && res > PDRHO*resold)) shoot = 1;
+      if(!shoot) {			/* plain: c <- P(c) */
+         resold = res;
+         for(l=1; l <= n; l++) x[l] = pb[l];
+         for(a=1; a <= NE; a++)
+            for(k=1; k <= M; k++) yb[a][k] = y[a][k];
+         continue;
+      }
+      if(++nnewt > PDNEWT) break;
+
+      /* --- GMRES: (P' - I) dc = -F, P'v from a replayed cycle --- */
+
+      beta = 0.0;
+      for(l=1; l <= n; l++) beta += d[l]*d[l];
+      beta = sqrt(beta);
+      for(l=1; l <= n; l++) v[1][l] = d[l]/beta;
+      for(i=1; i <= PDKRYL+1; i++) g[i] = 0.0;
+      g[1] = beta;
+
+      for(j=1; j <= PDKRYL; j++) {
+         tmp = 0.0;
+         for(l=1; l <= n; l++) if(fabs(v[j][l]) > tmp) tmp = fabs(v[j][l]);
+         eps = PDEPS/tmp;
+         for(a=1; a <= NE; a++)
+            for(k=1; k <= M; k++) y[a][k] = yb[a][k];
+         for(a=1; a <= N2; a++)
+            for(k=1; k <= M; k++) y[a][k] += eps*v[j][(a-1)*M+k]*cb[a];
+         nit += pdcycle(1,NULL,indexv,scalv,y,c,s);
+         ncyc++;
+         for(a=1; a <= N2; a++)
+            for(k=1; k <= M; k++) {
+               l = (a-1)*M+k;
+               v[j+1][l] = (y[a][k]/cb[a] - pb[l])/eps - v[j][l];
+            }
+
+         /* Arnoldi (modified Gram-Schmidt) */
+         for(i=1; i <= j; i++) {
+            tmp = 0.0;
+            for(l=1; l <= n; l++) tmp += v[j+1][l]*v[i][l];
+            hg[i][j] = tmp;
+            for(l=1; l <= n; l++) v[j+1][l] -= tmp*v[i][l];
+         }
+         tmp = 0.0;
+         for(l=1; l <= n; l++) tmp += v[j+1][l]*v[j+1][l];
+         hg[j+1][j] = sqrt(tmp);
+         if(hg[j+1][j] > 0.0)
+            for(l=1; l <= n; l++) v[j+1][l] /= hg[j+1][j];
+
+         /* Givens rotations -> least squares residual |g[j+1]| */
+         for(i=1; i < j; i++) {
+            tmp        =  cs[i]*hg[i][j] + sn[i]*hg[i+1][j];
+            hg[i+1][j] = -sn[i]*hg[i][j] + cs[i]*hg[i+1][j];
+            hg[i][j]   =  tmp;
+         }
+         tmp    = sqrt(SQ(hg[j][j]) + SQ(hg[j+1][j]));
+         cs[j]  = hg[j][j]/tmp;
+         sn[j]  = hg[j+1][j]/tmp;
+         hg[j][j]   = tmp;
+         hg[j+1][j] = 0.0;
+         g[j+1] = -sn[j]*g[j];
+         g[j]   =  cs[j]*g[j];
+         nk = j;
+         if(fabs(g[j+1]) < PDKTOL*beta) break;
+      }
+      for(i=nk; i >= 1; i--) {		/* back substitution */
+         for(j=i+1; j <= nk; j++) g[i] -= hg[i][j]*g[j];
+         g[i] /= hg[i][i];
+      }
+      for(l=1; l <= n; l++) {
+         d[l] = 0.0;
+         for(i=1; i <= nk; i++) d[l] += g[i]*v[i][l];
+      }
+
+      /* --- Newton step, concentrations stay positive --- */
+
+      lam = 1.0;
+      for(l=1; l <= n; l++)
+         if(x[l] + lam*d[l] < 0.1*x[l]) lam = -0.9*x[l]/d[l];
+      for(a=1; a <= N2; a++)
+         for(k=1; k <= M; k++) {
+            l = (a-1)*M+k;
+            x[l] += lam*d[l];
+            yb[a][k] = x[l]*cb[a];
+         }
+      fprintf(fppara,"          GMRES %d iterations, step %f \n",nk,lam);
+   }
+   trdt = 0.0;		/* back to steady state */
+
+   fprintf(fppara,"cycles integrated %d \n",ncyc);
+   fprintf(fppara,"profiles (.sv4): periodic state at t = 0 (end of dark) \n");
+   fprintf(fppara,"Newton iter. (BDF steps) %d \n",nit);
+   if(res >= PDTOL)
+      fprintf(fppara,"PERIODIC: not converged, max|F| %e \n",res);
+
+   free_dmatrix(trhat,1,N2,1,M);
+   free_dvector(sn,1,PDKRYL);
+   free_dvector(cs,1,PDKRYL);
+   free_dvector(g,1,PDKRYL+1);
+   free_dvector(d,1,n);
+   free_dvector(pb,1,n);
+   free_dvector(x,1,n);
+   free_dmatrix(hg,1,PDKRYL+1,1,PDKRYL);
+   free_dmatrix(v,1,PDKRYL+1,1,n);
+   free_dmatrix(yb,1,NE,1,M);
+}
+#endif
+
+#ifdef SPSHIFT
+/* ----------------------------------------------------------------
+
+   parameter derivatives of the difeq residual (SENSIT, ADJOINT,
+   FIT, CONTIN): central differences, the parameter shifted by SPAR() and
+   the derived quantities recomputed (initc(), initk(), inita()).
+   RADIUS scales the mesh (RBULK ~ RADIUS, the symbiont halo keeps
+   its points). SYMDIST only enters through the number of halo
+   points and has no derivative.
+
+   ---------------------------------------------------------------- */
+
+char *sparname(ip)	/* parameter name */
+int ip;
+{
+   if(ip == SPRAD)  return("RADIUS");
+   if(ip == SPCO3)  return("CO3UPT");
+   if(ip == SPSYM)  return("SYMTCUPT");
+   if(ip == SPTEMP) return("TEMP");
+   if(ip == SPSAL)  return("SALINITY");
+   if(ip == SPPH)   return("PHBULK");
+   if(ip == SPCO2)  return("CO2UPT");
+   if(ip == SPHCO3) return("HCO3UPT");
+   return("VMAX");
+}
+
+double spvalue(ip)	/* parameter value (with shift) */
+int ip;
+{
+   if(ip == SPRAD)  return(RADIUS);
+   if(ip == SPCO3)  return(CO3UPT);
+   if(ip == SPSYM)  return(SYMTCUPT);
+   if(ip == SPTEMP) return(TEMP);
+   if(ip == SPSAL)  return(SALINITY);
+   if(ip == SPPH)   return(PHBULK);
+   if(ip == SPCO2)  return(CO2UPT);
+   if(ip == SPHCO3) return(HCO3UPT);
+   return(VMAX);
+}
+
+void spset(ip,dp,r0,y)	/* shift parameter ip by dp */
+int ip;
+double dp,r0[],**y;
+{
+   int k;
+   double fac;
+   FILE *fpsave;
+   static CTX FILE *fpnull = NULL;
+
+   sdp[ip] = dp;
+   fac = RADIUS/(RADIUS - sdp[SPRAD]);	/* mesh */
+   for(k=1; k <= M; k++) r[k] = r0[k]*fac;
+#ifdef AUTOMESH
+   rbulkam = r[M];
+#ifdef EQFAR
+   rbulkam = r[M]*eqrb;		/* r[M]: the interface */
+#endif
+   symlen  = r0[0]*fac;
 #else
-		if (err < conv) {
-			free_dvector(ermax,1,ne);
-			free_ivector(kmax,1,ne);
-			return;
-		}
+   h  = (r[M] - r[1])/(double)(M-1);
+   hh = 0.5*h;
+#endif
+
+   if(fpnull == NULL) fpnull = tmpfile();
+   rewind(fpnull);
+   fpsave = fppara;		/* par.sv4: no second log of the init's */
+   fppara = fpnull;
+#ifdef C13ISTP
+   initeps();
+#endif
+   initc();
+   initk();
+#ifdef INITA
+   inita();			/* boundary fluxes */
+#endif
+   fppara = fpsave;
+#ifdef MIMECO2SYM
+   vmaxit = vmaxco2;
+#endif
+   ystore(y);			/* arrays of inita() */
+}
+
+void spsetn(nf,ip,x,pb,r0,y)	/* parameters ip[j] = x[j], pb: unshifted */
+int nf,ip[];
+double x[],pb[],r0[],**y;
+{
+   int j;
+
+   for(j=1; j < nf; j++) sdp[ip[j]] = x[j] - pb[j];
+   spset(ip[nf],x[nf] - pb[nf],r0,y);	/* derived quantities */
+}
+
+int spread(tag,fname,ip,nfp,xp)	/* scenarios: names, then values */
+char *tag,*fname;		/* returns their number, 0: none */
+int ip[],*nfp;
+double ***xp;
+{
+   int j,l,n,nf=0,nsc=0;
+   double d;
+   char line[1024],*tok,*sv;
+   FILE *fp;
+
+   fp = ctxopen(fname,"r");
+   if(fp == NULL || fgets(line,sizeof(line),fp) == NULL) {
+      fprintf(fppara,"%s: no scenario file %s \n",tag,fname);
+      if(fp != NULL) fclose(fp);
+      return(0);
+   }
+   for(tok=strtok_r(line," #\t\r\n",&sv); tok != NULL;
+       tok=strtok_r(NULL," \t\r\n",&sv)) {
+      for(l=1; l <= NSPAR; l++)
+         if(strcmp(sparname(l),tok) == 0) break;
+      if(l > NSPAR || nf == NSPAR) {
+         fprintf(fppara,"%s: unknown parameter %s \n",tag,tok);
+         fclose(fp);
+         return(0);
+      }
+      ip[++nf] = l;
+   }
+   while(fscanf(fp,"%lf",&d) == 1) nsc++;
+   if(nf > 0) nsc /= nf;
+   if(nsc == 0) {
+      fprintf(fppara,"%s: no scenarios in %s \n",tag,fname);
+      fclose(fp);
+      return(0);
+   }
+   *xp = dmatrix(1,nsc,1,nf);
+   rewind(fp);
+   fgets(line,sizeof(line),fp);
+   for(n=1; n <= nsc; n++)
+      for(j=1; j <= nf; j++) fscanf(fp,"%lf",&(*xp)[n][j]);
+   fclose(fp);
+   *nfp = nf;
+   return(nsc);
+}
+
+void spdrdp(l1,l2,indexv,y,drp,dp)	/* drp[p][row][k] = dR/dp, block k */
+int l1,l2,indexv[];			/* parameters l1 ... l2 */
+double **y,***drp,dp[];
+{
+   int i,k,l,sg,is1,isf;
+   double r0[MMAX+1],s0,fac,**s;
+   void difeq();
+
+   s = dmatrix(1,NE,1,NSJ);
+   fac = (RADIUS - sdp[SPRAD])/RADIUS;	/* unshifted mesh */
+   for(k=1; k <= M; k++) r0[k] = r[k]*fac;
+#ifdef AUTOMESH
+   r0[0] = symlen*fac;
+#endif
+   ystore(y);
+
+   for(l=l1; l <= l2; l++) {
+      s0 = sdp[l];			/* FIT, CONTIN: current shift */
+      dp[l] = SPREL*fabs(spvalue(l));
+      if(dp[l] == 0.0)
+         dp[l] = SPREL*((l == SPTEMP || l == SPPH) ? 1.0 : SPUPT);
+      for(i=1; i <= NE; i++)
+         for(k=1; k <= M+1; k++) drp[l][i][k] = 0.0;
+      for(sg=1; sg >= -1; sg -= 2) {
+         spset(l,s0 + (double)sg*dp[l],r0,y);
+         for(k=1; k <= M+1; k++) {
+            is1 = (k == 1)   ? NE-NB+1 : 1;
+            isf = (k == M+1) ? NE-NB   : NE;
+            difeq(k,1,M,NSJ,is1,isf,indexv,NE,s,y);
+            for(i=is1; i <= isf; i++)
+               drp[l][i][k] += (double)sg*s[i][NSJ]/(2.*dp[l]);
+         }
+      }
+      spset(l,s0,r0,y);
+   }
+   free_dmatrix(s,1,NE,1,NSJ);
+}
 #endif
 
+#if defined (SENSIT) || defined (FIT) || defined (CONTIN)
+/* ----------------------------------------------------------------
+
+   forward parametric sensitivities of the converged solution
+
+     J dy/dp = -dR/dp
+
+   J: the difeq blocks at the solution, reduced by the pinvs()/red()
+   elimination of solvde() with the nx columns dR/dp (spdrdp())
+   appended to the right-hand side (one sweep for all parameters),
+   then one back-substitution per column, spelim(). The residual
+   column of solvde() gives the Newton step J dy0 = -R on the way.
+   sensit(): shell values -> par.sv4, profiles -> sens.sv4
+   (par r species).
+
+   ---------------------------------------------------------------- */
+
+void sprhs(nx,iz1,iz2,jz1,jz2,ic1,jcf,kc,c,s)   /* red(): nx columns */
+int nx,iz1,iz2,jz1,jz2,ic1,jcf,kc;
+double ***c,**s;
+{
+   int i,j,l,ic=ic1;
+   double vx;
+
+   for(j=jz1; j <= jz2; j++) {
+      for(l=1; l <= nx; l++) {
+         vx = c[ic][jcf+l][kc];
+         for(i=iz1; i <= iz2; i++) s[i][NSJ+l] -= s[i][j]*vx;
+      }
+      ic++;
+   }
+}
+
+void spelim(indexv,y,nx,rhs,dy0,dy)	/* J dy[l] = -rhs[l], J dy0 = -R */
+int indexv[],nx;
+double **y,***rhs,**dy0,***dy;	/* dy0: NULL, not needed */
+{
+   int a,i,j,k,l,im,nbf=NE-NB,jcf=NE-NB+1,j9=NSJ,jsx=NSJ+nx;
+   double xx,**sx,***cx;
+   int pinvs();
+   void difeq(),red();
+
+   sx  = dmatrix(1,NE,1,jsx);
+   cx  = (double ***)malloc((unsigned) NE*sizeof(double **))-1;
+   for(i=1; i <= NE; i++) cx[i] = dmatrix(1,NCJ+nx,1,NCK);
+
+   /* --- block elimination as in solvde(), nx more columns --- */
+
+   difeq(1,1,M,j9,NE-NB+1,NE,indexv,NE,sx,y);
+   for(l=1; l <= nx; l++)
+      for(i=NE-NB+1; i <= NE; i++) sx[i][j9+l] = rhs[l][i][1];
+   if(pinvs(NE-NB+1,NE,NE+1,jsx,1,1,cx,sx)) svabort(y);
+   for(k=2; k <= M; k++) {
+      difeq(k,1,M,j9,1,NE,indexv,NE,sx,y);
+      for(l=1; l <= nx; l++)
+         for(i=1; i <= NE; i++) sx[i][j9+l] = rhs[l][i][k];
+      sprhs(nx,1,NE,1,NB,jcf,jcf,k-1,cx,sx);
+      red(1,NE,1,NB,NB+1,NE,j9,jcf,1,jcf,k-1,cx,sx);
+      if(pinvs(1,NE,NB+1,jsx,1,k,cx,sx)) svabort(y);
+   }
+   difeq(M+1,1,M,j9,1,NE-NB,indexv,NE,sx,y);
+   for(l=1; l <= nx; l++)
+      for(i=1; i <= NE-NB; i++) sx[i][j9+l] = rhs[l][i][M+1];
+   sprhs(nx,1,NE-NB,NE+1,NE+NB,jcf,jcf,M,cx,sx);
+   red(1,NE-NB,NE+1,NE+NB,NE+NB+1,2*NE,j9,jcf,1,jcf,M,cx,sx);
+   if(pinvs(1,NE-NB,NE+NB+1,jsx,jcf,M+1,cx,sx)) svabort(y);
+
+   /* --- back-substitution (bksub()) per column --- */
+
+   for(l=(dy0 == NULL); l <= nx; l++) {
+      j  = jcf + l;
+      im = 1;
+      for(k=M; k >= 1; k--) {
+         if(k == 1) im = nbf+1;
+         for(a=1; a <= nbf; a++) {
+            xx = cx[a][j][k+1];
+            for(i=im; i <= NE; i++) cx[i][j][k] -= cx[i][a][k]*xx;
+         }
+      }
+      for(k=1; k <= M; k++) {
+         for(i=1; i <= NB; i++)
+            (l ? dy[l] : dy0)[indexv[i]][k] = -cx[i+nbf][j][k];
+         for(i=1; i <= nbf; i++)
+            (l ? dy[l] : dy0)[indexv[i+NB]][k] = -cx[i][j][k+1];
+      }
+   }
+
+   for(i=NE; i >= 1; i--) free_dmatrix(cx[i],1,NCJ+nx,1,NCK);
+   free((char*) (cx+1));
+   free_dmatrix(sx,1,NE,1,jsx);
+}
+
+void spsolve(indexv,y,dy)	/* dy[p][species][k] = dy/dp */
+int indexv[];
+double **y,***dy;
+{
+   int l;
+   double dp[NSPAR+1],***drp;
+
+   drp = (double ***)malloc((unsigned) NSPAR*sizeof(double **))-1;
+   for(l=1; l <= NSPAR; l++) drp[l] = dmatrix(1,NE,1,M+1);
+
+   spdrdp(1,NSPAR,indexv,y,drp,dp);
+   spelim(indexv,y,NSPAR,drp,NULL,dy);
+
+   for(l=NSPAR; l >= 1; l--) free_dmatrix(drp[l],1,NE,1,M+1);
+   free((char*) (drp+1));
+}
+#endif
+
+#ifdef SENSIT
+void sensit(indexv,y)
+int indexv[];
+double **y;
+{
+   int a,k,l;
+   double ***dy;
+   FILE *fp;
+
+   dy = (double ***)malloc((unsigned) NSPAR*sizeof(double **))-1;
+   for(l=1; l <= NSPAR; l++) dy[l] = dmatrix(1,NE,1,M);
+
+   spsolve(indexv,y,dy);
+
+   fprintf(fppara,"--- sensitivities (SENSIT) --- \n");
+   fprintf(fppara,"d(shell value)/dp: parameter value");
+   for(a=1; a <= N2; a++) fprintf(fppara," %s",spname(a));
+   fprintf(fppara," \n");
+   fp = ctxopen("sens.sv4","w");
+   fprintf(fp,"# par r");
+   for(a=1; a <= N2; a++) fprintf(fp," %s",spname(a));
+   fprintf(fp,"\n");
+   for(l=1; l <= NSPAR; l++) {
+      fprintf(fppara,"%-9s %e",sparname(l),spvalue(l));
+      for(a=1; a <= N2; a++) fprintf(fppara," %e",dy[l][a][1]);
+      fprintf(fppara," \n");
+      for(k=1; k <= M; k++) {
+         fprintf(fp,"%s %e",sparname(l),r[k]);
+         for(a=1; a <= N2; a++) fprintf(fp," %e",dy[l][a][k]);
+         fprintf(fp,"\n");
+      }
+   }
+   fclose(fp);
+
+   for(l=NSPAR; l >= 1; l--) free_dmatrix(dy[l],1,NE,1,M);
+   free((char*) (dy+1));
+}
+#endif
+
+#ifdef MISFIT
+/* ----------------------------------------------------------------
+
+   measured profiles (ADJOINT, FIT), MISFILE: lines
+   "species r value sigma" (species as the .sv4 files or ph, '#':
+   comment). misres(): scaled residual (c(r_i) - d_i)/sigma_i and
+   its derivative with respect to c(r_i), c(r_i) linear in r
+   between the grid points (interval kd, weight w of point kd+1).
+   The mesh scales with RADIUS (spset()): the data move on the
+   mesh, misdr() is the explicit part of dres/dRADIUS.
+
+   ---------------------------------------------------------------- */
+
+int misread()		/* number of data, -1: no file */
+{
+   int a,i,ph;
+   double rd,dd,sd;
+   char spec[32];
+   FILE *fp;
+
+   fp = ctxopen(MISFILE,"r");
+   if(fp == NULL) return(-1);
+   nmis = 0;
+   while(fscanf(fp,"%31s",spec) == 1) {
+      if(spec[0] == '#') {			/* comment line */
+         while((i = fgetc(fp)) != EOF && i != '\n');
+         continue;
+      }
+      if(fscanf(fp,"%lf %lf %lf",&rd,&dd,&sd) != 3) break;
+      ph = (strcmp(spec,"ph") == 0);
+      for(a=1; a <= N2; a++)
+         if(strcmp(spname(a),ph ? "h" : spec) == 0) break;
+      if(a > N2 || nmis >= NMISMAX) continue;
+      nmis++;
+      misa[nmis] = ph ? -a : a;
+      misr[nmis] = rd;
+      misd[nmis] = dd;
+      miss[nmis] = sd;
+   }
+   fclose(fp);
+   return(nmis);
+}
+
+double misres(i,y,kd,w,dres)	/* residual of datum i */
+int i,*kd;
+double **y,*w,*dres;
+{
+   int a,k;
+   double cd;
+
+   a = (misa[i] < 0) ? -misa[i] : misa[i];
+   for(k=1; k < M-1 && r[k+1] < misr[i]; k++);
+   *kd = k;
+   *w  = (misr[i] - r[k])/(r[k+1] - r[k]);
+   if(*w < 0.0) *w = 0.0;
+   if(*w > 1.0) *w = 1.0;
+   cd = (1.-*w)*y[a][k] + *w*y[a][k+1];
+   if(misa[i] < 0) {				/* pH */
+      *dres = -1./(cd*log(10.)*miss[i]);
+      return((6. - log10(cd) - misd[i])/miss[i]);
+   }
+   *dres = 1./miss[i];
+   return((cd - misd[i])/miss[i]);
+}
+
+double misdr(i,y,kd,dres)	/* dres/dRADIUS, fixed y */
+int i,kd;
+double **y,dres;
+{
+   int a;
+
+   if(misr[i] <= r[1] || misr[i] >= r[M]) return(0.0);	/* clamped */
+   a = (misa[i] < 0) ? -misa[i] : misa[i];
+   return(-dres*(y[a][kd+1] - y[a][kd])/(r[kd+1] - r[kd])*misr[i]/RADIUS);
+}
+#endif
+
+#ifdef ADJOINT
+/* ----------------------------------------------------------------
+
+   adjoint gradient of the misfit to measured profiles (misread())
+
+     phi = 1/2 sum ((c(r_i) - d_i)/sigma_i)^2
+
+     J^T lambda = dphi/dy,   dphi/dp = -lambda^T dR/dp
+
+   One solve with the transposed Jacobian for all parameters: J^T
+   from the difeq blocks at the solution, band LU (bandec(),
+   banbks()), dR/dp from spdrdp().
+   -> par.sv4 and grad.sv4 (par value dphi/dp).
+
+   ---------------------------------------------------------------- */
+
+void adjoint(indexv,y)
+int indexv[];
+double **y;
+{
+   int a,i,jj,k,kd,l,r0,c0,n=NE*M,mb1=2*NE-NB-1,mb2=NE+NB-1,
+       is1,isf,jj1;
+   unsigned long *indx;
+   double w,res,dres,phi=0.0,det,dp[NSPAR+1],grad,gdr=0.0,
+          **s,**b,**al,*g,***drp;
+   FILE *fp;
+   void difeq(),bandec(),banbks();
+
+   if(misread() < 0) {
+      fprintf(fppara,"ADJOINT: no data file %s \n",MISFILE);
+      return;
+   }
+   g = dvector(1,n);
+   for(i=1; i <= n; i++) g[i] = 0.0;
+
+   /* --- misfit and dphi/dy --- */
+
+   for(i=1; i <= nmis; i++) {
+      a    = (misa[i] < 0) ? -misa[i] : misa[i];
+      res  = misres(i,y,&kd,&w,&dres);
+      phi += 0.5*res*res;
+      g[(kd-1)*NE+indexv[a]] += (1.-w)*res*dres;
+      g[kd*NE+indexv[a]]     +=     w*res*dres;
+      gdr += res*misdr(i,y,kd,dres);
+   }
+
+   /* --- J^T in band storage, row (col) of J: block k, eq. i --- */
+
+   s  = dmatrix(1,NE,1,NSJ);
+   b  = dmatrix(1,n,1,mb1+mb2+1);
+   al = dmatrix(1,n,1,mb1);
+   indx = (unsigned long *)malloc((unsigned) n*sizeof(unsigned long))-1;
+   for(i=1; i <= n; i++)
+      for(jj=1; jj <= mb1+mb2+1; jj++) b[i][jj] = 0.0;
+
+   ystore(y);
+   for(k=1; k <= M+1; k++) {
+      is1 = (k == 1)   ? NE-NB+1 : 1;
+      isf = (k == M+1) ? NE-NB   : NE;
+      jj1 = (k == 1 || k == M+1) ? NE+1 : 1;	/* BC: point 1 / M */
+      r0  = (k == 1) ? -(NE-NB) : NB + (k-2)*NE;
+      c0  = (k == M+1) ? (M-2)*NE : (k-2)*NE;
+      difeq(k,1,M,NSJ,is1,isf,indexv,NE,s,y);
+      for(i=is1; i <= isf; i++)
+         for(jj=jj1; jj <= 2*NE; jj++)
+            b[c0+jj][r0+i-(c0+jj)+mb1+1] = s[i][jj];
+   }
+   bandec(b,(unsigned long)n,mb1,mb2,al,indx,&det);
+   banbks(b,(unsigned long)n,mb1,mb2,al,indx,g);	/* g -> lambda */
+
+   /* --- dphi/dp --- */
+
+   drp = (double ***)malloc((unsigned) NSPAR*sizeof(double **))-1;
+   for(l=1; l <= NSPAR; l++) drp[l] = dmatrix(1,NE,1,M+1);
+   spdrdp(1,NSPAR,indexv,y,drp,dp);
+
+   fprintf(fppara,"--- misfit gradient (ADJOINT) --- \n");
+   fprintf(fppara,"data (%s)              %d \n",MISFILE,nmis);
+   fprintf(fppara,"misfit 1/2 sum(res^2)  %e \n",phi);
+   fprintf(fppara,"dphi/dp: parameter value dphi/dp \n");
+   fp = ctxopen("grad.sv4","w");
+   fprintf(fp,"# misfit %e\n",phi);
+   fprintf(fp,"# par value grad\n");
+   for(l=1; l <= NSPAR; l++) {
+      grad = (l == SPRAD) ? gdr : 0.0;
+      for(k=1; k <= M+1; k++) {
+         is1 = (k == 1)   ? NE-NB+1 : 1;
+         isf = (k == M+1) ? NE-NB   : NE;
+         r0  = (k == 1) ? -(NE-NB) : NB + (k-2)*NE;
+         for(i=is1; i <= isf; i++) grad -= g[r0+i]*drp[l][i][k];
+      }
+      fprintf(fppara,"%-9s %e %e \n",sparname(l),spvalue(l),grad);
+      fprintf(fp,"%s %e %e\n",sparname(l),spvalue(l),grad);
+   }
+   fclose(fp);
+
+   for(l=NSPAR; l >= 1; l--) free_dmatrix(drp[l],1,NE,1,M+1);
+   free((char*) (drp+1));
+   free((char*) (indx+1));
+   free_dmatrix(al,1,n,1,mb1);
+   free_dmatrix(b,1,n,1,mb1+mb2+1);
+   free_dmatrix(s,1,NE,1,NSJ);
+   free_dvector(g,1,n);
+}
+#endif
+
+#ifdef FIT
+/* ----------------------------------------------------------------
+
+   fit of selected parameters to measured profiles (misread())
+
+     min phi(p) = 1/2 sum ((c(r_i;p) - d_i)/sigma_i)^2,  lo <= p <= hi
+
+   FITFILE: lines "name lo hi" (names as sparname()). Levenberg-
+   Marquardt damped Gauss-Newton steps in the parameters scaled by
+   their start values x = p/|p0|:
+
+     (G + mu diag(G)) dx = -J^T res,   G = J^T J
+
+   J = dres/dx from the sensitivities of the converged solution,
+   spsolve() (the block elimination of solvde() with the columns
+   dR/dp, no further solves). Steps are limited to FITSTEP and
+   clipped to the bounds, each trial solution is iterated by
+   solvde() from the last one (spwarm: no uptake ramp). Stops when
+   phi decreases by less than FITTOL (relative) or no damping
+   gives a decrease. Covariance of the fitted parameters: G^-1 at
+   the optimum (sigma_i as the errors of the data). The solution
+   stays at the fitted parameters (profiles, SENSIT, ADJOINT).
+   -> par.sv4, fit.sv4 (par value sigma lo hi), fitcov.sv4,
+   fitit.sv4 (it misfit mu time[s] parameters).
+
+   ---------------------------------------------------------------- */
+
+double fitphi(y)		/* misfit */
+double **y;
+{
+   int i,kd;
+   double w,dres,res,phi=0.0;
+
+   for(i=1; i <= nmis; i++) {
+      res  = misres(i,y,&kd,&w,&dres);
+      phi += 0.5*res*res;
+   }
+   return(phi);
+}
+
+void fit(indexv,scalv,y,c,s)
+int indexv[];
+double scalv[],**y,***c,**s;
+{
+   int a,i,j,jj,k,kd,l,it,nf=0,acc,conv=0,ip[NSPAR+1],*indx;
+   double lo[NSPAR+1],hi[NSPAR+1],pb[NSPAR+1],sc[NSPAR+1],x[NSPAR+1],
+          xt[NSPAR+1],dx[NSPAR+1],gr[NSPAR+1],r0[MMAX+1],
+          w,res,dres,phi,phit,mu=FITMU,d,tm,
+          **gg,**aa,**cv,**jac,**yb,***dy;
+   char name[32];
+   clock_t tc;
+   FILE *fp,*fpit;
+   int solvde();
+   void ludcmp(),lubksb();
+
+   fp = ctxopen(FITFILE,"r");
+   if(fp == NULL || misread() < 1) {
+      fprintf(fppara,"FIT: no parameter file %s or no data %s \n",
+              FITFILE,MISFILE);
+      if(fp != NULL) fclose(fp);
+      return;
+   }
+   while(fscanf(fp,"%31s",name) == 1) {
+      if(name[0] == '#') {			/* comment line */
+         while((i = fgetc(fp)) != EOF && i != '\n');
+         continue;
+      }
+      if(fscanf(fp,"%lf %lf",&res,&w) != 2) break;
+      for(l=1; l <= NSPAR; l++)
+         if(strcmp(sparname(l),name) == 0) break;
+      if(l > NSPAR) {
+         fprintf(fppara,"FIT: unknown parameter %s \n",name);
+         continue;
+      }
+      nf++;
+      ip[nf] = l;
+      lo[nf] = res;
+      hi[nf] = w;
+   }
+   fclose(fp);
+   if(nf == 0) {
+      fprintf(fppara,"FIT: no parameters in %s \n",FITFILE);
+      return;
+   }
+
+   dy = (double ***)malloc((unsigned) NSPAR*sizeof(double **))-1;
+   for(l=1; l <= NSPAR; l++) dy[l] = dmatrix(1,NE,1,M);
+   jac  = dmatrix(1,nmis,1,nf);
+   gg   = dmatrix(1,nf,1,nf);
+   aa   = dmatrix(1,nf,1,nf);
+   cv   = dmatrix(1,nf,1,nf);
+   yb   = dmatrix(1,NE,1,M);
+   indx = ivector(1,nf);
+
+#ifdef ISTPDEC
+   for(a=1; a <= NE; a++) msub[a] = a;	/* full system */
+   ivfull = indexv;
+#endif
+   for(k=1; k <= M; k++) r0[k] = r[k];	/* unshifted mesh */
+#ifdef AUTOMESH
+   r0[0] = symlen;
+#endif
+   spwarm = 1;
+
+   fprintf(fppara,"--- parameter fit (FIT) --- \n");
+   fprintf(fppara,"data (%s)              %d \n",MISFILE,nmis);
+   fprintf(fppara,"parameter start lo hi \n");
+   acc = 0;
+   for(j=1; j <= nf; j++) {
+      pb[j] = spvalue(ip[j]);
+      x[j]  = pb[j];
+      if(x[j] < lo[j]) x[j] = lo[j];
+      if(x[j] > hi[j]) x[j] = hi[j];
+      if(x[j] != pb[j]) acc = 1;
+      sc[j] = fabs(pb[j]) > 0.0 ? fabs(pb[j]) : hi[j] - lo[j];
+      if(sc[j] <= 0.0) sc[j] = 1.0;
+      fprintf(fppara,"%-9s %e %e %e \n",sparname(ip[j]),x[j],lo[j],hi[j]);
+   }
+   if(acc) {				/* start outside the bounds */
+      spsetn(nf,ip,x,pb,r0,y);
+      if(solvde(ITMAX,CONV,SLOWC,scalv,indexv,NE,NB,M,y,c,s)) svabort(y);
+   }
+   phi = fitphi(y);
+
+   fpit = ctxopen("fitit.sv4","w");
+   fprintf(fpit,"# it misfit mu time");
+   for(j=1; j <= nf; j++) fprintf(fpit," %s",sparname(ip[j]));
+   fprintf(fpit,"\n");
+
+   tc = clock();
+   for(it=0; ; it++) {
+
+      /* --- J = dres/dx, gradient J^T res, G = J^T J --- */
+
+      spsolve(indexv,y,dy);
+      for(j=1; j <= nf; j++) {
+         gr[j] = 0.0;
+         for(jj=1; jj <= nf; jj++) gg[j][jj] = 0.0;
+      }
+      for(i=1; i <= nmis; i++) {
+         a   = (misa[i] < 0) ? -misa[i] : misa[i];
+         res = misres(i,y,&kd,&w,&dres);
+         for(j=1; j <= nf; j++) {
+            l = ip[j];
+            jac[i][j] = dres*((1.-w)*dy[l][a][kd] + w*dy[l][a][kd+1]);
+            if(l == SPRAD) jac[i][j] += misdr(i,y,kd,dres);
+            jac[i][j] *= sc[j];
+            gr[j]    += jac[i][j]*res;
+         }
+         for(j=1; j <= nf; j++)
+            for(jj=1; jj <= nf; jj++) gg[j][jj] += jac[i][j]*jac[i][jj];
+      }
+
+      tm = (double)(clock() - tc)/CLOCKS_PER_SEC;
+      tc = clock();
+      fprintf(fppara,"it %2d misfit %e mu %e time %f s \n",it,phi,mu,tm);
+      fprintf(fpit,"%d %e %e %e",it,phi,mu,tm);
+      for(j=1; j <= nf; j++) fprintf(fpit," %e",x[j]);
+      fprintf(fpit,"\n");
+      if(conv || it == FITIT) break;
+
+      /* --- damped steps until the misfit decreases --- */
+
+      for(a=1; a <= NE; a++)
+         for(k=1; k <= M; k++) yb[a][k] = y[a][k];
+      acc = 0;
+      for(l=0; l <= FITNMU; l++) {
+         for(j=1; j <= nf; j++) {
+            for(jj=1; jj <= nf; jj++) aa[j][jj] = gg[j][jj];
+            aa[j][j] += (gg[j][j] > 0.0) ? mu*gg[j][j] : 1.0;
+            dx[j] = -gr[j];
+         }
+         ludcmp(aa,nf,indx,&d);
+         lubksb(aa,nf,indx,dx);
+         d = 0.0;
+         for(j=1; j <= nf; j++) if(fabs(dx[j]) > d) d = fabs(dx[j]);
+         for(j=1; j <= nf; j++) {
+            if(d > FITSTEP) dx[j] *= FITSTEP/d;
+            xt[j] = x[j] + dx[j]*sc[j];
+            if(xt[j] < lo[j]) xt[j] = lo[j];
+            if(xt[j] > hi[j]) xt[j] = hi[j];
+         }
+         spsetn(nf,ip,xt,pb,r0,y);
+         phit = 1.e30;		/* not converged: as a worse step */
+         if(solvde(ITMAX,CONV,SLOWC,scalv,indexv,NE,NB,M,y,c,s) == SVOK) phit = fitphi(y);
+         if(phit < phi) {
+            acc = 1;
+            break;
+         }
+         for(a=1; a <= NE; a++)
+            for(k=1; k <= M; k++) y[a][k] = yb[a][k];
+         mu *= 10.;
+      }
+      if(!acc) {			/* no decrease: x is the optimum */
+         spsetn(nf,ip,x,pb,r0,y);
+         conv = 1;
+         continue;
+      }
+      conv = (phi - phit < FITTOL*phi);
+      phi  = phit;
+      for(j=1; j <= nf; j++) x[j] = xt[j];
+      mu *= 0.1;
+   }
+   fclose(fpit);
+   spwarm = 0;
+
+   /* --- covariance G^-1 (parameter units) --- */
+
+   for(j=1; j <= nf; j++)
+      for(jj=1; jj <= nf; jj++) aa[j][jj] = gg[j][jj];
+   for(j=1; j <= nf; j++) if(gg[j][j] == 0.0) aa[j][j] = 1.0;
+   ludcmp(aa,nf,indx,&d);
+   for(jj=1; jj <= nf; jj++) {
+      for(j=1; j <= nf; j++) dx[j] = (j == jj) ? 1.0 : 0.0;
+      lubksb(aa,nf,indx,dx);
+      for(j=1; j <= nf; j++)
+         cv[j][jj] = (gg[jj][jj] == 0.0) ? HUGE_VAL : dx[j]*sc[j]*sc[jj];
+   }
+
+   fprintf(fppara,"misfit 1/2 sum(res^2)  %e \n",phi);
+   if(nmis > nf)
+      fprintf(fppara,"chi^2/(data - par.)    %e \n",2.*phi/(double)(nmis-nf));
+   fprintf(fppara,"parameter value sigma \n");
+   fp = ctxopen("fit.sv4","w");
+   fprintf(fp,"# misfit %e\n",phi);
+   fprintf(fp,"# par value sigma lo hi\n");
+   for(j=1; j <= nf; j++) {
+      fprintf(fppara,"%-9s %e %e \n",sparname(ip[j]),x[j],sqrt(cv[j][j]));
+      fprintf(fp,"%s %e %e %e %e\n",sparname(ip[j]),x[j],sqrt(cv[j][j]),
+              lo[j],hi[j]);
+   }
+   fclose(fp);
+   fp = ctxopen("fitcov.sv4","w");
+   fprintf(fp,"# par");
+   for(j=1; j <= nf; j++) fprintf(fp," %s",sparname(ip[j]));
+   fprintf(fp,"\n");
+   for(j=1; j <= nf; j++) {
+      fprintf(fp,"%s",sparname(ip[j]));
+      for(jj=1; jj <= nf; jj++) fprintf(fp," %e",cv[j][jj]);
+      fprintf(fp,"\n");
+   }
+   fclose(fp);
+
+   free_ivector(indx,1,nf);
+   free_dmatrix(yb,1,NE,1,M);
+   free_dmatrix(cv,1,nf,1,nf);
+   free_dmatrix(aa,1,nf,1,nf);
+   free_dmatrix(gg,1,nf,1,nf);
+   free_dmatrix(jac,1,nmis,1,nf);
+   for(l=NSPAR; l >= 1; l--) free_dmatrix(dy[l],1,NE,1,M);
+   free((char*) (dy+1));
+}
+#endif
+
+#ifdef CONTIN
+/* ----------------------------------------------------------------
+
+   pseudo-arclength continuation of the solution in the parameter
+   CTPAR from its input value to CTEND. Scaled variables
+   Y = y/scalv, L = p/|CTEND - p0|, arclength s with
+
+     ds^2 = mean(dY^2) + dL^2
+
+   predictor: tangent (dY/ds, dL/ds) from J dy/dp = -dR/dp (b of
+   the last corrector iteration, i.e. no extra elimination);
+   corrector: bordered Newton on R(y,p) = 0 and the arclength
+   condition  mean(tY (Y - Yp)) + tL (L - Lp) = 0,  i.e.
+
+     J a = -R,  J b = -dR/dp  (one elimination, spelim()),
+     dp  = -(N + <tY,a>)/(<tY,b> + tL),  dy = a + dp b.
+
+   Turning points (folds) are passed, sign change of tL. Step
+   doubled / halved with the number of corrector iterations; the
+   last point is set to CTEND (Newton in y only). The solution
+   stays at CTEND. -> par.sv4, cont.sv4 (s par tL newton shell
+   values), contprof.sv4 (par r species, every CTPROF-th point).
+
+   ---------------------------------------------------------------- */
+
+double ctdot(u,v,w,scalv)	/* mean(u (v - w) / scalv^2), w: NULL = 0 */
+double **u,**v,**w,scalv[];
+{
+   int a,k;
+   double d=0.0;
+
+   for(a=1; a <= NE; a++)
+      for(k=1; k <= M; k++)
+         d += u[a][k]*(v[a][k] - (w == NULL ? 0.0 : w[a][k]))/SQ(scalv[a]);
+   return(d/(double)(NE*M));
+}
+
+void contin(indexv,scalv,y)
+int indexv[];
+double scalv[],**y;
+{
+   int a,k,it,np=0,nit=0,nel=0,ok,fin=0;
+   double r0[MMAX+1],dp[NSPAR+1],fac,lam,lam0,lamb,lams,lamo,lamp,
+          ds=CTDS,s=0.0,tl=0.0,tlo=0.0,dl,nn,err,
+          **ty,**tyo,**yo,**yp,**dy0,***drp,***dyp;
+   FILE *fp,*fpp;
+
+   lam0 = spvalue(CTPAR);
+   lamb = lam0 - sdp[CTPAR];		/* unshifted value */
+   lams = fabs(CTEND - lam0);
+   if(lams == 0.0) return;
+
+   ty  = dmatrix(1,NE,1,M);
+   tyo = dmatrix(1,NE,1,M);
+   yo  = dmatrix(1,NE,1,M);
+   yp  = dmatrix(1,NE,1,M);
+   dy0 = dmatrix(1,NE,1,M);
+   drp = (double ***)malloc((unsigned) NSPAR*sizeof(double **))-1;
+   dyp = (double ***)malloc((unsigned) NSPAR*sizeof(double **))-1;
+   drp[CTPAR] = dmatrix(1,NE,1,M+1);
+   dyp[CTPAR] = dmatrix(1,NE,1,M);
+
+   fac = (RADIUS - sdp[SPRAD])/RADIUS;	/* unshifted mesh */
+   for(k=1; k <= M; k++) r0[k] = r[k]*fac;
+#ifdef AUTOMESH
+   r0[0] = symlen*fac;
+#endif
+#ifdef ISTPDEC
+   for(a=1; a <= NE; a++) msub[a] = a;	/* full system */
+   ivfull = indexv;
+#endif
+
+   fprintf(fppara,"--- continuation (CONTIN) --- \n");
+   fprintf(fppara,"parameter %s from %e to %e \n",sparname(CTPAR),lam0,
+           (double)CTEND);
+   fp = ctxopen("cont.sv4","w");
+   fprintf(fp,"# s %s tL newton",sparname(CTPAR));
+   for(a=1; a <= N2; a++) fprintf(fp," %s",spname(a));
+   fprintf(fp,"\n");
+   fpp = ctxopen("contprof.sv4","w");
+   fprintf(fpp,"# %s r",sparname(CTPAR));
+   for(a=1; a <= N2; a++) fprintf(fpp," %s",spname(a));
+   fprintf(fpp,"\n");
+
+   lam = lam0;
+   it  = 0;
+   while(1) {
+
+      /* --- tangent (not at the last point), output --- */
+
+      if(!fin) {
+         if(np == 0) {		/* later: b of the last corrector step */
+            spdrdp(CTPAR,CTPAR,indexv,y,drp,dp);
+            spelim(indexv,y,1,drp+CTPAR-1,NULL,dyp+CTPAR-1);  /* dy/dp */
+            nel++;
+         }
+         for(a=1; a <= NE; a++)
+            for(k=1; k <= M; k++) ty[a][k] = dyp[CTPAR][a][k]*lams;
+         nn = sqrt(ctdot(ty,ty,NULL,scalv) + 1.0);
+         tl = 1.0/nn;
+         if(np == 0) {
+            if(CTEND < lam0) tl = -tl;		/* towards CTEND */
+         }
+         else if(ctdot(ty,tyo,NULL,scalv)/nn + tl*tlo < 0.0) tl = -tl;
+         for(a=1; a <= NE; a++)
+            for(k=1; k <= M; k++) ty[a][k] *= tl;	/* dy/ds */
+         if(np > 0 && tl*tlo < 0.0)
+            fprintf(fppara,"turning point between %s = %e and %e \n",
+                    sparname(CTPAR),lamo,lam);
+      }
+      fprintf(fp,"%e %e %e %d",s,lam,tl,it);
+      for(a=1; a <= N2; a++) fprintf(fp," %e",y[a][1]);
+      fprintf(fp,"\n");
+      if(np%CTPROF == 0 || fin)
+         for(k=1; k <= M; k++) {
+            fprintf(fpp,"%e %e",lam,r[k]);
+            for(a=1; a <= N2; a++) fprintf(fpp," %e",y[a][k]);
+            fprintf(fpp,"\n");
+         }
+      if(fin) break;
+      if(np >= CTNMAX) {
+         fprintf(fppara,"CONTIN: CTNMAX points, stopped at %e \n",lam);
+         break;
+      }
+      for(a=1; a <= NE; a++)
+         for(k=1; k <= M; k++) {
+            tyo[a][k] = ty[a][k];
+            yo[a][k]  = y[a][k];
+         }
+      tlo  = tl;
+      lamo = lam;
+
+      /* --- predictor, corrector; step halved on failure --- */
+
+      while(1) {
+         if(ds < CTDSMIN) break;
+         lamp = lamo + ds*tl*lams;
+         if((lamp - CTEND)*(CTEND - lam0) >= 0.0 && tl*(CTEND - lam0) > 0.0) {
+            ds   = (CTEND - lamo)/(tl*lams);	/* last point: CTEND */
+            lamp = CTEND;
+            fin  = 1;
+         }
+         for(a=1; a <= NE; a++)
+            for(k=1; k <= M; k++) y[a][k] = yp[a][k] = yo[a][k] + ds*ty[a][k];
+         lam = lamp;
+
+         ok = 0;
+         for(it=1; it <= CTNEWT; it++) {
+            spset(CTPAR,lam - lamb,r0,y);
+            if(fin) {				/* p = CTEND */
+               spelim(indexv,y,0,drp,dy0,dyp);
+               dl = 0.0;
+            }
+            else {
+               spdrdp(CTPAR,CTPAR,indexv,y,drp,dp);
+               spelim(indexv,y,1,drp+CTPAR-1,dy0,dyp+CTPAR-1);
+               dl  = -(ctdot(ty,y,yp,scalv) + tl*(lam - lamp)/lams
+                       + ctdot(ty,dy0,NULL,scalv))
+                    /(ctdot(ty,dyp[CTPAR],NULL,scalv) + tl/lams);
+            }
+            nel++;
+            err = fabs(dl)/lams;
+            for(a=1; a <= NE; a++)
+               for(k=1; k <= M; k++) {
+                  if(!fin) dy0[a][k] += dl*dyp[CTPAR][a][k];
+                  y[a][k] += dy0[a][k];
+                  err += fabs(dy0[a][k])/scalv[a]/(double)(NE*M);
+               }
+            lam += dl;
+            for(a=1; a <= N2; a++)		/* concentrations > 0 */
+               for(k=1; k <= M; k++) if(!(y[a][k] > 0.0)) err = HUGE_VAL;
+            if(err == HUGE_VAL) break;
+            if(err < CTTOL) {
+               ok = 1;
+               break;
+            }
+         }
+         if(ok) break;
+         ds *= 0.5;				/* failed: shorter step */
+         fin = 0;
+         for(a=1; a <= NE; a++)
+            for(k=1; k <= M; k++) y[a][k] = yo[a][k];
+         lam = lamo;
+      }
+      if(!ok) {
+         spset(CTPAR,lam - lamb,r0,y);
+         fprintf(fppara,"CONTIN: step < CTDSMIN at %s = %e \n",
+                 sparname(CTPAR),lam);
+         break;
+      }
+      spset(CTPAR,lam - lamb,r0,y);
+      np++;
+      nit += it;
+      s   += ds;
+      if(it <= 3) ds *= 2.0;
+      else if(it >= 5) ds *= 0.5;
+      if(ds > CTDSMAX) ds = CTDSMAX;
+   }
+   fclose(fpp);
+   fclose(fp);
+
+   fprintf(fppara,"points                        %d \n",np+1);
+   fprintf(fppara,"corrector iterations          %d \n",nit);
+   fprintf(fppara,"eliminations (solvde: %d)     %d \n",itsol,nel);
+   fprintf(fppara,"end: %s = %e \n",sparname(CTPAR),spvalue(CTPAR));
+
+   free_dmatrix(dyp[CTPAR],1,NE,1,M);
+   free_dmatrix(drp[CTPAR],1,NE,1,M+1);
+   free((char*) (dyp+1));
+   free((char*) (drp+1));
+   free_dmatrix(dy0,1,NE,1,M);
+   free_dmatrix(yp,1,NE,1,M);
+   free_dmatrix(yo,1,NE,1,M);
+   free_dmatrix(tyo,1,NE,1,M);
+   free_dmatrix(ty,1,NE,1,M);
+}
+#endif
+
+#ifdef BATCH
+/* ----------------------------------------------------------------
+
+   batched scenarios: the solution for many parameter sets (BTFILE:
+   a line of SPSHIFT parameter names, then one line of values per
+   scenario), NLANE at a time. Each lane does the Newton iterations
+   of solvde() (damping SLOWC, convergence CONV) on its own
+   scenario, started as main() (yinit(), the uptake ramp vmramp()
+   of its iterations). A start from the converged solution of the
+   input parameters (no ramp) takes 3 - 68 iterations on a spread
+   of PHBULK, SYMTCUPT and RADIUS, the ramped start 6 - 9.
+   The blocks of the lanes are stored with the lane index innermost
+   (LVEC, a GCC vector type), so red(), pinvs() and bksub() act on
+   NLANE scenarios per instruction (-O2 -march=native: AVX). The
+   derived quantities are set per lane (spsetn()) for BTCHUNK mesh
+   points of difeq() at a time. Common pivots of the lanes in
+   btpinvs(): largest scaled element, the minimum over the lanes;
+   the pivots of the last sweep are kept while they are not small
+   (BTPTOL) in any lane.
+   A lane that has converged (or failed after ITMAX iterations)
+   takes the next scenario. The solution stays at the input
+   parameters. -DBTSERIAL: one scenario after the other by solvde()
+   (reference). -> par.sv4, batch.sv4 (scen it parameters shell
+   values; it < 0: not converged), batchprof.sv4 (-DBTPROF:
+   scen r species).
+
+   ---------------------------------------------------------------- */
+
+typedef double LVEC __attribute__ ((vector_size (NLANE*sizeof(double))));
+
+LVEC **lmatrix(nrl,nrh,ncl,nch)	/* m[nrl..nrh][ncl..nch], aligned */
+int nrl,nrh,ncl,nch;
+{
+   int i,nc=nch-ncl+1;
+   LVEC **m,*v;
+
+   m = (LVEC **) malloc((unsigned) (nrh-nrl+1)*sizeof(LVEC *));
+   if(!m || posix_memalign((void **) &v,sizeof(LVEC),
+                           (size_t) (nrh-nrl+1)*nc*sizeof(LVEC)))
+      svfail(SVNOMEM,"allocation failure in lmatrix()");
+   m -= nrl;
+   for(i=nrl; i <= nrh; i++) m[i] = v + (i-nrl)*nc - ncl;
+   return(m);
+}
+
+void free_lmatrix(m,nrl,ncl)
+LVEC **m;
+int nrl,ncl;
+{
+   free((char*) (m[nrl]+ncl));
+   free((char*) (m+nrl));
+}
+
+void btpinvs(ie1,ie2,je1,jsf,jc1,k,c,s,pv)	/* pinvs(), NLANE lanes */
+int ie1,ie2,je1,jsf,jc1,k,pv[];		/* pv: pivots of the last sweep */
+LVEC ***c,**s;
+{
+	int js1,jpiv,jp,je2,jcoff,j,jj,nj,irow,ipiv,id,icoff,i,l,nz,
+	    indxr[NE+1],jl[NSJ+1];
+	double piv,big,v,vl,pscl[NE+1][NLANE];
+	LVEC pivinv,dum,ss;
+
+	je2=je1+ie2-ie1;
+	js1=je2+1;
+	for (i=ie1;i<=ie2;i++) indxr[i]=0;
+	nj=0;			/* columns not yet pivot (zero in the pivot row) */
+	for (j=je1;j<=jsf;j++) jl[nj++]=j;
+	for (id=ie1;id<=ie2;id++) {
+		if (pv[0]) {		/* last pivot, if not too small in a lane */
+			ipiv=pv[2*(id-ie1)+1];
+			jpiv=pv[2*(id-ie1)+2];
+			ss=s[ipiv][je1]*s[ipiv][je1];
+			for (j=je1+1;j<=je2;j++) ss += s[ipiv][j]*s[ipiv][j];
+			for (l=0;l<NLANE;l++)
+				if (SQ(s[ipiv][jpiv][l]) < SQ(BTPTOL)*ss[l]) pv[0]=0;
+			if (!pv[0]) {	/* full search from here: row scales */
+				for (i=ie1;i<=ie2;i++) {
+					for (l=0;l<NLANE;l++) {
+						big=0.0;
+						for (j=je1;j<=je2;j++)
+							if (fabs(s[i][j][l]) > big) big=fabs(s[i][j][l]);
+						if (big == 0.0)
+							svfail(SVSING,"Singular matrix - row all 0, in BTPINVS");
+						pscl[i][l]=1.0/big;
+					}
+				}
+			}
+		}
+		else if (id == ie1) {
+			for (i=ie1;i<=ie2;i++) {
+				for (l=0;l<NLANE;l++) {
+					big=0.0;
+					for (j=je1;j<=je2;j++)
+						if (fabs(s[i][j][l]) > big) big=fabs(s[i][j][l]);
+					if (big == 0.0)
+						svfail(SVSING,"Singular matrix - row all 0, in BTPINVS");
+					pscl[i][l]=1.0/big;
+				}
+			}
+		}
+		if (!pv[0]) {
+			piv=0.0;
+			ipiv=ie1;
+			jpiv=je1;
+			for (i=ie1;i<=ie2;i++) {
+				if (indxr[i] == 0) {
+					big=0.0;
+					jp=je1;
+					for (j=je1;j<=je2;j++) {
+						v=fabs(s[i][j][0])*pscl[i][0];	/* min. of the lanes */
+						for (l=1;l<NLANE;l++) {
+							vl=fabs(s[i][j][l])*pscl[i][l];
+							if (vl < v) v=vl;
+						}
+						if (v > big) {
+							jp=j;
+							big=v;
+						}
+					}
+					if (big > piv) {
+						ipiv=i;
+						jpiv=jp;
+						piv=big;
+					}
+				}
+			}
+			if (piv == 0.0) svfail(SVSING,"Singular matrix in routine BTPINVS");
+			pv[2*(id-ie1)+1]=ipiv;
+			pv[2*(id-ie1)+2]=jpiv;
+		}
+		indxr[ipiv]=jpiv;
+		for (jj=0;jl[jj] != jpiv;jj++);
+		jl[jj]=jl[--nj];
+		for (l=0;l<NLANE;l++) pivinv[l]=1.0/s[ipiv][jpiv][l];
+		for (jj=0;jj<nj;jj++) s[ipiv][jl[jj]] *= pivinv;
+		for (l=0;l<NLANE;l++) s[ipiv][jpiv][l]=1.0;
+		for (i=ie1;i<=ie2;i++) {
+			if (indxr[i] != jpiv) {
+				dum=s[i][jpiv];
+				for (nz=0,l=0;l<NLANE;l++) if (dum[l] != 0.0) nz=1;
+				if (nz) {
+					for (jj=0;jj<nj;jj++)
+						s[i][jl[jj]] -= dum*s[ipiv][jl[jj]];
+					for (l=0;l<NLANE;l++) s[i][jpiv][l]=0.0;
+				}
+			}
+		}
+	}
+	pv[0]=1;
+	jcoff=jc1-js1;
+	icoff=ie1-je1;
+	for (i=ie1;i<=ie2;i++) {
+		irow=indxr[i]+icoff;
+		for (j=js1;j<=jsf;j++) c[irow][j+jcoff][k]=s[i][j];
+	}
+}
+
+void btred(iz1,iz2,jz1,jz2,jm1,jm2,jmf,ic1,jc1,jcf,kc,c,s)  /* red() */
+LVEC ***c,**s;
+int iz1,iz2,jz1,jz2,jm1,jm2,jmf,ic1,jc1,jcf,kc;
+{
+	int loff,l,j,ic,i;
+	LVEC vx;
+
+	loff=jc1-jm1;
+	ic=ic1;
+	for (j=jz1;j<=jz2;j++) {
+		for (l=jm1;l<=jm2;l++) {
+			vx=c[ic][l+loff][kc];
+			for (i=iz1;i<=iz2;i++) s[i][l] -= s[i][j]*vx;
+		}
+		vx=c[ic][jcf][kc];
+		for (i=iz1;i<=iz2;i++) s[i][jmf] -= s[i][j]*vx;
+		ic += 1;
+	}
+}
+
+void btbksub(ne,nb,jf,k1,k2,c)		/* bksub() */
+int ne,nb,jf,k1,k2;
+LVEC ***c;
+{
+	int nbf,im,kp,k,j,i;
+	LVEC xx;
+
+	nbf=ne-nb;
+	im=1;
+	for (k=k2;k>=k1;k--) {
+		if (k == k1) im=nbf+1;
+		kp=k+1;
+		for (j=1;j<=nbf;j++) {
+			xx=c[j][jf][kp];
+			for (i=im;i<=ne;i++)
+				c[i][jf][k] -= c[i][j][k]*xx;
+		}
+	}
+	for (k=k1;k<=k2;k++) {
+		kp=k+1;
+		for (i=1;i<=nb;i++) c[i][1][k]=c[i+nbf][jf][k];
+		for (i=1;i<=nbf;i++) c[i+nb][1][k]=c[i][jf][kp];
+	}
+}
+
+void btprof(fp,n,y)		/* profiles of scenario n */
+FILE *fp;
+int n;
+double **y;
+{
+   int a,k;
+
+   for(k=1; k <= M; k++) {
+      fprintf(fp,"%d %e",n,r[k]);
+      for(a=1; a <= N2; a++) fprintf(fp," %e",y[a][k]);
+      fprintf(fp,"\n");
+   }
+}
+
+void btstart(indexv,y)	/* start of a scenario: initial guess of main() */
+int indexv[];
+double **y;
+{
+#ifdef LININIT
+   FILE *fpsave;
+   static CTX FILE *fpnull = NULL;
+#endif
+   void yinit();
+
+   yinit(y);
+#ifdef LININIT
+   if(fpnull == NULL) fpnull = tmpfile();
+   rewind(fpnull);
+   fpsave = fppara;		/* par.sv4: no modes per scenario */
+   fppara = fpnull;
+   lininit(indexv,y);
+   fppara = fpsave;
+#endif
+}
+
+void batch(indexv,scalv,y,c,s)
+int indexv[];
+double scalv[],**y,***c,**s;
+{
+   int a,j,k,n,nf,nsc,nsw=0,nit=0,nfail=0,ip[NSPAR+1],*its;
+   double pb[NSPAR+1],sd0[NSPAR+1],r0[MMAX+1],fac,tm,
+          **x,**ysh,**yb;
+   clock_t tc;
+   FILE *fp,*fpp=NULL;
+   int solvde();
+#ifndef BTSERIAL
+   int i,l,next,nact,k0,kn,is1,isf,jv,sl[NLANE],act[NLANE],it[NLANE],
+       rmp[NLANE],**pv;
+   double err,vz,**yl[NLANE];
+#ifdef MIMECO2SYM
+   double vmramp();
+#endif
+   double **sd[NLANE][BTCHUNK];
+   LVEC ***cb,**sk;
+   void difeq();
+#endif
+
+   if((nsc = spread("BATCH",BTFILE,ip,&nf,&x)) == 0) return;
+   its = ivector(1,nsc);
+   ysh = dmatrix(1,nsc,1,N2);
+   yb  = dmatrix(1,NE,1,M);
+
+#ifdef ISTPDEC
+   for(a=1; a <= NE; a++) msub[a] = a;	/* full system */
+   ivfull = indexv;
+#endif
+   fac = (RADIUS - sdp[SPRAD])/RADIUS;	/* unshifted mesh */
+   for(k=1; k <= M; k++) r0[k] = r[k]*fac;
+#ifdef AUTOMESH
+   r0[0] = symlen*fac;
+#endif
+   for(j=1; j <= nf; j++) {
+      sd0[j] = sdp[ip[j]];
+      pb[j]  = spvalue(ip[j]) - sd0[j];	/* unshifted */
+   }
+   for(a=1; a <= NE; a++)
+      for(k=1; k <= M; k++) yb[a][k] = y[a][k];
+
+   fprintf(fppara,"--- batched scenarios (BATCH) --- \n");
+   fprintf(fppara,"scenarios (%s)            %d \n",BTFILE,nsc);
+   fprintf(fppara,"parameters               ");
+   for(j=1; j <= nf; j++) fprintf(fppara," %s",sparname(ip[j]));
+   fprintf(fppara," \n");
+#ifdef BTPROF
+   fpp = ctxopen("batchprof.sv4","w");
+   fprintf(fpp,"# scen r");
+   for(a=1; a <= N2; a++) fprintf(fpp," %s",spname(a));
+   fprintf(fpp,"\n");
+#endif
+   tc = clock();
+
+#ifdef BTSERIAL
+   /* --- reference: one scenario after the other --- */
+
+   fprintf(fppara,"one at a time (BTSERIAL) \n");
+   for(n=1; n <= nsc; n++) {
+      spsetn(nf,ip,x[n],pb,r0,y);
+      btstart(indexv,y);
+      if(solvde(ITMAX,CONV,SLOWC,scalv,indexv,NE,NB,M,y,c,s) != SVOK) {
+         fprintf(fppara,"scenario %d: %s (it %d, k %d) \n",n,svmsg,svit,svk);
+         its[n] = -svit;		/* not converged, as the lanes */
+         nfail++;
+      }
+      else its[n] = itsol;
+      nit += itsol;
+      nsw += itsol;
+      for(a=1; a <= N2; a++) ysh[n][a] = y[a][1];
+      if(fpp != NULL) btprof(fpp,n,y);
+   }
+   for(a=1; a <= NE; a++)
+      for(k=1; k <= M; k++) y[a][k] = yb[a][k];
+#else
+   /* --- NLANE scenarios per sweep --- */
+
+   fprintf(fppara,"lanes (NLANE)            %d \n",NLANE);
+   cb = (LVEC ***)malloc((unsigned) NE*sizeof(LVEC **))-1;
+   for(i=1; i <= NE; i++) cb[i] = lmatrix(1,NCJ,1,NCK);
+   sk = lmatrix(1,NE,1,NSJ);
+   for(l=0; l < NLANE; l++)
+      for(k=0; k < BTCHUNK; k++) sd[l][k] = dmatrix(1,NE,1,NSJ);
+   pv = imatrix(1,NCK,0,2*NE);		/* pivots per block, btpinvs() */
+   for(k=1; k <= NCK; k++) pv[k][0] = 0;
+
+   next = 1;
+   for(l=0; l < NLANE; l++) {
+      yl[l]  = dmatrix(1,NE,1,M);
+      act[l] = (next <= nsc);
+      sl[l]  = act[l] ? next++ : 1;	/* idle: copy of scenario 1 */
+      it[l]  = 0;
+      spsetn(nf,ip,x[sl[l]],pb,r0,yl[l]);
+      btstart(indexv,yl[l]);
+   }
+
+   for(nact=NLANE; nact > 0; ) {
+
+      /* --- blocks of the lanes, BTCHUNK mesh points at a time,
+             and their elimination (as solvde())                --- */
+
+      for(k0=1; k0 <= M+1; k0 += BTCHUNK) {
+         kn = (k0+BTCHUNK-1 < M+1) ? k0+BTCHUNK-1 : M+1;
+         for(l=0; l < NLANE; l++) {
+            spsetn(nf,ip,x[sl[l]],pb,r0,yl[l]);
+            rmp[l] = 1;			/* ramp done */
+#ifdef MIMECO2SYM
+            vmaxit = vmramp(it[l]+1);
+            rmp[l] = (vmaxit >= vmaxco2);
+#endif
+            for(k=k0; k <= kn; k++) {
+               is1 = (k == 1)   ? NE-NB+1 : 1;
+               isf = (k == M+1) ? NE-NB   : NE;
+               difeq(k,1,M,NSJ,is1,isf,indexv,NE,sd[l][k-k0],yl[l]);
+            }
+         }
+         for(k=k0; k <= kn; k++) {
+            is1 = (k == 1)   ? NE-NB+1 : 1;
+            isf = (k == M+1) ? NE-NB   : NE;
+            for(i=is1; i <= isf; i++)		/* lanes innermost */
+               for(j=1; j <= NSJ; j++)
+                  for(l=0; l < NLANE; l++) sk[i][j][l] = sd[l][k-k0][i][j];
+            if(k == 1)
+               btpinvs(NE-NB+1,NE,NE+1,NSJ,1,1,cb,sk,pv[1]);
+            else if(k <= M) {
+               btred(1,NE,1,NB,NB+1,NE,NSJ,NE-NB+1,1,NE-NB+1,k-1,cb,sk);
+               btpinvs(1,NE,NB+1,NSJ,1,k,cb,sk,pv[k]);
+            }
+            else {
+               btred(1,NE-NB,NE+1,NE+NB,NE+NB+1,2*NE,NSJ,NE-NB+1,1,
+                     NE-NB+1,M,cb,sk);
+               btpinvs(1,NE-NB,NE+NB+1,NSJ,NE-NB+1,M+1,cb,sk,pv[M+1]);
+            }
+         }
+      }
+      btbksub(NE,NB,NE-NB+1,1,M,cb);
+      nsw++;
+
+      /* --- Newton step per lane; converged: next scenario --- */
+
+      for(l=0; l < NLANE; l++) {
+         if(!act[l]) continue;
+         err = 0.0;
+         for(j=1; j <= NE; j++) {
+            vz = 0.0;
+            for(k=1; k <= M; k++) vz += fabs(cb[j][1][k][l]);
+            err += vz/scalv[indexv[j]];
+         }
+         err /= (double)(NE*M);
+         fac = (err > SLOWC) ? SLOWC/err : 1.0;
+         for(jv=1; jv <= NE; jv++) {
+            j = indexv[jv];
+            for(k=1; k <= M; k++) yl[l][j][k] -= fac*cb[jv][1][k][l];
+         }
+         it[l]++;
+         nit++;
+         if((err < CONV && rmp[l]) || it[l] >= ITMAX || !(err == err)) {
+            n = sl[l];
+            its[n] = (err < CONV && rmp[l]) ? it[l] : -it[l];
+            if(its[n] < 0) nfail++;
+            for(a=1; a <= N2; a++) ysh[n][a] = yl[l][a][1];
+            if(fpp != NULL) {
+               spsetn(nf,ip,x[n],pb,r0,yl[l]);	/* mesh */
+               btprof(fpp,n,yl[l]);
+            }
+            if(next <= nsc) {
+               sl[l] = next++;
+               it[l] = 0;
+               spsetn(nf,ip,x[sl[l]],pb,r0,yl[l]);
+               btstart(indexv,yl[l]);
+            }
+            else {
+               act[l] = 0;
+               nact--;
+            }
+         }
+      }
+   }
+
+   for(l=NLANE-1; l >= 0; l--) free_dmatrix(yl[l],1,NE,1,M);
+   free_imatrix(pv,1,NCK,0,2*NE);
+   for(l=NLANE-1; l >= 0; l--)
+      for(k=BTCHUNK-1; k >= 0; k--) free_dmatrix(sd[l][k],1,NE,1,NSJ);
+   free_lmatrix(sk,1,1);
+   for(i=NE; i >= 1; i--) free_lmatrix(cb[i],1,1);
+   free((char*) (cb+1));
+#endif
+   tm = (double)(clock() - tc)/CLOCKS_PER_SEC;
+   if(fpp != NULL) fclose(fpp);
+
+   /* --- back to the input parameters --- */
+
+   for(j=1; j < nf; j++) sdp[ip[j]] = sd0[j];
+   spset(ip[nf],sd0[nf],r0,y);
+
+   fp = ctxopen("batch.sv4","w");
+   fprintf(fp,"# scen it");
+   for(j=1; j <= nf; j++) fprintf(fp," %s",sparname(ip[j]));
+   for(a=1; a <= N2; a++) fprintf(fp," %s",spname(a));
+   fprintf(fp,"\n");
+   for(n=1; n <= nsc; n++) {
+      fprintf(fp,"%d %d",n,its[n]);
+      for(j=1; j <= nf; j++) fprintf(fp," %e",x[n][j]);
+      for(a=1; a <= N2; a++) fprintf(fp," %e",ysh[n][a]);
+      fprintf(fp,"\n");
+   }
+   fclose(fp);
+
+   fprintf(fppara,"Newton iterations        %d \n",nit);
+   fprintf(fppara,"eliminations (sweeps)    %d \n",nsw);
+   fprintf(fppara,"not converged            %d \n",nfail);
+   fprintf(fppara,"time [s], per scenario   %f %e \n",tm,tm/(double)nsc);
+
+   free_dmatrix(yb,1,NE,1,M);
+   free_dmatrix(ysh,1,nsc,1,N2);
+   free_ivector(its,1,nsc);
+   free_dmatrix(x,1,nsc,1,nf);
+}
+#endif
+
+#ifdef ROM
+/* ----------------------------------------------------------------
+
+   reduced-order model: POD basis from converged solutions of the
+   training scenarios (ROMFILE, names and values as BTFILE), solved
+   for the queries (ROMQFILE, the same parameters) in the basis,
+
+     y = yb + sum_l q_l phi_l
+
+   yb: solution at the input parameters. The modes phi_l are those
+   of the snapshots y - yb, all variables (species and fluxes, / scalv)
+   in one vector, so each mode satisfies the linear (transport) rows
+   of difeq as the snapshots do; down to an rms amplitude ROMEPS, at
+   most ROMMAX. Hyper-reduction: the difeq residual is evaluated only
+   on the intervals of the empirical interpolation (DEIM) rows of the
+   mode responses J phi_l at yb, i.e. the reactions only at these
+   mesh points. Gauss-Newton on the least squares of these rows, each
+   scaled by the Newton correction it implies (rmw). Start: the
+   coefficients of the nearest training scenario. Error estimate:
+   residual on ROMNV validation intervals, relative to the one of yb,
+
+     est = |R(y)|_V / |R(yb)|_V
+
+   Outside the training box (margin ROMBOX), est > ROMTOL or no
+   convergence: solvde() from the nearest training solution
+   (fallback). -DROMVERIFY: every query also by solvde(), err: max.
+   error of the reduced shell values / scalv (also if not taken).
+   -> par.sv4, rom.sv4 (scen it est [err] parameters shell values;
+   it = 0: reduced solution, > 0: solvde iterations of the fallback).
+
+   ---------------------------------------------------------------- */
+
+void romy(p,q,y)		/* y at mesh point p from q, -> difeq */
+int p;
+double q[],**y;
+{
+   int a,l;
+   double d;
+
+   for(a=1; a <= NE; a++) {
+      d = rmyb[a][p];
+      for(l=1; l <= rmnq; l++) d += rmphi[p][a][l]*q[l];
+      y[a][p] = d;
+   }
+   ystorek(p,y);
+}
+
+void romjac(k,is1,isf,indexv,s,jr)	/* jr[i][l] = J phi_l, interval k */
+int k,is1,isf,indexv[];
+double **s,**jr;
+{
+   int a,i,j,l;
+   double sr,sl,*br,*bl;
+
+   for(i=is1; i <= isf; i++) {
+      for(l=1; l <= rmnq; l++) jr[i][l] = 0.0;
+      for(a=1; a <= NE; a++) {
+         j  = indexv[a];
+         sr = rmw[k][i]*s[i][NE+j];
+         br = rmphi[(k <= M) ? k : M][a];
+         for(l=1; l <= rmnq; l++) jr[i][l] += sr*br[l];
+         if(k == 1 || k > M) continue;
+         sl = rmw[k][i]*s[i][j];
+         bl = rmphi[k-1][a];
+         for(l=1; l <= rmnq; l++) jr[i][l] += sl*bl[l];
+      }
+   }
+}
+
+double romres(n1,n2,q,indexv,y,s,jr,aa,g)	/* intervals rmblk[n1..n2] */
+int n1,n2,indexv[];		/* returns sum (rmw R)^2;	  */
+double q[],**y,**s,**jr,**aa,g[];	/* jr: J phi of the intervals,	  */
+{				/* aa: new jr, += J^T J; g += J^T R */
+   int i,l,m,n,k,is1,isf;
+   double rr,f=0.0,*jx;
+   void difeq();
+
+   for(n=n1; n <= n2; n++) {
+      k   = rmblk[n];
+      is1 = (k == 1)   ? NE-NB+1 : 1;
+      isf = (k == M+1) ? NE-NB   : NE;
+      if(k > 1 && k <= M) romy(k-1,q,y);
+      romy((k <= M) ? k : M,q,y);
+      difeq(k,1,M,NSJ,is1,isf,indexv,NE,s,y);
+      if(aa != NULL) romjac(k,is1,isf,indexv,s,jr+(n-n1)*NE);
+      for(i=is1; i <= isf; i++) {
+         rr = rmw[k][i]*s[i][NSJ];
+         f += rr*rr;
+         if(g == NULL) continue;
+         jx = jr[(n-n1)*NE+i];
+         for(l=1; l <= rmnq; l++) g[l] += jx[l]*rr;
+         if(aa == NULL) continue;
+         for(l=1; l <= rmnq; l++)
+            for(m=l; m <= rmnq; m++) aa[l][m] += jx[l]*jx[m];
+      }
+   }
+   return(f);
+}
+
+int romsolve(q,indexv,y,s,jr,aa,dq,indx)	/* Gauss-Newton, q: start */
+int indexv[],indx[];			/* returns iterations,	  */
+double q[],**y,**s,**jr,**aa,dq[];	/* < 0: not converged	  */
+{
+   int it,l,m,njac=1;
+   double d,dold=0.0;
+   void ludcmp(),lubksb();
+
+   for(it=1; it <= ROMIT; it++) {
+      for(l=1; l <= rmnq; l++) {
+         dq[l] = 0.0;
+         if(njac)
+            for(m=l; m <= rmnq; m++) aa[l][m] = 0.0;
+      }
+      romres(1,rmnb,q,indexv,y,s,jr,njac ? aa : NULL,dq);
+      if(njac) {			/* else J of an earlier iteration */
+         for(l=1; l <= rmnq; l++)
+            for(m=1; m < l; m++) aa[l][m] = aa[m][l];
+         ludcmp(aa,rmnq,indx,&d);
+      }
+      for(l=1; l <= rmnq; l++) dq[l] = -dq[l];
+      lubksb(aa,rmnq,indx,dq);
+      d = 0.0;
+      for(l=1; l <= rmnq; l++) {
+         q[l] += dq[l];
+         d += dq[l]*dq[l];
+      }
+      d = sqrt(d/(double)(NE*M));	/* rms change of y / scalv */
+      if(!(d == d)) break;
+      if(d < ROMCONV) return(it);
+      njac = (it > 1 && d > ROMRATE*dold);
+      dold = d;
+   }
+   return(-it);
+}
+
+void rom(indexv,scalv,y,c,s)
+int indexv[];
+double scalv[],**y,***c,**s;
+{
+   int a,i,j,k,l,m,n,p,nf,nfq,nt,nsc,nq1,it,ntr,inbox,acc,nok=0,nfb=0,
+       nbox=0,nest=0,nnc=0,ip[NSPAR+1],ipq[NSPAR+1],*its,*indx,*prow,
+       *sel;
+   double pb[NSPAR+1],sd0[NSPAR+1],r0[MMAX+1],lo[NSPAR+1],hi[NSPAR+1],
+          fac,d,rr,f0,tm,tmfb=0.0,
+          **x,**xq,**ysh,**yr,***dt,**cc,**ev,*lam,**jr,**u,**qtr,
+          **aa,*q,*dq,*est,*err;
+#ifdef ROMVERIFY
+   double tmv=0.0,ermax=0.0;
+#endif
+   clock_t tc;
+   FILE *fp;
+   int solvde();
+   void difeq(),ludcmp(),lubksb();
+
+   if((nt = spread("ROM",ROMFILE,ip,&nf,&x)) == 0) return;
+   if((nsc = spread("ROM",ROMQFILE,ipq,&nfq,&xq)) == 0) {
+      free_dmatrix(x,1,nt,1,nf);
+      return;
+   }
+   for(j=1; j <= nf; j++)
+      if(nfq != nf || ipq[j] != ip[j]) break;
+   if(j <= nf) {
+      fprintf(fppara,"ROM: parameters of %s and %s differ \n",
+              ROMFILE,ROMQFILE);
+      free_dmatrix(xq,1,nsc,1,nfq);
+      free_dmatrix(x,1,nt,1,nf);
+      return;
+   }
+
+#ifdef ISTPDEC
+   for(a=1; a <= NE; a++) msub[a] = a;	/* full system */
+   ivfull = indexv;
+#endif
+   fac = (RADIUS - sdp[SPRAD])/RADIUS;	/* unshifted mesh */
+   for(k=1; k <= M; k++) r0[k] = r[k]*fac;
+#ifdef AUTOMESH
+   r0[0] = symlen*fac;
+#endif
+   for(j=1; j <= nf; j++) {
+      sd0[j] = sdp[ip[j]];
+      pb[j]  = spvalue(ip[j]) - sd0[j];	/* unshifted */
+      lo[j]  = hi[j] = x[1][j];		/* training box */
+      for(n=2; n <= nt; n++) {
+         if(x[n][j] < lo[j]) lo[j] = x[n][j];
+         if(x[n][j] > hi[j]) hi[j] = x[n][j];
+      }
+   }
+
+   rmyb = dmatrix(1,NE,1,M);
+   yr   = dmatrix(1,NE,1,M);
+   for(a=1; a <= NE; a++)
+      for(k=1; k <= M; k++) rmyb[a][k] = yr[a][k] = y[a][k];
+
+   fprintf(fppara,"--- reduced-order model (ROM) --- \n");
+   fprintf(fppara,"training scenarios (%s)  %d \n",ROMFILE,nt);
+   fprintf(fppara,"parameters               ");
+   for(j=1; j <= nf; j++) fprintf(fppara," %s",sparname(ip[j]));
+   fprintf(fppara," \n");
+   tc = clock();
+
+   /* --- snapshots y - yb of the training scenarios --- */
+
+   dt = (double ***)malloc((unsigned) nt*sizeof(double **))-1;
+   spwarm = 1;
+   for(n=1; n <= nt; n++) {
+      for(a=1; a <= NE; a++)
+         for(k=1; k <= M; k++) y[a][k] = rmyb[a][k];
+      spsetn(nf,ip,x[n],pb,r0,y);
+      if(solvde(ITMAX,CONV,SLOWC,scalv,indexv,NE,NB,M,y,c,s)) svabort(y);
+      dt[n] = dmatrix(1,NE,1,M);
+      for(a=1; a <= NE; a++)
+         for(k=1; k <= M; k++) dt[n][a][k] = y[a][k] - rmyb[a][k];
+   }
+
+   /* --- POD (method of snapshots), q: coefficients / scalv --- */
+
+   cc  = dmatrix(1,nt,1,nt);
+   ev  = dmatrix(1,nt,1,nt);
+   lam = dvector(1,nt);
+   for(n=1; n <= nt; n++)
+      for(m=n; m <= nt; m++) {
+         d = 0.0;
+         for(a=1; a <= NE; a++)
+            for(k=1; k <= M; k++)
+               d += dt[n][a][k]*dt[m][a][k]/SQ(scalv[a]);
+         cc[n][m] = cc[m][n] = d;
+      }
+   jacobi(cc,nt,lam,ev);
+   rmphi = (double ***)malloc((unsigned) M*sizeof(double **))-1;
+   for(k=1; k <= M; k++) rmphi[k] = dmatrix(1,NE,1,ROMMAX);
+   qtr = dmatrix(1,nt,1,ROMMAX);	/* coefficients of the snapshots */
+   for(rmnq=0; rmnq < ROMMAX && rmnq < nt; ) {
+      for(m=1, n=2; n <= nt; n++)	/* largest one left */
+         if(lam[n] > lam[m]) m = n;
+      d = sqrt(fabs(lam[m])/(double)(nt*NE*M));	/* rms amplitude */
+      if(!(d > ROMEPS)) break;
+      rmnq++;
+      for(a=1; a <= NE; a++)
+         for(k=1; k <= M; k++) {
+            rr = 0.0;
+            for(n=1; n <= nt; n++) rr += ev[n][m]*dt[n][a][k];
+            rmphi[k][a][rmnq] = rr/sqrt(lam[m]);
+         }
+      for(n=1; n <= nt; n++) qtr[n][rmnq] = ev[n][m]*sqrt(lam[m]);
+      lam[m] = -1.0;
+   }
+   nq1 = (rmnq > 0) ? rmnq : 1;
+
+   /* --- row weights, mode responses J phi at yb --- */
+
+   spsetn(nf,ip,pb,pb,r0,rmyb);
+   rmw = dmatrix(1,NCK,1,NE);
+   u   = dmatrix(1,NE*NCK,1,nq1);
+   for(k=1; k <= M+1; k++) {
+      i = (k == 1)   ? NE-NB+1 : 1;
+      j = (k == M+1) ? NE-NB   : NE;
+      difeq(k,1,M,NSJ,i,j,indexv,NE,s,rmyb);
+      for(p=1; p <= NE; p++) {
+         rmw[k][p] = 0.0;
+         for(l=1; l <= rmnq; l++) u[(k-1)*NE+p][l] = 0.0;
+      }
+      for(p=i; p <= j; p++) {
+         d = 0.0;
+         for(a=1; a <= NE; a++) {
+            if(k > 1 && k <= M) d += fabs(s[p][indexv[a]])*scalv[a];
+            d += fabs(s[p][NE+indexv[a]])*scalv[a];
+         }
+         rmw[k][p] = (d > 0.0) ? 1.0/d : 0.0;
+      }
+      romjac(k,i,j,indexv,s,u+(k-1)*NE);
+   }
+
+   /* --- DEIM rows -> sampled intervals, validation intervals --- */
+
+   prow = ivector(1,nq1);
+   indx = ivector(1,nq1);
+   aa   = dmatrix(1,nq1,1,nq1);
+   q    = dvector(1,nq1);
+   dq   = dvector(1,nq1);
+   for(l=1; l <= rmnq; l++) {
+      for(m=1; m < l; m++) {		/* interpolate mode l */
+         q[m] = u[prow[m]][l];
+         for(n=1; n < l; n++) aa[m][n] = u[prow[m]][n];
+      }
+      if(l > 1) {
+         ludcmp(aa,l-1,indx,&d);
+         lubksb(aa,l-1,indx,q);
+      }
+      d = -1.0;
+      for(p=1; p <= NE*NCK; p++) {	/* largest residual */
+         rr = u[p][l];
+         for(m=1; m < l; m++) rr -= u[p][m]*q[m];
+         if(fabs(rr) > d) {
+            d = fabs(rr);
+            prow[l] = p;
+         }
+      }
+   }
+   sel = ivector(1,NCK);
+   for(k=1; k <= NCK; k++) sel[k] = 0;
+   sel[1] = 1;				/* shell */
+   for(l=1; l <= rmnq; l++) sel[(prow[l]-1)/NE+1] = 1;
+   rmnb = 0;
+   for(k=1; k <= NCK; k++) rmnb += sel[k];
+   rmblk = ivector(1,rmnb+ROMNV);
+   for(n=0, k=1; k <= NCK; k++) if(sel[k]) rmblk[++n] = k;
+   jr = dmatrix(1,NE*rmnb,1,nq1);		/* J phi, sampled intervals */
+   rmnv = 0;
+   for(i=1; i <= ROMNV; i++) {		/* not sampled */
+      k = 2 + (i*(M-2))/(ROMNV+1);
+      while(k < M && sel[k]) k++;
+      if(sel[k]) continue;
+      sel[k] = 1;
+      rmblk[rmnb + ++rmnv] = k;
+   }
+
+   tm = (double)(clock() - tc)/CLOCKS_PER_SEC;
+   fprintf(fppara,"POD modes, sampled / valid. intervals %d %d %d \n",
+           rmnq,rmnb,rmnv);
+   fprintf(fppara,"training time [s]        %f \n",tm);
+
+   /* --- queries --- */
+
+   its = ivector(1,nsc);
+   est = dvector(1,nsc);
+   err = dvector(1,nsc);
+   ysh = dmatrix(1,nsc,1,N2);
+   tm  = 0.0;
+   for(n=1; n <= nsc; n++) {
+      tc = clock();
+      inbox = 1;
+      for(j=1; j <= nf; j++) {
+         d = ROMBOX*(hi[j] - lo[j]);
+         if(xq[n][j] < lo[j] - d || xq[n][j] > hi[j] + d) inbox = 0;
+      }
+      for(ntr=1, f0=-1.0, m=1; m <= nt; m++) {	/* nearest snapshot */
+         d = 0.0;
+         for(j=1; j <= nf; j++)
+            if(hi[j] > lo[j]) d += SQ((xq[n][j] - x[m][j])/(hi[j] - lo[j]));
+         if(f0 < 0.0 || d < f0) {
+            f0  = d;
+            ntr = m;
+         }
+      }
+      for(l=1; l <= rmnq; l++) q[l] = qtr[ntr][l];
+      spsetn(nf,ip,xq[n],pb,r0,yr);
+      it = (rmnq > 0) ? romsolve(q,indexv,yr,s,jr,aa,dq,indx) : 1;
+      for(l=1; l <= rmnq; l++) dq[l] = 0.0;
+      f0 = romres(rmnb+1,rmnb+rmnv,dq,indexv,yr,s,jr,NULL,NULL);
+      rr = romres(rmnb+1,rmnb+rmnv,q,indexv,yr,s,jr,NULL,NULL);
+      est[n] = (f0 > 0.0) ? sqrt(rr/f0) : (rr > 0.0 ? 1.0 : 0.0);
+      for(a=1; a <= N2; a++) {
+         ysh[n][a] = rmyb[a][1];
+         for(l=1; l <= rmnq; l++) ysh[n][a] += rmphi[1][a][l]*q[l];
+      }
+      tm += (double)(clock() - tc)/CLOCKS_PER_SEC;
+
+      its[n] = 0;
+      acc = 0;
+      if(!inbox)                   nbox++;
+      else if(it < 0)              nnc++;
+      else if(!(est[n] <= ROMTOL)) nest++;
+      else                         acc = 1;
+      nok += acc;
+      if(!acc) {			/* fallback: solvde() */
+         tc = clock();
+         for(a=1; a <= NE; a++)
+            for(k=1; k <= M; k++) y[a][k] = rmyb[a][k] + dt[ntr][a][k];
+         its[n] = itsol;
+         if(solvde(ITMAX,CONV,SLOWC,scalv,indexv,NE,NB,M,y,c,s) != SVOK) {
+            fprintf(fppara,"query %d: %s (it %d, k %d) \n",n,svmsg,svit,svk);
+            its[n] = -svit;		/* not converged */
+         }
+         for(a=1; a <= N2; a++) ysh[n][a] = y[a][1];
+         tmfb += (double)(clock() - tc)/CLOCKS_PER_SEC;
+         nfb++;
+      }
+#ifdef ROMVERIFY
+      tc = clock();
+      for(a=1; a <= NE; a++)
+         for(k=1; k <= M; k++) y[a][k] = rmyb[a][k];
+      spsetn(nf,ip,xq[n],pb,r0,y);
+      if(solvde(ITMAX,CONV,SLOWC,scalv,indexv,NE,NB,M,y,c,s)) svabort(y);
+      tmv += (double)(clock() - tc)/CLOCKS_PER_SEC;
+      err[n] = 0.0;
+      for(a=1; a <= N2; a++) {
+         rr = rmyb[a][1] - y[a][1];
+         for(l=1; l <= rmnq; l++) rr += rmphi[1][a][l]*q[l];
+         if(fabs(rr)/scalv[a] > err[n]) err[n] = fabs(rr)/scalv[a];
+      }
+      if(acc && err[n] > ermax) ermax = err[n];
+#endif
+   }
+   spwarm = 0;
+
+   /* --- back to the input parameters --- */
+
+   for(a=1; a <= NE; a++)
+      for(k=1; k <= M; k++) y[a][k] = rmyb[a][k];
+   for(j=1; j < nf; j++) sdp[ip[j]] = sd0[j];
+   spset(ip[nf],sd0[nf],r0,y);
+
+   fp = ctxopen("rom.sv4","w");
+   fprintf(fp,"# scen it est");
+#ifdef ROMVERIFY
+   fprintf(fp," err");
+#endif
+   for(j=1; j <= nf; j++) fprintf(fp," %s",sparname(ip[j]));
+   for(a=1; a <= N2; a++) fprintf(fp," %s",spname(a));
+   fprintf(fp,"\n");
+   for(n=1; n <= nsc; n++) {
+      fprintf(fp,"%d %d %e",n,its[n],est[n]);
+#ifdef ROMVERIFY
+      fprintf(fp," %e",err[n]);
+#endif
+      for(j=1; j <= nf; j++) fprintf(fp," %e",xq[n][j]);
+      for(a=1; a <= N2; a++) fprintf(fp," %e",ysh[n][a]);
+      fprintf(fp,"\n");
+   }
+   fclose(fp);
+
+   fprintf(fppara,"queries (%s)            %d \n",ROMQFILE,nsc);
+   fprintf(fppara,"reduced solutions        %d \n",nok);
+   fprintf(fppara,"fallback (box, est, Newton) %d %d %d \n",nbox,nest,nnc);
+   fprintf(fppara,"time [s] per query (reduced) %e \n",tm/(double)nsc);
+   if(nfb > 0)
+      fprintf(fppara,"time [s] per fallback    %e \n",tmfb/(double)nfb);
+#ifdef ROMVERIFY
+   fprintf(fppara,"time [s] per full solve  %e \n",tmv/(double)nsc);
+   fprintf(fppara,"max. error / scalv of the reduced solutions %e \n",ermax);
+#endif
+
+   free_dmatrix(ysh,1,nsc,1,N2);
+   free_dvector(err,1,nsc);
+   free_dvector(est,1,nsc);
+   free_ivector(its,1,nsc);
+   free_ivector(rmblk,1,rmnb+ROMNV);
+   free_ivector(sel,1,NCK);
+   free_dvector(dq,1,nq1);
+   free_dvector(q,1,nq1);
+   free_dmatrix(jr,1,NE*rmnb,1,nq1);
+   free_dmatrix(aa,1,nq1,1,nq1);
+   free_ivector(indx,1,nq1);
+   free_ivector(prow,1,nq1);
+   free_dmatrix(u,1,NE*NCK,1,nq1);
+   free_dmatrix(rmw,1,NCK,1,NE);
+   for(k=M; k >= 1; k--) free_dmatrix(rmphi[k],1,NE,1,ROMMAX);
+   free((char*) (rmphi+1));
+   free_dmatrix(qtr,1,nt,1,ROMMAX);
+   free_dvector(lam,1,nt);
+   free_dmatrix(ev,1,nt,1,nt);
+   free_dmatrix(cc,1,nt,1,nt);
+   for(n=nt; n >= 1; n--) free_dmatrix(dt[n],1,NE,1,M);
+   free((char*) (dt+1));
+   free_dmatrix(yr,1,NE,1,M);
+   free_dmatrix(rmyb,1,NE,1,M);
+   free_dmatrix(xq,1,nsc,1,nf);
+   free_dmatrix(x,1,nt,1,nf);
+}
+#endif
+
+#ifdef SURR
+/* ----------------------------------------------------------------
+
+   surrogate table of shell values: piecewise linear interpolant on
+   an adaptive sparse grid over the parameter box of SGFILE (names,
+   then a line of lower and one of upper values, as BTFILE). Per
+   parameter, u = (x - lo)/(hi - lo) in [0,1], the hierarchical basis
+
+     level 1:  c = 1/2,               phi = 1
+     level l:  c = 0, 1 (l = 2),  (2i-1)/2^(l-1) (l > 2),
+               phi = max(0, 1 - |u - c| 2^(l-1))
+
+   and in several parameters the products. Grid positions are
+   integers 0..SGR, c = pos/SGR. Every grid point is solved (solvde()
+   from the input solution, as BTSERIAL); its surplus, value minus
+   the interpolant of the points so far, decides the refinement: the
+   children (next level) in every parameter if an output exceeds its
+   tolerance (SGTOL x bulk, SGDTOL for pH and delta values), up to
+   level SGLMAX and SGNMAX points. The parents of a new point are
+   added first, so the points below a point are always in the grid.
+   Error estimate at u: max |surplus| of the unrefined points whose
+   phi covers u. SGNVAL random points are solved to check both.
+   -> SGTAB (binary, read by surrtab.c and boilerplate), par.sv4,
+   surr.sv4 (pt leaf parameters outputs).
+
+   ---------------------------------------------------------------- */
+
+int surrout(y,q,tol,nm)		/* outputs of the table, tol, names */
+double **y,q[],tol[];
+char *nm[];
+{
+   int a,n=0;
+
+   nm[++n] = "pH";
+   q[n]    = -log10(y[EQHP][1]*1.e-6);
+   tol[n]  = SGDTOL;
+   for(a=1; a <= N2; a++) {
+      nm[++n] = spname(a);
+      q[n]    = y[a][1];
+      tol[n]  = SGTOL*fabs(y[a][M]);	/* bulk: typical value */
+   }
+#ifdef C13ISTP
+   nm[++n] = "d13c_co3";
+#ifdef CISTP
+   q[n]    = (alphac*y[EQCCO3][1]/y[EQCO3][1]/RSTAND - 1.)*1000.;
+#else
+   q[n]    = (alphac*y[EQCCO3][1]/(y[EQCO3][1]-y[EQCCO3][1])
+             /RSTAND - 1.)*1000.;
+#endif
+   tol[n]  = SGDTOL;
+#endif
+#ifdef BORISTP
+   nm[++n] = "d11b_boh4";
+   q[n]    = ((y[EQBBOH4][1]/y[EQBOH4][1])/BSTAND - 1.)*1000.;
+   tol[n]  = SGDTOL;
+#endif
+   return(n);
+}
+
+int sglev(p)		/* level of grid position p */
+int p;
+{
+   int l=SGLMAX;
+
+   if(p == SGR/2) return(1);
+   if(p == 0 || p == SGR) return(2);
+   for( ; p % 2 == 0; p /= 2) l--;
+   return(l);
+}
+
+double sgphi(p,u)	/* basis of grid position p at u */
+int p;
+double u;
+{
+   int l=sglev(p);
+   double d;
+
+   if(l == 1) return(1.0);
+   d = 1.0 - fabs(u*(double)SGR - (double)p)/(double)(SGR >> (l-1));
+   return(d > 0.0 ? d : 0.0);
+}
+
+int sgchild(p,ch)	/* positions of the children, returns their number */
+int p,ch[];
+{
+   int l=sglev(p);
+
+   if(l == SGLMAX) return(0);
+   if(l == 1) {
+      ch[0] = 0;
+      ch[1] = SGR;
+      return(2);
+   }
+   if(l == 2) {
+      ch[0] = (p == 0) ? SGR/4 : 3*SGR/4;
+      return(1);
+   }
+   ch[0] = p - (SGR >> l);
+   ch[1] = p + (SGR >> l);
+   return(2);
+}
+
+int sgadd(nf,p,np,pos)		/* point p, its parents first */
+int nf,p[],*np,**pos;		/* returns its index, 0: SGNMAX */
+{
+   int i,j,l,w,pp[NSPAR+1];
+
+   for(i=1; i <= *np; i++) {
+      for(j=1; j <= nf && pos[i][j] == p[j]; j++) ;
+      if(j > nf) return(i);
+   }
+   for(j=1; j <= nf; j++) {
+      if((l = sglev(p[j])) == 1) continue;
+      for(i=1; i <= nf; i++) pp[i] = p[i];
+      w = SGR >> (l-1);
+      if(l == 2)                       pp[j] = SGR/2;
+      else if(sglev(p[j]-w) == l-1)    pp[j] = p[j] - w;
+      else                             pp[j] = p[j] + w;
+      if(sgadd(nf,pp,np,pos) == 0) return(0);
+   }
+   if(*np == SGNMAX) return(0);
+   (*np)++;
+   for(j=1; j <= nf; j++) pos[*np][j] = p[j];
+   return(*np);
+}
+
+void sgeval(np,nf,no,pos,al,leaf,u,q,e)	/* interpolant q, estimate e */
+int np,nf,no,**pos,leaf[];		/* at u; e: NULL = none	 */
+double **al,u[],q[],e[];
+{
+   int i,j,o;
+   double f;
+
+   for(o=1; o <= no; o++) q[o] = 0.0;
+   if(e != NULL) for(o=1; o <= no; o++) e[o] = 0.0;
+   for(i=1; i <= np; i++) {
+      f = 1.0;
+      for(j=1; j <= nf && f > 0.0; j++) f *= sgphi(pos[i][j],u[j]);
+      if(f == 0.0) continue;
+      for(o=1; o <= no; o++) q[o] += f*al[i][o];
+      if(e != NULL && leaf[i])
+         for(o=1; o <= no; o++)
+            if(fabs(al[i][o]) > e[o]) e[o] = fabs(al[i][o]);
+   }
+}
+
+void surr(indexv,scalv,y,c,s)
+int indexv[];
+double scalv[],**y,***c,**s;
+{
+   int a,i,j,k,l,n,o,nf,no,np=0,ns=0,nb,nit=0,nfull=0,ncov=0,
+       ip[NSPAR+1],p[NSPAR+1],ch[2],*ref,*leaf,**pos;
+   double pb[NSPAR+1],sd0[NSPAR+1],r0[MMAX+1],u[NSPAR+1],xs[NSPAR+1],
+          q[SGNOUT+1],f[SGNOUT+1],e[SGNOUT+1],tol[SGNOUT+1],
+          emax[SGNOUT+1],vmax[SGNOUT+1],fac,tm,tq,**x,**al,**fv,**yb;
+   char *nm[SGNOUT+1],name[16];
+   clock_t tc;
+   FILE *fp;
+   int solvde();
+
+   if((n = spread("SURR",SGFILE,ip,&nf,&x)) == 0) return;
+   if(n != 2) {
+      fprintf(fppara,"SURR: %s needs 2 lines (lower, upper values) \n",
+              SGFILE);
+      free_dmatrix(x,1,n,1,nf);
+      return;
+   }
+   pos  = imatrix(1,SGNMAX,1,nf);
+   al   = dmatrix(1,SGNMAX,1,SGNOUT);	/* surpluses		*/
+   fv   = dmatrix(1,SGNMAX,1,SGNOUT);	/* values		*/
+   ref  = ivector(1,SGNMAX);		/* 1: refine, 2: refined */
+   leaf = ivector(1,SGNMAX);
+   yb   = dmatrix(1,NE,1,M);
+
+#ifdef ISTPDEC
+   for(a=1; a <= NE; a++) msub[a] = a;	/* full system */
+   ivfull = indexv;
+#endif
+   fac = (RADIUS - sdp[SPRAD])/RADIUS;	/* unshifted mesh */
+   for(k=1; k <= M; k++) r0[k] = r[k]*fac;
+#ifdef AUTOMESH
+   r0[0] = symlen*fac;
+#endif
+   for(j=1; j <= nf; j++) {
+      sd0[j] = sdp[ip[j]];
+      pb[j]  = spvalue(ip[j]) - sd0[j];	/* unshifted */
+   }
+   for(a=1; a <= NE; a++)
+      for(k=1; k <= M; k++) yb[a][k] = y[a][k];
+   no = surrout(y,q,tol,nm);		/* tolerances at the input */
+
+   fprintf(fppara,"--- surrogate table (SURR) --- \n");
+   fprintf(fppara,"parameter  lower        upper \n");
+   for(j=1; j <= nf; j++)
+      fprintf(fppara,"%-9s  %e %e \n",sparname(ip[j]),x[1][j],x[2][j]);
+
+   /* --- grid: solve the new points, then refine --- */
+
+   tc = clock();
+   spwarm = 1;
+   for(j=1; j <= nf; j++) p[j] = SGR/2;
+   sgadd(nf,p,&np,pos);
+   while(ns < np) {
+      for(i=ns+1; i <= np; i++) {
+         for(j=1; j <= nf; j++) {
+            u[j]  = (double)pos[i][j]/(double)SGR;
+            xs[j] = x[1][j] + u[j]*(x[2][j] - x[1][j]);
+         }
+         for(a=1; a <= NE; a++)
+            for(k=1; k <= M; k++) y[a][k] = yb[a][k];
+         spsetn(nf,ip,xs,pb,r0,y);
+         if(solvde(ITMAX,CONV,SLOWC,scalv,indexv,NE,NB,M,y,c,s)) svabort(y);
+         nit += itsol;
+         surrout(y,fv[i],e,nm);
+         sgeval(i-1,nf,no,pos,al,leaf,u,q,(double *)NULL);
+         ref[i]  = (i == 1);		/* the root: always */
+         leaf[i] = 1;
+         for(o=1; o <= no; o++) {
+            al[i][o] = fv[i][o] - q[o];
+            if(fabs(al[i][o]) > tol[o]) ref[i] = 1;
+         }
+      }
+      nb = ns = np;
+      for(i=1; i <= nb; i++) {
+         if(ref[i] != 1) continue;
+         ref[i] = 2;
+         for(j=1; j <= nf; j++) {
+            for(l=1; l <= nf; l++) p[l] = pos[i][l];
+            n = sgchild(pos[i][j],ch);
+            for(k=0; k < n; k++) {
+               p[j] = ch[k];
+               if(sgadd(nf,p,&np,pos) > 0) leaf[i] = 0;
+               else nfull = 1;
+            }
+         }
+      }
+   }
+   spwarm = 0;
+   tm = (double)(clock() - tc)/CLOCKS_PER_SEC;
+
+   /* --- validation: random points --- */
+
+   for(o=1; o <= no; o++) emax[o] = vmax[o] = 0.0;
+   for(i=1; i <= np; i++)
+      for(o=1; o <= no; o++)
+         if(leaf[i] && fabs(al[i][o]) > emax[o]) emax[o] = fabs(al[i][o]);
+   srand(1);
+   spwarm = 1;
+   for(n=1; n <= SGNVAL; n++) {
+      for(j=1; j <= nf; j++) {
+         u[j]  = (double)rand()/((double)RAND_MAX + 1.0);
+         xs[j] = x[1][j] + u[j]*(x[2][j] - x[1][j]);
+      }
+      for(a=1; a <= NE; a++)
+         for(k=1; k <= M; k++) y[a][k] = yb[a][k];
+      spsetn(nf,ip,xs,pb,r0,y);
+      if(solvde(ITMAX,CONV,SLOWC,scalv,indexv,NE,NB,M,y,c,s)) svabort(y);
+      surrout(y,f,e,nm);
+      sgeval(np,nf,no,pos,al,leaf,u,q,e);
+      for(o=1; o <= no; o++) {
+         if(fabs(f[o] - q[o])/tol[o] > vmax[o])
+            vmax[o] = fabs(f[o] - q[o])/tol[o];
+         if(fabs(f[o] - q[o]) <= e[o]) ncov++;
+      }
+   }
+   spwarm = 0;
+
+   tc = clock();			/* query time */
+   for(n=1; n <= 10000; n++) {
+      for(j=1; j <= nf; j++) u[j] = (double)((n*(2*j+1)) % 997)/997.;
+      sgeval(np,nf,no,pos,al,leaf,u,q,e);
+   }
+   tq = (double)(clock() - tc)/CLOCKS_PER_SEC/10000.;
+
+   /* --- back to the input parameters --- */
+
+   for(a=1; a <= NE; a++)
+      for(k=1; k <= M; k++) y[a][k] = yb[a][k];
+   for(j=1; j < nf; j++) sdp[ip[j]] = sd0[j];
+   spset(ip[nf],sd0[nf],r0,y);
+
+   /* --- table: int nf no np SGLMAX, char[16] names, double lo hi,
+          char[16] output names, double tol, then per point
+          int pos[nf] leaf, double surplus[no] (native byte order) --- */
+
+   fp = ctxopen(SGTAB,"wb");
+   l = SGLMAX;
+   fwrite(&nf,sizeof(int),1,fp);
+   fwrite(&no,sizeof(int),1,fp);
+   fwrite(&np,sizeof(int),1,fp);
+   fwrite(&l,sizeof(int),1,fp);
+   for(j=1; j <= nf; j++) {
+      memset(name,0,sizeof(name));
+      strncpy(name,sparname(ip[j]),sizeof(name)-1);
+      fwrite(name,1,sizeof(name),fp);
+   }
+   fwrite(&x[1][1],sizeof(double),nf,fp);
+   fwrite(&x[2][1],sizeof(double),nf,fp);
+   for(o=1; o <= no; o++) {
+      memset(name,0,sizeof(name));
+      strncpy(name,nm[o],sizeof(name)-1);
+      fwrite(name,1,sizeof(name),fp);
+   }
+   fwrite(&tol[1],sizeof(double),no,fp);
+   for(i=1; i <= np; i++) {
+      fwrite(&pos[i][1],sizeof(int),nf,fp);
+      fwrite(&leaf[i],sizeof(int),1,fp);
+      fwrite(&al[i][1],sizeof(double),no,fp);
+   }
+   fclose(fp);
+
+   fp = ctxopen("surr.sv4","w");
+   fprintf(fp,"# pt leaf");
+   for(j=1; j <= nf; j++) fprintf(fp," %s",sparname(ip[j]));
+   for(o=1; o <= no; o++) fprintf(fp," %s",nm[o]);
+   fprintf(fp,"\n");
+   for(i=1; i <= np; i++) {
+      fprintf(fp,"%d %d",i,leaf[i]);
+      for(j=1; j <= nf; j++)
+         fprintf(fp," %e",x[1][j] + (double)pos[i][j]/(double)SGR
+                          *(x[2][j] - x[1][j]));
+      for(o=1; o <= no; o++) fprintf(fp," %e",fv[i][o]);
+      fprintf(fp,"\n");
+   }
+   fclose(fp);
+
+   fprintf(fppara,"grid points (solves)     %d \n",np);
+   if(nfull)
+      fprintf(fppara,"SURR: SGNMAX points reached, not refined further \n");
+   fprintf(fppara,"Newton iterations        %d \n",nit);
+   fprintf(fppara,"time [s], per point      %f %e \n",tm,tm/(double)np);
+   fprintf(fppara,"time [s] per query       %e \n",tq);
+   fprintf(fppara,"output     tolerance    estimate     val. error / tol. \n");
+   for(o=1; o <= no; o++)
+      fprintf(fppara,"%-9s  %e %e %e \n",nm[o],tol[o],emax[o],vmax[o]);
+   fprintf(fppara,"validation (%d points): error <= estimate %d of %d \n",
+           SGNVAL,ncov,SGNVAL*no);
+
+   free_dmatrix(yb,1,NE,1,M);
+   free_ivector(leaf,1,SGNMAX);
+   free_ivector(ref,1,SGNMAX);
+   free_dmatrix(fv,1,SGNMAX,1,SGNOUT);
+   free_dmatrix(al,1,SGNMAX,1,SGNOUT);
+   free_imatrix(pos,1,SGNMAX,1,nf);
+   free_dmatrix(x,1,2,1,nf);
+}
+#endif
+
+#if defined (SOLLIB) || defined (LIBSOLVDE)
+void ymap(y,mo,ro,yo)	/* initial guess from solution yo on mesh ro */
+int mo;			/* (mo points): interpolated in		*/
+double **y,ro[],**yo;	/* (r - r[1])/(r[M] - r[1]), each species	*/
+{			/* scaled to its current bulk value		*/
+   int a,j,k;
+   double s,sc,fl,w;
+
+   fl = (ro[mo] - ro[1])/(r[M] - r[1]);	/* d/dr: mesh length */
+   for(a=1; a <= N2; a++) {
+      sc = (yo[a][mo] != 0.0) ? y[a][M]/yo[a][mo] : 1.0;	/* bulk */
+      for(j=1, k=1; k <= M; k++) {
+         s = ro[1] + (r[k] - r[1])*fl;	/* old mesh */
+         while(j < mo-1 && ro[j+1] < s) j++;
+         w = (s - ro[j])/(ro[j+1] - ro[j]);
+         if(w < 0.0) w = 0.0;
+         if(w > 1.0) w = 1.0;
+         y[a][k]    = sc*((1.0-w)*yo[a][j] + w*yo[a][j+1]);
+         y[N2+a][k] = sc*fl*((1.0-w)*yo[N2+a][j] + w*yo[N2+a][j+1]);
+      }
+   }
+}
+#endif
+
+#if defined (SOLLIB) || defined (DAEMON)	/* key of a solution	*/
+void sllkey(key)	/* key: parameters / typical change */
+double key[];
+{
+   int i;
+
+   for(i=0; i < SLNKEY; i++) key[i] = 0.0;
+   key[0]  = log(RADIUS)/0.05;
+   key[1]  = CO3UPT/SLUPT;
+   key[2]  = CO2UPT/SLUPT;
+   key[3]  = HCO3UPT/SLUPT;
+#ifdef SYMBIONTS
+   key[4]  = SYMCO2UPT/SLUPT;
+   key[5]  = SYMHCO3UPT/SLUPT;
+   key[6]  = (SYMRAD - RADIUS)/50.;
+#endif
+#ifdef MIMECO2SYM
+   key[7]  = SYMTCUPT/SLUPT;
+   key[8]  = (VMAX > 0.0) ? log(VMAX)/0.1 : 0.0;
+#endif
+   key[9]  = PHBULK/0.02;
+   key[10] = DICBULK/20.;
+#ifdef BORON
+   key[11] = BORTBULK/20.;
+#endif
+   key[12] = TEMP/1.;
+   key[13] = SALINITY/0.5;
+}
+
+double sldist(a,b)
+double a[],b[];
+{
+   int i;
+   double d=0.0;
+
+   for(i=0; i < SLNKEY; i++) d += SQ(a[i] - b[i]);
+   return(sqrt(d));
+}
+#endif
+
+#ifdef SOLLIB
+/* ----------------------------------------------------------------
+
+   library of converged solutions (SLDIR, kept between runs): one
+   directory per class (SLTAG, NE, M, mesh), in it the solutions of
+   earlier runs (y: species and derivatives, and the mesh r), keyed
+   by the normalised parameters of sllkey(). Before the solve, the
+   nearest entry within key distance SLMAXD replaces the initial
+   guess (no uptake ramp): interpolated onto the current mesh in
+   (r - r[1])/(r[M] - r[1]), each species scaled to its current bulk
+   value. After the solve, the solution is added (not if an entry
+   has the same key). Index: a k-d tree stored in tree order (the
+   middle record of a range is its node, with the split dimension),
+   so a search reads only the records it visits, plus an unsorted
+   tail of new entries, merged into the tree at SLTAIL entries.
+   Not for several runs writing to one library at the same time.
+
+   ---------------------------------------------------------------- */
+
+typedef struct {
+   double key[SLNKEY];
+   int id,dim;		/* solution file, split dimension (tree) */
+} SLREC;
+
+CTX int sldim;		/* slcmp(): dimension			*/
+
+void slfile(buf,id,name)	/* path of solution id, or of name (id 0),
+				   buf[SLPATH] */
+char buf[],*name;
+int id;
+{
+   int n;
+#ifdef AUTOMESH
+   char *mesh="am";
+#else
+   char *mesh="eq";
+#endif
+
+   if(id > 0)
+      n = snprintf(buf,SLPATH,"%s/%s_ne%d_m%d_%s/%d/%d.bin",SLDIR,SLTAG,
+                   NE,M,mesh,id/1000,id);
+   else if(name != NULL)
+      n = snprintf(buf,SLPATH,"%s/%s_ne%d_m%d_%s/%s",SLDIR,SLTAG,NE,M,
+                   mesh,name);
+   else
+      n = snprintf(buf,SLPATH,"%s/%s_ne%d_m%d_%s",SLDIR,SLTAG,NE,M,mesh);
+   if(n < 0 || n >= SLPATH)
+      svfail(SVPARAM,"SOLLIB: path too long, shorten SLDIR");
+}
+
+int slcmp(a,b)		/* qsort(): key[sldim] */
+const void *a,*b;
+{
+   double d=((SLREC *)a)->key[sldim] - ((SLREC *)b)->key[sldim];
+
+   return((d > 0.0) - (d < 0.0));
+}
+
+void slbuild(rec,lo,hi)		/* tree order of records lo..hi-1 */
+SLREC rec[];
+int lo,hi;
+{
+   int i,j,mid,dim=0;
+   double a,b,sp,spmax=-1.0;
+
+   if(hi - lo < 2) {
+      if(hi > lo) rec[lo].dim = 0;
+      return;
+   }
+   for(j=0; j < SLNKEY; j++) {		/* largest spread */
+      a = b = rec[lo].key[j];
+      for(i=lo+1; i < hi; i++) {
+         if(rec[i].key[j] < a) a = rec[i].key[j];
+         if(rec[i].key[j] > b) b = rec[i].key[j];
+      }
+      if((sp = b - a) > spmax) {
+         spmax = sp;
+         dim   = j;
+      }
+   }
+   sldim = dim;
+   qsort(rec+lo,(size_t)(hi-lo),sizeof(SLREC),slcmp);
+   mid = (lo + hi)/2;
+   rec[mid].dim = dim;
+   slbuild(rec,lo,mid);
+   slbuild(rec,mid+1,hi);
+}
+
+void slnear(fp,lo,hi,key,best,db)	/* tree records lo..hi-1 */
+FILE *fp;
+int lo,hi;
+double key[],*db;
+SLREC *best;
+{
+   int mid;
+   double d;
+   SLREC rec;
+
+   if(lo >= hi) return;
+   mid = (lo + hi)/2;
+   fseek(fp,(long)sizeof(int) + (long)mid*(long)sizeof(SLREC),SEEK_SET);
+   if(fread(&rec,sizeof(SLREC),1,fp) != 1) return;
+   if((d = sldist(rec.key,key)) < *db) {
+      *db   = d;
+      *best = rec;
+   }
+   d = key[rec.dim] - rec.key[rec.dim];
+   if(d < 0.0) {
+      slnear(fp,lo,mid,key,best,db);
+      if(-d < *db) slnear(fp,mid+1,hi,key,best,db);
+   }
+   else {
+      slnear(fp,mid+1,hi,key,best,db);
+      if(d < *db) slnear(fp,lo,mid,key,best,db);
+   }
+}
+
+int slfind(key,best,db,ntot)	/* nearest entry within *db, 0: none */
+double key[],*db;		/* ntot: number of entries	      */
+SLREC *best;
+int *ntot;
+{
+   int n=0,nt=0;
+   double d;
+   char fname[SLPATH];
+   SLREC rec;
+   FILE *fp;
+
+   best->id = 0;
+   slfile(fname,0,"tree.bin");
+   if((fp = fopen(fname,"rb")) != NULL) {
+      if(fread(&nt,sizeof(int),1,fp) == 1) slnear(fp,0,nt,key,best,db);
+      fclose(fp);
+   }
+   slfile(fname,0,"tail.bin");
+   if((fp = fopen(fname,"rb")) != NULL) {
+      while(fread(&rec,sizeof(SLREC),1,fp) == 1) {
+         if((d = sldist(rec.key,key)) < *db) {
+            *db   = d;
+            *best = rec;
+         }
+         n++;
+      }
+      fclose(fp);
+   }
+   *ntot = nt + n;
+   return(best->id);
+}
+
+void sllook(y)		/* warm start from the library */
+double **y;
+{
+   int a,n,ne,m,ok;
+   double key[SLNKEY],db=SLMAXD,*ro,**yo;
+   char fname[SLPATH];
+   SLREC best;
+   FILE *fp;
+
+   sllkey(key);
+   slfile(fname,0,NULL);
+   fprintf(fppara,"--- solution library (SOLLIB) --- \n");
+   fprintf(fppara,"class                    %s \n",fname);
+   if(slfind(key,&best,&db,&n) == 0) {
+      fprintf(fppara,"entries                  %d \n",n);
+      fprintf(fppara,"none within key distance %g: initial guess \n",SLMAXD);
+      return;
+   }
+   slfile(fname,best.id,NULL);
+   if((fp = fopen(fname,"rb")) == NULL) {
+      fprintf(fppara,"SOLLIB: no file %s \n",fname);
+      return;
+   }
+   ro = dvector(1,M);
+   yo = dmatrix(1,NE,1,M);
+   ok = fread(&ne,sizeof(int),1,fp) == 1 && fread(&m,sizeof(int),1,fp) == 1
+        && ne == NE && m == M && fread(&ro[1],sizeof(double),M,fp) == M;
+   for(a=1; ok && a <= NE; a++)
+      ok = fread(&yo[a][1],sizeof(double),M,fp) == M;
+   fclose(fp);
+
+   if(ok) {
+      ymap(y,M,ro,yo);
+      slwarm = 1;
+      fprintf(fppara,"entries                  %d \n",n);
+      fprintf(fppara,"warm start: entry, key distance %d %e \n",best.id,db);
+   }
+   else fprintf(fppara,"SOLLIB: bad file %s \n",fname);
+
+   free_dmatrix(yo,1,NE,1,M);
+   free_dvector(ro,1,M);
+}
+
+void slstore(y)		/* add the solution to the library */
+double **y;
+{
+   int a,n,nt=0,nl,id;
+   double key[SLNKEY],db=SLDUP;
+   char fname[SLPATH],ftmp[SLPATH];
+   SLREC best,rec,*all;
+   FILE *fp;
+
+   sllkey(key);
+   fprintf(fppara,"Newton iterations        %d \n",itsol);
+   if(slfind(key,&best,&db,&n) > 0) {
+      fprintf(fppara,"same key as entry        %d, not stored \n",best.id);
+      return;
+   }
+   id = n + 1;
+   mkdir(SLDIR,0777);
+   slfile(fname,0,NULL);
+   mkdir(fname,0777);
+   slfile(ftmp,id,NULL);
+   *strrchr(ftmp,'/') = '\0';	/* its directory, id/1000	*/
+   mkdir(ftmp,0777);
+
+   slfile(fname,id,NULL);
+   if((fp = fopen(fname,"wb")) == NULL) {
+      fprintf(fppara,"SOLLIB: cannot write %s \n",fname);
+      return;
+   }
+   a = NE;
+   fwrite(&a,sizeof(int),1,fp);
+   a = M;
+   fwrite(&a,sizeof(int),1,fp);
+   fwrite(&r[1],sizeof(double),M,fp);
+   for(a=1; a <= NE; a++) fwrite(&y[a][1],sizeof(double),M,fp);
+   fclose(fp);
+
+   for(a=0; a < SLNKEY; a++) rec.key[a] = key[a];
+   rec.id  = id;
+   rec.dim = 0;
+   slfile(fname,0,"tail.bin");
+   fp = fopen(fname,"ab");
+   fwrite(&rec,sizeof(SLREC),1,fp);
+   nl = (int)(ftell(fp)/(long)sizeof(SLREC));
+   fclose(fp);
+   fprintf(fppara,"stored as entry          %d \n",id);
+   if(nl < SLTAIL) return;
+
+   /* --- tail full: new tree of all entries --- */
+
+   all = (SLREC *)malloc((size_t)n*sizeof(SLREC) + sizeof(SLREC));
+   slfile(fname,0,"tree.bin");
+   if((fp = fopen(fname,"rb")) != NULL) {
+      if(fread(&nt,sizeof(int),1,fp) != 1
+         || fread(all,sizeof(SLREC),(size_t)nt,fp) != (size_t)nt) nt = 0;
+      fclose(fp);
+   }
+   slfile(ftmp,0,"tail.bin");
+   fp = fopen(ftmp,"rb");
+   nl = (int)fread(all+nt,sizeof(SLREC),(size_t)(n+1-nt),fp);
+   fclose(fp);
+   n = nt + nl;
+   slbuild(all,0,n);
+   slfile(ftmp,0,"tree.tmp");
+   fp = fopen(ftmp,"wb");
+   fwrite(&n,sizeof(int),1,fp);
+   fwrite(all,sizeof(SLREC),(size_t)n,fp);
+   fclose(fp);
+   rename(ftmp,fname);
+   slfile(fname,0,"tail.bin");
+   remove(fname);
+   free(all);
+   fprintf(fppara,"index rebuilt, entries   %d \n",n);
+}
+#endif
+
+#ifdef MTHREAD
+/* ----------------------------------------------------------------
+
+   scenarios in threads of one process. All mutable state of a solve
+   (the globals, mp, static locals) is thread-local (CTX), i.e. each
+   thread is one solver context: N threads solve N problems at the
+   same time without locks. mthread() reads MTFILE, one scenario per
+   line as NAME=value arguments (added to those of the run, see
+   mpread()), and runs each scenario as main() in a new thread (new
+   state), MTNTHR at a time. Output files of scenario i (from 1) in
+   MTDIR/i (ctxopen()), status (SVOK: 0, else the reason, iteration
+   and mesh point, see solvde()) and times in mt.sv4. A failed
+   scenario ends its thread only, the others go on (nrerror():
+   nrfail()). Afterwards main() solves the parameters of the run as
+   usual.
+
+   ---------------------------------------------------------------- */
+
+typedef struct {
+   int argc,id,rc,it,k;	/* status: svrc, svit, svk of the scenario	*/
+   char **argv;
+   double t;		/* [s] wall time				*/
+} MTJOB;
+
+MTJOB *mtjob;		/* shared by the threads, not CTX:	*/
+int mtn=0,mtnext=0;	/* scenarios, next one (atomic)		*/
+double mtwall;		/* [s] wall time of all scenarios	*/
+
+int main();
+
+double mtclock()
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC,&ts);
+   return((double)ts.tv_sec + 1.e-9*(double)ts.tv_nsec);
+}
+
+void *mtsolve(arg)		/* thread: one scenario */
+void *arg;
+{
+   MTJOB *jb=(MTJOB *)arg;
+   double t0=mtclock();
+
+   snprintf(ctxdir,sizeof(ctxdir),"%s/%d",MTDIR,jb->id);
+   mkdir(ctxdir,0777);
+   if(setjmp(ctxjmp) == 0) {
+      ctxjmpon = 1;
+      main(jb->argc,jb->argv);
+   }
+   ctxjmpon = 0;
+   jb->rc = svrc;
+   jb->it = svit;
+   jb->k  = svk;
+   jb->t  = mtclock() - t0;
+   return(NULL);
+}
+
+void *mtwork(arg)		/* thread: scenarios until none is left */
+void *arg;
+{
+   int i;
+   pthread_t th;
+   pthread_attr_t at;
+
+   pthread_attr_init(&at);
+   pthread_attr_setstacksize(&at,MTSTACK);
+   while((i = __sync_fetch_and_add(&mtnext,1)) < mtn) {
+      if(pthread_create(&th,&at,mtsolve,&mtjob[i]) != 0) {
+         mtjob[i].rc = -1;
+         continue;
+      }
+      pthread_join(th,NULL);
+   }
+   pthread_attr_destroy(&at);
+   return(NULL);
+}
+
+void mthread(argc,argv)		/* scenarios of MTFILE in threads */
+int argc;
+char *argv[];
+{
+   int i,nt,na,nmax=0;
+   double t0;
+   char line[4096],*tok,*sv,**av;
+   pthread_t th[MTNTHR];
+   FILE *fp;
+
+   if((fp = fopen(MTFILE,"r")) == NULL) return;
+   while(fgets(line,sizeof(line),fp) != NULL) {
+      av = (char **)malloc((argc + strlen(line)/2 + 2)*sizeof(char *));
+      for(na=0; na < argc; na++) av[na] = argv[na];
+      for(tok=strtok_r(line," \t\r\n",&sv); tok != NULL && tok[0] != '#';
+          tok=strtok_r(NULL," \t\r\n",&sv)) av[na++] = strdup(tok);
+      if(na == argc) {		/* empty or comment */
+         free(av);
+         continue;
+      }
+      av[na] = NULL;
+      if(mtn == nmax) {
+         nmax  = 2*nmax + 16;
+         mtjob = (MTJOB *)realloc(mtjob,nmax*sizeof(MTJOB));
+      }
+      mtjob[mtn].argc = na;
+      mtjob[mtn].argv = av;
+      mtjob[mtn].id   = mtn + 1;
+      mtjob[mtn].rc   = -1;
+      mtjob[mtn].it   = 0;
+      mtjob[mtn].k    = 0;
+      mtjob[mtn].t    = 0.0;
+      mtn++;
+   }
+   fclose(fp);
+   if(mtn == 0) return;
+
+   mkdir(MTDIR,0777);
+   nt = (mtn < MTNTHR) ? mtn : MTNTHR;
+   t0 = mtclock();
+   for(i=0; i < nt; i++) pthread_create(&th[i],NULL,mtwork,NULL);
+   for(i=0; i < nt; i++) pthread_join(th[i],NULL);
+   mtwall = mtclock() - t0;
+
+   fp = fopen("mt.sv4","w");
+   fprintf(fp,"# scen rc it k t\n");
+   for(i=0; i < mtn; i++) {
+      fprintf(fp,"%d %d %d %d %e\n",mtjob[i].id,mtjob[i].rc,mtjob[i].it,
+              mtjob[i].k,mtjob[i].t);
+      for(na=argc; na < mtjob[i].argc; na++) free(mtjob[i].argv[na]);
+      free(mtjob[i].argv);
+   }
+   fclose(fp);
+   free(mtjob);
+}
+#endif
+
+#ifdef LIBSOLVDE
+/* ----------------------------------------------------------------
+
+   shared library (C ABI, declarations in libsolvde.h): solves in
+   the process of the caller, no output files.
+
+     cc -O2 -shared -fPIC -pthread -DLIBSOLVDE run.c -o libsolvde.so -lm
+
+     SOLVDE *h = solvde_create();      parameters: the defaults of
+     solvde_set(h,"PHBULK",8.1);       the build, names as mpread()
+     solvde_warm(h,1);                 start from the last solution
+     it = solvde_solve(h);             Newton iterations, < 0: failed
+     rc = solvde_error(h,&it,&k,&msg); reason SV..., iteration, point
+     solvde_cancel(h);                 other thread: stop the solve
+     n  = solvde_points(h);            mesh points M
+     solvde_profile(h,"co2",buf,n);    "r" or species (.sv4 names)
+     solvde_destroy(h);
+
+   A solve is lbmain() (main() of the executable) in a new thread,
+   i.e. with fresh state (CTX), output files on LBNULL and the
+   solution copied to the handle (lbget()); the workers of the
+   daemon call lbrun() in their own threads instead (lbkeep). One handle per thread
+   at a time, handles in different threads solve concurrently.
+   A failed solve (solvde(), nrerror(): nrfail()) returns -reason,
+   the status is kept in the handle and so is the last solution
+   (e.g. a retry from it with other ITMAX, SLOWC); the process and
+   the other handles go on.
+
+   ---------------------------------------------------------------- */
+
+int lbmain(),mpset(),mpval();
+
+void lbstart(y)		/* initial guess: last solution of the handle */
+double **y;
+{
+   if(!lbcur->warm || lbcur->m == 0) return;
+   ymap(y,lbcur->m,lbcur->r,lbcur->y);
+   lbwarm = 1;
+}
+
+void lbget(y)		/* solution -> handle */
+double **y;
+{
+   int a;
+
+   if(lbcur->y == NULL) {
+      lbcur->r = dvector(1,MMAX);
+      lbcur->y = dmatrix(1,NE,1,MMAX);
+   }
+   for(a=1; a <= NE; a++)
+      memcpy(&lbcur->y[a][1],&y[a][1],M*sizeof(double));
+   memcpy(&lbcur->r[1],&r[1],M*sizeof(double));
+   lbcur->m  = M;
+   lbcur->rc = itsol;
+}
+
+void *lbrun(arg)		/* one solve: thread of solvde_solve(), worker */
+void *arg;
+{
+   char *argv[2]={"libsolvde",NULL};
+
+   lbcur = (SOLVDE *)arg;
+   mp    = lbcur->mp;
+   svrc  = SVOK;		/* thread of an earlier solve: dmwork() */
+   svit  = svk = 0;
+   svmsg[0] = '\0';
+   lbwarm = 0;
+   if(setjmp(ctxjmp) == 0) {
+      ctxjmpon = 1;
+      lbmain(1,argv);
+   }
+   ctxjmpon = 0;
+   lbcur->svrc = svrc;		/* status -> handle */
+   lbcur->svit = svit;
+   lbcur->svk  = svk;
+   snprintf(lbcur->svmsg,sizeof(lbcur->svmsg),"%s",svmsg);
+   if(svrc != SVOK) lbcur->rc = -svrc;
+   if(svrc == SVCANCEL) lbcur->cancel = 0;
+   return(NULL);
+}
+
+SOLVDE *solvde_create(void)
+{
+   SOLVDE *h;
+
+   h = (SOLVDE *)calloc(1,sizeof(SOLVDE));
+   if(h != NULL) h->mp = mp;	/* defaults (this thread: unchanged) */
+   return(h);
+}
+
+int solvde_set(SOLVDE *h,const char *name,double v)	/* -1: unknown name */
+{
+   int ok;
+   ModelParams save=mp;
+
+   mp = h->mp;
+   ok = mpset((char *)name,v);
+   h->mp = mp;
+   mp = save;
+   return(ok ? 0 : -1);
+}
+
+void solvde_warm(SOLVDE *h,int on)
+{
+   h->warm = on;
+}
+
+int solvde_solve(SOLVDE *h)	/* Newton iterations, < 0: -reason */
+{
+   pthread_t th;
+   pthread_attr_t at;
+
+   h->rc   = -SVNOMEM;
+   h->svrc = SVNOMEM;
+   h->svit = h->svk = 0;
+   strcpy(h->svmsg,"no thread for the solve");
+   pthread_attr_init(&at);
+   pthread_attr_setstacksize(&at,LBSTACK);
+   if(pthread_create(&th,&at,lbrun,h) == 0) pthread_join(th,NULL);
+   pthread_attr_destroy(&at);
+   return(h->rc);
+}
+
+void solvde_cancel(SOLVDE *h)	/* from another thread: the running (or
+				   the next) solve of h ends, SVCANCEL */
+{
+   __sync_lock_test_and_set(&h->cancel,1);
+}
+
+int solvde_error(SOLVDE *h,int *it,int *k,const char **msg)
+{				/* status of the last solve, SVOK: none */
+   if(it != NULL)  *it  = h->svit;
+   if(k != NULL)   *k   = h->svk;
+   if(msg != NULL) *msg = h->svmsg;
+   return(h->svrc);
+}
+
+int solvde_points(SOLVDE *h)	/* of the last solve, 0: none */
+{
+   return(h->m);
+}
+
+int solvde_profile(SOLVDE *h,const char *name,double *buf,int n)
+{				/* values written, -1: unknown name */
+   int a,k;
+
+   if(h->m == 0) return(-1);
+   if(n > h->m) n = h->m;
+   if(strcmp(name,"r") == 0) {
+      for(k=0; k < n; k++) buf[k] = h->r[k+1];
+      return(n);
+   }
+   for(a=1; a <= N2; a++)
+      if(strcmp(spname(a),name) == 0) {
+         for(k=0; k < n; k++) buf[k] = h->y[a][k+1];
+         return(n);
+      }
+   return(-1);
+}
+
+void solvde_destroy(SOLVDE *h)
+{
+   if(h == NULL) return;
+   if(h->y != NULL) {
+      free_dmatrix(h->y,1,NE,1,MMAX);
+      free_dvector(h->r,1,MMAX);
+   }
+   free(h);
+}
+#endif
+
+#ifdef DAEMON
+/* ----------------------------------------------------------------
+
+   solver daemon: the LIBSOLVDE build with a main() that listens on
+   the Unix socket DMSOCK (or argv[1]) and solves parameter sets for
+   its clients (notebooks, the Julia coupling) without a process,
+   compile or files per solve.
+
+     cc -O2 -pthread -DLIBSOLVDE -DDAEMON run.c -o solvd -lm
+     ./solvd /tmp/solvd.sock &
+
+   Requests: one per line, ID chosen by the client (no blanks);
+   answers carry the ID of the request, in the order the solves end:
+
+     ID solve [NAME=value ...] [shell] [bin]
+        -> ID ok IT M r species...     and M lines of values (%.9e):
+                                       profiles, shell: M = 1, r[1];
+                                       bin: M rows of doubles (byte
+                                       order of the host) instead
+     ID cancel ID2
+        -> ID ok 0 0                   ID2 (same connection): queued,
+                                       dropped; running, stopped at
+                                       its next Newton iteration
+     failed (solvde_error(), parameters: SVPARAM, cancelled: SVCANCEL):
+        -> ID error REASON IT K message
+
+   NAME=value as mpread(), others: the defaults of the build. All
+   requests go to one queue, DMNTHR workers (dmwork(), one handle
+   each) solve them at the same time, each in its own thread (no
+   thread per request, arrays of lbmain() kept: lbkeep). The last DMNKEEP solutions are
+   kept: a solve starts from the nearest one within key distance
+   DMMAXD (sllkey(), as SOLLIB), i.e. without the uptake ramp. A
+   closed connection cancels its requests.
+
+   ---------------------------------------------------------------- */
+
+typedef struct {	/* connection				*/
+   int fd,refs;		/* socket, reader + requests of it	*/
+   pthread_mutex_t wr;	/* one answer at a time			*/
+} DMCONN;
+
+typedef struct DMJOB {	/* request				*/
+   char id[64];
+   int shell,bin;	/* r[1] only; raw doubles, see dmanswer()	*/
+   ModelParams mp;
+   DMCONN *cn;
+   SOLVDE *h;		/* worker handle, NULL: queued		*/
+   struct DMJOB *next;
+} DMJOB;
+
+typedef struct {	/* recent solution			*/
+   double key[SLNKEY];
+   int m;		/* 0: empty				*/
+   double *r,**y;
+} DMSOL;
+
+pthread_mutex_t dmlock=PTHREAD_MUTEX_INITIALIZER;	/* all below	*/
+pthread_cond_t dmcond=PTHREAD_COND_INITIALIZER;	/* queue not empty */
+DMJOB *dmhead=NULL,*dmtail=NULL;	/* queue			*/
+DMJOB *dmrun=NULL;		/* running requests		*/
+DMSOL dmsol[DMNKEEP];
+int dmnext=0;			/* next slot of dmsol		*/
+
+void dmunref(cn)		/* reference gone: last one closes */
+DMCONN *cn;
+{
+   int n;
+
+   pthread_mutex_lock(&dmlock);
+   n = --cn->refs;
+   pthread_mutex_unlock(&dmlock);
+   if(n > 0) return;
+   close(cn->fd);
+   pthread_mutex_destroy(&cn->wr);
+   free(cn);
+}
+
+void dmsend(cn,buf,n)		/* answer to the client */
+DMCONN *cn;
+char *buf;
+size_t n;
+{
+   ssize_t w;
+
+   pthread_mutex_lock(&cn->wr);
+   while(n > 0 && (w = send(cn->fd,buf,n,MSG_NOSIGNAL)) > 0) {
+      buf += w;
+      n   -= (size_t)w;
+   }
+   pthread_mutex_unlock(&cn->wr);
+}
+
+void dmerror(cn,id,rc,it,k,msg)
+DMCONN *cn;
+char *id,*msg;
+int rc,it,k;
+{
+   int n;
+   char buf[512];
+
+   n = snprintf(buf,sizeof(buf),"%s error %d %d %d %s\n",id,rc,it,k,msg);
+   if(n >= (int)sizeof(buf)) n = sizeof(buf) - 1;
+   dmsend(cn,buf,(size_t)n);
+}
+
+void dmlook(h,key)		/* warm start: nearest recent solution */
+SOLVDE *h;
+double key[];
+{
+   int a,i,ib=-1;
+   double d,db=DMMAXD;
+
+   h->warm = 0;
+   pthread_mutex_lock(&dmlock);
+   for(i=0; i < DMNKEEP; i++)
+      if(dmsol[i].m > 0 && (d = sldist(dmsol[i].key,key)) < db) {
+         db = d;
+         ib = i;
+      }
+   if(ib >= 0) {
+      if(h->y == NULL) {
+         h->r = dvector(1,MMAX);
+         h->y = dmatrix(1,NE,1,MMAX);
+      }
+      h->m = dmsol[ib].m;
+      memcpy(&h->r[1],&dmsol[ib].r[1],h->m*sizeof(double));
+      for(a=1; a <= NE; a++)
+         memcpy(&h->y[a][1],&dmsol[ib].y[a][1],h->m*sizeof(double));
+      h->warm = 1;
+   }
+   pthread_mutex_unlock(&dmlock);
+}
+
+void dmkeep(h,key)		/* solution of h -> recent solutions */
+SOLVDE *h;
+double key[];
+{
+   int a,i;
+   DMSOL *sl;
+
+   pthread_mutex_lock(&dmlock);
+   sl = &dmsol[dmnext];
+   dmnext = (dmnext + 1) % DMNKEEP;
+   if(sl->m == 0) {
+      sl->r = dvector(1,MMAX);
+      sl->y = dmatrix(1,NE,1,MMAX);
+   }
+   for(i=0; i < SLNKEY; i++) sl->key[i] = key[i];
+   sl->m = h->m;
+   memcpy(&sl->r[1],&h->r[1],h->m*sizeof(double));
+   for(a=1; a <= NE; a++)
+      memcpy(&sl->y[a][1],&h->y[a][1],h->m*sizeof(double));
+   pthread_mutex_unlock(&dmlock);
+}
+
+void dmanswer(jb,h,it)		/* profiles (shell: r[1]) or the error */
+DMJOB *jb;
+SOLVDE *h;
+int it;
+{
+   int a,k,m,rc,kk;
+   char *buf=NULL;
+   const char *msg;
+   size_t n=0;
+   FILE *fp;
+
+   if(it < 0) {
+      rc = solvde_error(h,&it,&kk,&msg);
+      dmerror(jb->cn,jb->id,rc,it,kk,(char *)msg);
+      return;
+   }
+   m = jb->shell ? 1 : h->m;
+   if((fp = open_memstream(&buf,&n)) == NULL) {
+      dmerror(jb->cn,jb->id,SVNOMEM,0,0,"no memory for the answer");
+      return;
+   }
+   fprintf(fp,"%s ok %d %d r",jb->id,it,m);
+   for(a=1; a <= N2; a++)
+      if(strcmp(spname(a),"unused") != 0) fprintf(fp," %s",spname(a));
+   fprintf(fp,"\n");
+   for(k=1; k <= m; k++) {
+      if(jb->bin) {		/* no conversion to text */
+         fwrite(&h->r[k],sizeof(double),1,fp);
+         for(a=1; a <= N2; a++)
+            if(strcmp(spname(a),"unused") != 0)
+               fwrite(&h->y[a][k],sizeof(double),1,fp);
+         continue;
+      }
+      fprintf(fp,"%.9e",h->r[k]);
+      for(a=1; a <= N2; a++)
+         if(strcmp(spname(a),"unused") != 0) fprintf(fp," %.9e",h->y[a][k]);
+      fprintf(fp,"\n");
+   }
+   fclose(fp);
+   dmsend(jb->cn,buf,n);
+   free(buf);
+}
+
+void *dmwork(arg)		/* worker: requests of the queue */
+void *arg;
+{
+   int it;
+   double key[SLNKEY];
+   DMJOB *jb,**pj;
+   SOLVDE *h;
+
+   if((h = solvde_create()) == NULL) return(NULL);
+   lbkeep = 1;
+   for(;;) {
+      pthread_mutex_lock(&dmlock);
+      while(dmhead == NULL) pthread_cond_wait(&dmcond,&dmlock);
+      jb = dmhead;
+      if((dmhead = jb->next) == NULL) dmtail = NULL;
+      jb->h     = h;		/* running: cancel -> solvde_cancel() */
+      jb->next  = dmrun;
+      dmrun     = jb;
+      h->cancel = 0;
+      pthread_mutex_unlock(&dmlock);
+
+      mp = jb->mp;		/* sllkey(): parameters of the request */
+      sllkey(key);
+      h->mp = jb->mp;
+      dmlook(h,key);
+      lbrun(h);			/* in this thread, see solvde_solve() */
+      if((it = h->rc) >= 0) dmkeep(h,key);
+
+      pthread_mutex_lock(&dmlock);
+      for(pj=&dmrun; *pj != jb; pj=&(*pj)->next);
+      *pj = jb->next;
+      pthread_mutex_unlock(&dmlock);
+      dmanswer(jb,h,it);
+      dmunref(jb->cn);
+      free(jb);
+   }
+   return(NULL);
+}
+
+int dmcancel(cn,id)		/* requests of cn (id NULL: all): queued */
+DMCONN *cn;			/* dropped, running stopped; 0: none	*/
+char *id;
+{
+   int n=0;
+   DMJOB *jb,**pj,*drop=NULL;
+
+   pthread_mutex_lock(&dmlock);
+   for(pj=&dmhead; *pj != NULL;)
+      if((*pj)->cn == cn && (id == NULL || strcmp((*pj)->id,id) == 0)) {
+         jb       = *pj;
+         *pj      = jb->next;
+         jb->next = drop;
+         drop     = jb;
+         n++;
+      }
+      else pj = &(*pj)->next;
+   for(dmtail=dmhead; dmtail != NULL && dmtail->next != NULL;
+       dmtail=dmtail->next);
+   for(jb=dmrun; jb != NULL; jb=jb->next)
+      if(jb->cn == cn && (id == NULL || strcmp(jb->id,id) == 0)) {
+         solvde_cancel(jb->h);	/* answered by its worker */
+         n++;
+      }
+   pthread_mutex_unlock(&dmlock);
+   while((jb = drop) != NULL) {
+      drop = jb->next;
+      if(id != NULL) dmerror(cn,jb->id,SVCANCEL,0,0,"cancelled");
+      dmunref(cn);
+      free(jb);
+   }
+   return(n);
+}
+
+void dmrequest(cn,line,mpdef)	/* one line of the client */
+DMCONN *cn;
+char *line;
+ModelParams *mpdef;
+{
+   double v;
+   char *id,*cmd,*tok,*sv,*eq,name[64],buf[128];
+   DMJOB *jb;
+
+   if((id = strtok_r(line," \t\r\n",&sv)) == NULL) return;
+   if((cmd = strtok_r(NULL," \t\r\n",&sv)) == NULL) cmd = "";
+   if(strlen(id) >= sizeof(jb->id)) {
+      dmerror(cn,"-",SVPARAM,0,0,"request id too long");
+      return;
+   }
+
+   if(strcmp(cmd,"cancel") == 0) {
+      tok = strtok_r(NULL," \t\r\n",&sv);
+      if(tok != NULL && dmcancel(cn,tok)) {
+         snprintf(buf,sizeof(buf),"%s ok 0 0\n",id);
+         dmsend(cn,buf,strlen(buf));
+      }
+      else dmerror(cn,id,SVFAIL,0,0,"no such request");
+      return;
+   }
+   if(strcmp(cmd,"solve") != 0) {
+      dmerror(cn,id,SVFAIL,0,0,"unknown request (solve, cancel)");
+      return;
+   }
 
-	}
+   jb = (DMJOB *)calloc(1,sizeof(DMJOB));
+   strcpy(jb->id,id);
+   mp = *mpdef;
+   while((tok = strtok_r(NULL," \t\r\n",&sv)) != NULL) {
+      if(strcmp(tok,"shell") == 0) {
+         jb->shell = 1;
+         continue;
+      }
+      if(strcmp(tok,"bin") == 0) {
+         jb->bin = 1;
+         continue;
+      }
+      if((eq = strchr(tok,'=')) == NULL || eq - tok >= 64) {
+         dmerror(cn,id,SVPARAM,0,0,"NAME=value expected");
+         free(jb);
+         return;
+      }
+      strncpy(name,tok,eq - tok);
+      name[eq - tok] = '\0';
+      if(!mpval(eq+1,&v)) {
+         snprintf(buf,sizeof(buf),"bad value of model parameter %s",name);
+         dmerror(cn,id,SVPARAM,0,0,buf);
+         free(jb);
+         return;
+      }
+      if(!mpset(name,v)) {
+         snprintf(buf,sizeof(buf),"unknown model parameter %s",name);
+         dmerror(cn,id,SVPARAM,0,0,buf);
+         free(jb);
+         return;
+      }
+   }
+   jb->mp = mp;
+   jb->cn = cn;
+
+   pthread_mutex_lock(&dmlock);
+   cn->refs++;
+   if(dmtail == NULL) dmhead = jb;
+   else dmtail->next = jb;
+   dmtail = jb;
+   pthread_cond_signal(&dmcond);
+   pthread_mutex_unlock(&dmlock);
+}
+
+void *dmread(arg)		/* thread: requests of one connection */
+void *arg;
+{
+   DMCONN *cn=(DMCONN *)arg;
+   ModelParams mpdef=mp;	/* new thread: the defaults of the build */
+   char *line=NULL;
+   size_t n=0;
+   FILE *fp;
+
+   if((fp = fdopen(dup(cn->fd),"r")) != NULL) {
+      while(getline(&line,&n,fp) > 0) dmrequest(cn,line,&mpdef);
+      fclose(fp);
+   }
+   free(line);
+   dmcancel(cn,NULL);		/* closed: its requests */
+   dmunref(cn);
+   return(NULL);
+}
+
+int main(int argc,char *argv[])	/* daemon: accepts connections */
+{
+   int i,fd,cfd;
+   char *path=(argc > 1) ? argv[1] : DMSOCK;
+   struct sockaddr_un sa;
+   pthread_t th;
+   pthread_attr_t at;
+   DMCONN *cn;
+
+   signal(SIGPIPE,SIG_IGN);
+   memset(&sa,0,sizeof(sa));
+   sa.sun_family = AF_UNIX;
+   snprintf(sa.sun_path,sizeof(sa.sun_path),"%s",path);
+   unlink(path);
+   if((fd = socket(AF_UNIX,SOCK_STREAM,0)) < 0
+      || bind(fd,(struct sockaddr *)&sa,sizeof(sa)) < 0 || listen(fd,64) < 0) {
+      perror(path);
+      return(1);
+   }
+   pthread_attr_init(&at);
+   pthread_attr_setstacksize(&at,LBSTACK);	/* the solves, see lbrun() */
+   for(i=0; i < DMNTHR; i++)
+      if(pthread_create(&th,&at,dmwork,NULL) == 0) pthread_detach(th);
+   pthread_attr_destroy(&at);
+
+   for(;;) {
+      if((cfd = accept(fd,NULL,NULL)) < 0) continue;
+      cn = (DMCONN *)calloc(1,sizeof(DMCONN));
+      cn->fd   = cfd;
+      cn->refs = 1;		/* the reader */
+      pthread_mutex_init(&cn->wr,NULL);
+      if(pthread_create(&th,NULL,dmread,cn) == 0) pthread_detach(th);
+      else dmunref(cn);
+   }
+   return(0);
+}
+#endif
 
-/*        debug   (only if too many iterations in SOLVDE)   */
+/* -----  failed solve (solvde() != SVOK): the last iterate to the
+          profile files (still open, closed by main() or the exit)
+          and its derivatives to d*.sv4 (debug)                  ----- */
 
+void svdump(y)
+double **y;
+{
+   int j;
 
-   fpdco2   = fopen("dco2.sv4","w");
-   fpdhco3  = fopen("dhco3.sv4","w");
-   fpdco3   = fopen("dco3.sv4","w");
-   fpdh     = fopen("dh.sv4","w");
-   fpdoh    = fopen("doh.sv4","w");
+   fpdco2   = ctxopen("dco2.sv4","w");
+   fpdhco3  = ctxopen("dhco3.sv4","w");
+   fpdco3   = ctxopen("dco3.sv4","w");
+   fpdh     = ctxopen("dh.sv4","w");
+   fpdoh    = ctxopen("doh.sv4","w");
 #ifdef C13ISTP
-   fpdcco2   = fopen("dcco2.sv4","w");
-   fpdhcco3  = fopen("dhcco3.sv4","w");
-   fpdcco3   = fopen("dcco3.sv4","w");
+   fpdcco2   = ctxopen("dcco2.sv4","w");
+   fpdhcco3  = ctxopen("dhcco3.sv4","w");
+   fpdcco3   = ctxopen("dcco3.sv4","w");
 #endif
 #ifdef OXYGEN
-   fpdo2    = fopen("do2.sv4","w");
+   fpdo2    = ctxopen("do2.sv4","w");
 #endif
 #ifdef BORON
-   fpdboh3  = fopen("dboh3.sv4","w");
-   fpdboh4  = fopen("dboh4.sv4","w");
+   fpdboh3  = ctxopen("dboh3.sv4","w");
+   fpdboh4  = ctxopen("dboh4.sv4","w");
 #ifdef BORISTP
-   fpdbboh3  = fopen("dbboh3.sv4","w");
-   fpdbboh4  = fopen("dbboh4.sv4","w");
+   fpdbboh3  = ctxopen("dbboh3.sv4","w");
+   fpdbboh4  = ctxopen("dbboh4.sv4","w");
 #endif
 #endif
 #ifdef CALCIUM
-   fpdca    = fopen("dca.sv4","w");
+   fpdca    = ctxopen("dca.sv4","w");
 #endif
 
 
@@ -3234,33 +7979,6 @@ int indexv[];
 #endif
       } /* for */
 
-      fclose(fpr);
-
-      fclose(fpco2);
-      fclose(fphco3);
-      fclose(fpco3);
-      fclose(fph);
-      fclose(fpoh);
-#ifdef C13ISTP
-      fclose(fpcco2);
-      fclose(fphcco3);
-      fclose(fpcco3);
-#endif
-#ifdef OXYGEN
-      fclose(fpo2);
-#endif
-#ifdef BORON
-      fclose(fpboh3);
-      fclose(fpboh4);
-#ifdef BORISTP
-      fclose(fpbboh3);
-      fclose(fpbboh4);
-#endif
-#endif
-#ifdef CALCIUM
-      fclose(fpca);
-#endif
-
       fclose(fpdco2);
       fclose(fpdhco3);
       fclose(fpdco3);
@@ -3285,7 +8003,282 @@ int indexv[];
 #ifdef CALCIUM
       fclose(fpdca);
 #endif
-	nrerror("Too many iterations in SOLVDE");
+}
+
+void svabort(y)		/* failed solve, the caller cannot go on */
+double **y;
+{
+   svdump(y);
+   nrerror(svmsg);
+}
+
+#ifdef MIMECO2SYM
+double vmramp(it)	/* vmaxit of Newton iteration it (solvde, batch) */
+int it;
+{
+	/* set vmaxit: linear increase with step of iteration (it)*/
+	/* to avoid negative values of co2. Neg. values occur	*/
+	/* if the initial uptake is too large.			*/
+	/* Vmax(it) = a * it					*/
+	/* slope: a = dV/d(it)					*/
+
+	double v;
+
+	if(it <= (int)(vmaxco2*1.e9*3600./DVDIT))
+		v = DVDIT*(double)(it*1.e-9/3600.);
+	else
+		v = vmaxco2;
+#ifdef ISTPDEC
+	if(istpst != 0) v = vmaxco2;	/* ramp: 1. pass only */
+#endif
+#ifdef LININIT
+	v = vmaxco2;		/* uptake is in the initial guess */
+#endif
+#ifdef TIMESTEP
+	if(trdt > 0.0) v = vmaxco2;	/* time steps: no ramp */
+#endif
+#ifdef SPSHIFT
+	if(spwarm) v = vmaxco2;		/* warm start: no ramp */
+#endif
+#ifdef SOLLIB
+	if(slwarm) v = vmaxco2;		/* library start: no ramp */
+#endif
+#ifdef LIBSOLVDE
+	if(lbwarm) v = vmaxco2;		/* last solution: no ramp */
+#endif
+	return(v);
+}
+#endif
+
+/* =========================================================
+   =========================================================
+
+             Numerical Recipes   (begin)
+
+   =========================================================
+   ========================================================= */
+
+
+int solvde(itmax,conv,slowc,scalv,indexv,ne,nb,m,y,c,s)
+       /* ----- 6/93 dwg Numerical Recipes: float -> double ----- */
+       /* returns SVOK, or the reason (svrc, svit, svk, svmsg):
+          singular block (pinvs()), too many iterations,
+          cancelled (LIBSOLVDE)                                  */
+int itmax,ne,nb,m;
+double conv,slowc,scalv[],**y,***c,**s;
+int indexv[];
+{
+	int ic1,ic2,ic3,ic4,it,j,j1,j2,j3,j4,j5,j6,j7,j8,j9;
+	int jc1,jcf,jv,k,k1,k2,km,kp,nvars,*kmax,*ivector();
+	double err,errj,fac,vmax,vz,*ermax,*dvector(),x;
+	int pinvs();
+	void difeq(),red(),bksub(),free_dvector(),free_ivector();
+#ifdef ISTPDEC
+	void difeqs(),istpset();
+#endif
+#ifdef QOICONV
+	int i,nq;
+	double q[NQOI+1],qold[NQOI+1],w[NQOI+1],dq,dqold=0.0,rho;
+#endif
+	svrc=SVOK;
+	svit=svk=0;
+	svmsg[0]='\0';
+	kmax=ivector(1,ne);
+	ermax=dvector(1,ne);
+	k1=1;
+	k2=m;
+	nvars=ne*m;
+	j1=1;
+	j2=nb;
+	j3=nb+1;
+	j4=ne;
+	j5=j4+j1;
+	j6=j4+j2;
+	j7=j4+j3;
+	j8=j4+j4;
+	j9=j8+j1;
+	ic1=1;
+	ic2=ne-nb;
+	ic3=ic2+1;
+	ic4=ne;
+	jc1=1;
+	jcf=ic3;
+#ifdef QOICONV
+	nq = qoival(y,qold,w);
+#endif
+	for (it=1;it<=itmax;it++) {
+#ifdef LIBSOLVDE
+		if (lbcur != NULL && lbcur->cancel) {	/* solvde_cancel() */
+			svrc=SVCANCEL;
+			strcpy(svmsg,"cancelled");
+			goto fail;
+		}
+#endif
+
+/* -----   store data: -> difeq   ----- */
+
+#ifdef ISTPDEC
+		if(ne < NE && istpst != 1) istpset(y,0);   /* main species pass */
+#endif
+		ystore(y);
+
+		co2negflag = 0;
+		for(j=1;j<=M;j++){
+		 	if(y[EQCO2][j] < 0.0) co2negflag = 1;
+		}
+      #ifdef PRINT
+		if(co2negflag == 1)
+			printf("\n ! too bad - CO2 is negative !\n");
+      #endif
+#ifdef MIMECO2SYM
+		vmaxit = vmramp(it);
+
+      #ifdef PRINT
+		printf("\n-----  before iteration ------\n");
+		printf("%d co2negflag\n",co2negflag);
+		printf("%d it\n",it);
+		printf("%e vmaxit\n",vmaxit*3600.);
+      #endif  /* PRINT */
+#endif
+
+		k=k1;
+		DIFEQ(k,k1,k2,j9,ic3,ic4,indexv,ne,s,y);
+		if (pinvs(ic3,ic4,j5,j9,jc1,k1,c,s)) goto fail;
+#if defined (CLPL) && defined (DRAIN)
+		calldifeq = 1;
+		fdrain = 0.0;
+		for (k=k1+1;k<=k2;k++) {
+			DIFEQ(k,k1,k2,j9,ic1,ic4,indexv,ne,s,y);
+		}
+		calldifeq = 2;
+		printf("calldifeq %d %e \n",calldifeq,fdrain);
+		for (k=k1+1;k<=k2;k++) {
+			kp=k-1;
+			DIFEQ(k,k1,k2,j9,ic1,ic4,indexv,ne,s,y);
+			red(ic1,ic4,j1,j2,j3,j4,j9,ic3,jc1,jcf,kp,c,s);
+			if (pinvs(ic1,ic4,j3,j9,jc1,k,c,s)) goto fail;
+		}
+#else
+		for (k=k1+1;k<=k2;k++) {
+			kp=k-1;
+			DIFEQ(k,k1,k2,j9,ic1,ic4,indexv,ne,s,y);
+			red(ic1,ic4,j1,j2,j3,j4,j9,ic3,jc1,jcf,kp,c,s);
+			if (pinvs(ic1,ic4,j3,j9,jc1,k,c,s)) goto fail;
+		}
+#endif
+		k=k2+1;
+		DIFEQ(k,k1,k2,j9,ic1,ic2,indexv,ne,s,y);
+		red(ic1,ic2,j5,j6,j7,j8,j9,ic3,jc1,jcf,k2,c,s);
+		if (pinvs(ic1,ic2,j7,j9,jcf,k2+1,c,s)) goto fail;
+		bksub(ne,nb,jcf,k1,k2,c);
+		err=0.0;
+		for (j=1;j<=ne;j++) {
+			jv=MSUB(indexv[j]);
+			errj=vmax=0.0;
+			km=0;
+			for (k=k1;k<=k2;k++) {
+				vz=fabs(c[j][1][k]);
+				if (vz > vmax) {
+					 vmax=vz;
+					 km=k;
+				}
+				errj += vz;
+			}
+			err += errj/scalv[jv];
+			ermax[j]=c[j][1][km]/scalv[jv];
+			kmax[j]=km;
+		}
+		err /= nvars;
+		fac=(err > slowc ? slowc/err : 1.0);
+              /* set new values */
+
+		for (jv=1;jv<=ne;jv++) {
+			j=MSUB(indexv[jv]);
+			for (k=k1;k<=k2;k++)
+				y[j][k] -= fac*c[jv][1][k];
+		}
+
+#ifdef NOHPLUS
+          for (k=k1;k<=k2;k++) y[4][k] = hplus[k];  /* diagnostic */
+#endif
+
+      #ifdef PRINT
+		printf("\n%8s %9s %9s\n","Iter.","Error","FAC");
+		printf("%6d %12.6f %11.6f\n",it,err,fac);
+      #endif /* PRINT */
+#ifdef PRINT
+		printf("%8s %8s %14s\n","Var.","Kmax","Max. Error");
+		for (j=1;j<=ne;j++)
+			printf("%6d %9d %14.6f \n",indexv[j],kmax[j],ermax[j]);
+#endif
+
+		itsol = it;
+#ifdef QOICONV
+		/* --- goal-oriented: change of the quantities of interest
+		   (scaled by their tolerance) and its contraction rho;
+		   remaining error <= dq * rho/(1-rho). Stops when it is
+		   below 1, and not at CONV while they change by more
+		   than their tolerance (slow convergence, C13ISTP)    --- */
+		qoival(y,q,w);
+		dq = 0.0;
+		for(i=1; i <= nq; i++) {
+			if(fabs(q[i]-qold[i])*w[i] > dq) dq = fabs(q[i]-qold[i])*w[i];
+			qold[i] = q[i];
+		}
+		if(it >= 2 && fac == 1.0 && dqold > 0.0
+#ifdef MIMECO2SYM
+		   && vmaxit >= vmaxco2
+#endif
+		  ) {
+			rho = dq/dqold;
+			if(rho < 1.0 && dq*rho/(1.0-rho) < 1.0) {
+				fprintf(fppara,"QOICONV: it %d err %e est. error/tol %e \n",
+					it,err,dq*rho/(1.0-rho));
+				free_dvector(ermax,1,ne);
+				free_ivector(kmax,1,ne);
+				return(SVOK);
+			}
+		}
+		dqold = dq;
+		if (dq >= 1.0) continue;
+#endif
+#ifdef MIMECO2SYM
+		if (err < conv && vmaxit >= vmaxco2) {
+			free_dvector(ermax,1,ne);
+			free_ivector(kmax,1,ne);
+			return(SVOK);
+		}
+#else
+		if (err < conv) {
+			free_dvector(ermax,1,ne);
+			free_ivector(kmax,1,ne);
+			return(SVOK);
+		}
+#endif
+
+
+	}
+
+	/* too many iterations: the largest correction of the last one */
+
+	svrc=SVITMAX;
+	svit=itmax;
+	for (j=1,vmax=0.0;j<=ne;j++) {
+		if (fabs(ermax[j]) >= vmax) {
+			vmax=fabs(ermax[j]);
+			svk=kmax[j];
+		}
+	}
+	strcpy(svmsg,"Too many iterations in SOLVDE");
+	free_dvector(ermax,1,ne);
+	free_ivector(kmax,1,ne);
+	return(svrc);
+
+fail:				/* pinvs(), cancel: svrc, svk, svmsg */
+	svit=it;
+	free_dvector(ermax,1,ne);
+	free_ivector(kmax,1,ne);
+	return(svrc);
 }
 
 void bksub(ne,nb,jf,k1,k2,c)
@@ -3314,13 +8307,13 @@ double ***c;
 }
 
 
-void pinvs(ie1,ie2,je1,jsf,jc1,k,c,s)
+int pinvs(ie1,ie2,je1,jsf,jc1,k,c,s)	/* SVOK, SVSING: svk = k, svmsg */
 int ie1,ie2,je1,jsf,jc1,k;
 double ***c,**s;
 {
 	int js1,jpiv,jp,je2,jcoff,j,irow,ipiv,id,icoff,i,*indxr,*ivector();
 	double pivinv,piv,dum,big,*pscl,*dvector();
-	void nrerror(),free_dvector(),free_ivector();
+	void free_dvector(),free_ivector();
 
 	indxr=ivector(ie1,ie2);
 	pscl=dvector(ie1,ie2);
@@ -3330,7 +8323,10 @@ double ***c,**s;
 		big=0.0;
 		for (j=je1;j<=je2;j++)
 			if (fabs(s[i][j]) > big) big=fabs(s[i][j]);
-		if (big == 0.0) nrerror("Singular matrix - row all 0, in PINVS");
+		if (big == 0.0) {
+			strcpy(svmsg,"Singular matrix - row all 0, in PINVS");
+			goto sing;
+		}
 		pscl[i]=1.0/big;
 		indxr[i]=0;
 	}
@@ -3352,7 +8348,10 @@ double ***c,**s;
 				}
 			}
 		}
-		if (s[ipiv][jpiv] == 0.0) nrerror("Singular matrix in routine PINVS");
+		if (piv == 0.0 || s[ipiv][jpiv] == 0.0) {
+			strcpy(svmsg,"Singular matrix in routine PINVS");
+			goto sing;
+		}
 		indxr[ipiv]=jpiv;
 		pivinv=1.0/s[ipiv][jpiv];
 		for (j=je1;j<=jsf;j++) s[ipiv][j] *= pivinv;
@@ -3376,6 +8375,14 @@ double ***c,**s;
 	}
 	free_dvector(pscl,ie1,ie2);
 	free_ivector(indxr,ie1,ie2);
+	return(SVOK);
+
+sing:
+	svrc=SVSING;
+	svk=k;
+	free_dvector(pscl,ie1,ie2);
+	free_ivector(indxr,ie1,ie2);
+	return(svrc);
 }
 
 void red(iz1,iz2,jz1,jz2,jm1,jm2,jmf,ic1,jc1,jcf,kc,c,s)
@@ -3398,6 +8405,169 @@ int iz1,iz2,jz1,jz2,jm1,jm2,jmf,ic1,jc1,jcf,kc;
 	}
 }
 
+#ifdef ADJOINT
+#define SWAP(a,b) {dum=(a);(a)=(b);(b)=dum;}
+#define TINY 1.0e-20
+
+void bandec(a,n,m1,m2,al,indx,d)
+       /* ----- Numerical Recipes: float -> double ----- */
+double **a,**al,*d;
+unsigned long n,indx[];
+int m1,m2;
+{
+	unsigned long i,j,k,l;
+	int mm;
+	double dum;
+
+	mm=m1+m2+1;
+	l=m1;
+	for (i=1;i<=m1;i++) {
+		for (j=m1+2-i;j<=mm;j++) a[i][j-l]=a[i][j];
+		l--;
+		for (j=mm-l;j<=mm;j++) a[i][j]=0.0;
+	}
+	*d=1.0;
+	l=m1;
+	for (k=1;k<=n;k++) {
+		dum=a[k][1];
+		i=k;
+		if (l < n) l++;
+		for (j=k+1;j<=l;j++) {
+			if (fabs(a[j][1]) > fabs(dum)) {
+				dum=a[j][1];
+				i=j;
+			}
+		}
+		indx[k]=i;
+		if (dum == 0.0) a[k][1]=TINY;
+		if (i != k) {
+			*d = -(*d);
+			for (j=1;j<=mm;j++) SWAP(a[k][j],a[i][j])
+		}
+		for (i=k+1;i<=l;i++) {
+			dum=a[i][1]/a[k][1];
+			al[k][i-k]=dum;
+			for (j=2;j<=mm;j++) a[i][j-1]=a[i][j]-dum*a[k][j];
+			a[i][mm]=0.0;
+		}
+	}
+}
+
+void banbks(a,n,m1,m2,al,indx,b)
+       /* ----- Numerical Recipes: float -> double ----- */
+double **a,**al,b[];
+unsigned long n,indx[];
+int m1,m2;
+{
+	unsigned long i,k,l;
+	int mm;
+	double dum;
+
+	mm=m1+m2+1;
+	l=m1;
+	for (k=1;k<=n;k++) {
+		i=indx[k];
+		if (i != k) SWAP(b[k],b[i])
+		if (l < n) l++;
+		for (i=k+1;i<=l;i++) b[i] -= al[k][i-k]*b[k];
+	}
+	l=1;
+	for (i=n;i>=1;i--) {
+		dum=b[i];
+		for (k=2;k<=l;k++) dum -= a[i][k]*b[k+i-1];
+		b[i]=dum/a[i][1];
+		if (l < mm) l++;
+	}
+}
+#undef SWAP
+#undef TINY
+#endif
+
+#if defined (FIT) || defined (ROM)
+#define TINY 1.0e-20
+
+void ludcmp(a,n,indx,d)
+       /* ----- Numerical Recipes: float -> double ----- */
+int n,*indx;
+double **a,*d;
+{
+	int i,imax,j,k;
+	double big,dum,sum,temp;
+	double *vv,*dvector();
+	void nrerror(),free_dvector();
+
+	vv=dvector(1,n);
+	*d=1.0;
+	for (i=1;i<=n;i++) {
+		big=0.0;
+		for (j=1;j<=n;j++)
+			if ((temp=fabs(a[i][j])) > big) big=temp;
+		if (big == 0.0) svfail(SVSING,"Singular matrix in routine LUDCMP");
+		vv[i]=1.0/big;
+	}
+	for (j=1;j<=n;j++) {
+		for (i=1;i<j;i++) {
+			sum=a[i][j];
+			for (k=1;k<i;k++) sum -= a[i][k]*a[k][j];
+			a[i][j]=sum;
+		}
+		big=0.0;
+		imax=j;
+		for (i=j;i<=n;i++) {
+			sum=a[i][j];
+			for (k=1;k<j;k++)
+				sum -= a[i][k]*a[k][j];
+			a[i][j]=sum;
+			if ( (dum=vv[i]*fabs(sum)) >= big) {
+				big=dum;
+				imax=i;
+			}
+		}
+		if (j != imax) {
+			for (k=1;k<=n;k++) {
+				dum=a[imax][k];
+				a[imax][k]=a[j][k];
+				a[j][k]=dum;
+			}
+			*d = -(*d);
+			vv[imax]=vv[j];
+		}
+		indx[j]=imax;
+		if (a[j][j] == 0.0) a[j][j]=TINY;
+		if (j != n) {
+			dum=1.0/(a[j][j]);
+			for (i=j+1;i<=n;i++) a[i][j] *= dum;
+		}
+	}
+	free_dvector(vv,1,n);
+}
+
+void lubksb(a,n,indx,b)
+       /* ----- Numerical Recipes: float -> double ----- */
+double **a,b[];
+int n,*indx;
+{
+	int i,ii=0,ip,j;
+	double sum;
+
+	for (i=1;i<=n;i++) {
+		ip=indx[i];
+		sum=b[ip];
+		b[ip]=b[i];
+		if (ii)
+			for (j=ii;j<=i-1;j++) sum -= a[i][j]*b[j];
+		else if (sum) ii=i;
+		b[i]=sum;
+	}
+	for (i=n;i>=1;i--) {
+		sum=b[i];
+		for (j=i+1;j<=n;j++) sum -= a[i][j]*b[j];
+		b[i]=sum/a[i][i];
+	}
+}
+#undef TINY
+#endif
+
 /* =========================================================
    =========================================================
 
@@ -3556,6 +8726,9 @@ void difeq(k,k1,k2,jsf,is1,isf,indexv,ne,s,y)
 
       for(a=1; a <= N2; a++) s[NRB+a][NE+indexv[N2+a]] = 1.0;
 
+#ifdef GENRXN
+      rxnleft(jsf,s,y);		/* plain fluxes, the others below */
+#endif
 
 
 #ifdef MIMECO2DIA
@@ -3576,12 +8749,16 @@ void difeq(k,k1,k2,jsf,is1,isf,indexv,ne,s,y)
    VMAXDIA * KSDIA / (KSDIA + y[EQCO2][1]) / (KSDIA + y[EQCO2][1]);
    printf("%e  s[NRB+1][NE+indexv[1]]  \n",s[NRB+1][NE+indexv[1]]);
 #else
+#ifndef GENRXN
       s[NRB+1][jsf] = y[N2+EQCO2][1]  -  co2flux;
 #endif
+#endif
+#ifndef GENRXN
       s[NRB+2][jsf] = y[N2+EQHCO3][1] - hco3flux;
       s[NRB+3][jsf] = y[N2+EQCO3][1]  -  co3flux;
       s[NRB+4][jsf] = y[N2+EQHP][1]   -    hflux;
       s[NRB+5][jsf] = y[N2+EQOH][1]   -   ohflux;
+#endif
 #ifdef C13ISTP
 
 
@@ -3799,6 +8976,7 @@ void difeq(k,k1,k2,jsf,is1,isf,indexv,ne,s,y)
 #endif /* C13ISTP */
 
 
+#ifndef GENRXN
 #ifdef BORON
       s[NRB+EQBOH3][jsf] = y[N2+EQBOH3][1]   -   boh3flux;
       s[NRB+EQBOH4][jsf] = y[N2+EQBOH4][1]   -   boh4flux;
@@ -3813,6 +8991,7 @@ void difeq(k,k1,k2,jsf,is1,isf,indexv,ne,s,y)
 #ifdef CALCIUM
       s[NRB+EQCA][jsf] = y[N2+EQCA][1]   -   caflux;
 #endif
+#endif /* GENRXN */
 
 
 
@@ -3830,6 +9009,11 @@ void difeq(k,k1,k2,jsf,is1,isf,indexv,ne,s,y)
 
       for(a=1; a <= N2; a++)  s[a][NE+indexv[a]] = 1.0; /* prior 28.11.93 */
 
+#ifdef GENRXN
+      rxnright(jsf,s,y);
+#elif defined (EQFAR)
+      eqfar(jsf,indexv,s,y);	/* truncated mesh: far field	*/
+#else
       s[1][jsf] = y[EQCO2][M]  -  co2bulk;
       s[2][jsf] = y[EQHCO3][M] - hco3bulk;
       s[3][jsf] = y[EQCO3][M]  -  co3bulk;
@@ -3854,6 +9038,7 @@ void difeq(k,k1,k2,jsf,is1,isf,indexv,ne,s,y)
 #ifdef CALCIUM
       s[EQCA][jsf] = y[EQCA][M]   -   cabulk;
 #endif
+#endif /* GENRXN */
 
    } else {
 
@@ -3861,6 +9046,11 @@ void difeq(k,k1,k2,jsf,is1,isf,indexv,ne,s,y)
 
    /* --- interior point --- */
 
+#ifdef AUTOMESH
+      h  = r[k] - r[k-1];	/* non-uniform mesh */
+      hh = 0.5 * h;
+#endif
+
 /* first index: equation;
   second index: dependent variable */
 
@@ -3954,6 +9144,10 @@ void difeq(k,k1,k2,jsf,is1,isf,indexv,ne,s,y)
      if(k < dumk1 || k >= dumk2){
 #endif
 
+#ifdef GENRXN
+     rxnjac(k,indexv,s);
+#else
+
 #ifndef NOCO2
 
   /* ===== CO2 ================= */
@@ -4604,6 +9798,8 @@ if(k == 20){
 #endif
 #endif
 
+#endif /* GENRXN */
+
 #ifdef CLPL
      }
 #endif
@@ -4665,16 +9861,16 @@ if(k == 20){
 	  /* right hand side		*/
 
 	  tmp1  = vmaxit*co2[k]*1.e21;
-	  tmp1 /= (dco2*4.*PI*r[k]*r[k]*(double)nsymrad*(KS+co2[k]));
+	  tmp1 /= (dco2*4.*PI*r[k]*r[k]*NSYMK(k)*(KS+co2[k]));
 	  s[N2+a][jsf] -= tmp1;
 
 	  /*  derivatives dCO2/dCO2 	*/
 
 	  dummyd  = vmaxit*KS*1.e21;
-	  dummyd /= (dco2*2.*4.*PI*r[k]*r[k]*(double)nsymrad*SQ(KS+co2[k-1]));
+	  dummyd /= (dco2*2.*4.*PI*r[k]*r[k]*NSYMK(k)*SQ(KS+co2[k-1]));
 	  s[N2+a][indexv[1]]    -= dummyd;
 	  dummyd  = vmaxit*KS*1.e21;
-	  dummyd /= (dco2*2.*4.*PI*r[k]*r[k]*(double)nsymrad*SQ(KS+co2[k]));
+	  dummyd /= (dco2*2.*4.*PI*r[k]*r[k]*NSYMK(k)*SQ(KS+co2[k]));
 	  s[N2+a][NE+indexv[1]] -= dummyd;
 
 	  a = 2;	/* HCO3- */
@@ -4682,17 +9878,17 @@ if(k == 20){
 	  /* right hand side		*/
 
 	  tmp2  = vmaxit*1.e21;
-	  tmp2 /= (dhco3*4.*PI*r[k]*r[k]*(double)nsymrad);
+	  tmp2 /= (dhco3*4.*PI*r[k]*r[k]*NSYMK(k));
 	  tmp2 *= (1. - co2[k]/(KS+co2[k]));
 	  s[N2+a][jsf] -= tmp2;
 
 	  /*  derivatives dHCO3/dCO2	*/
 
 	  dummyd  = (-1.)*vmaxit*KS*1.e21;
-	  dummyd /= (dhco3*2.*4.*PI*r[k]*r[k]*(double)nsymrad*SQ(KS+co2[k-1]));
+	  dummyd /= (dhco3*2.*4.*PI*r[k]*r[k]*NSYMK(k)*SQ(KS+co2[k-1]));
 	  s[N2+a][indexv[1]]    -= dummyd;
 	  dummyd  = (-1.)*vmaxit*KS*1.e21;
-	  dummyd /= (dhco3*2.*4.*PI*r[k]*r[k]*(double)nsymrad*SQ(KS+co2[k]));
+	  dummyd /= (dhco3*2.*4.*PI*r[k]*r[k]*NSYMK(k)*SQ(KS+co2[k]));
 	  s[N2+a][NE+indexv[1]] -= dummyd;
 
 #define HSYM
@@ -4703,17 +9899,17 @@ if(k == 20){
 	  /* right hand side		*/
 
 	  tmp4  = vmaxit*1.e21;
-	  tmp4 /= (dh*4.*PI*r[k]*r[k]*(double)nsymrad);
+	  tmp4 /= (dh*4.*PI*r[k]*r[k]*NSYMK(k));
 	  tmp4 *= (1. - co2[k]/(KS+co2[k]));
 	  s[N2+a][jsf] -= tmp4;
 
 	  /*  derivatives dH/dCO2 	*/
 
 	  dummyd  = (-1.)*vmaxit*KS*1.e21;
-	  dummyd /= (dh*2.*4.*PI*r[k]*r[k]*(double)nsymrad*SQ(KS+co2[k-1]));
+	  dummyd /= (dh*2.*4.*PI*r[k]*r[k]*NSYMK(k)*SQ(KS+co2[k-1]));
 	  s[N2+a][indexv[1]]    -= dummyd;
 	  dummyd  = (-1.)*vmaxit*KS*1.e21;
-	  dummyd /= (dh*2.*4.*PI*r[k]*r[k]*(double)nsymrad*SQ(KS+co2[k]));
+	  dummyd /= (dh*2.*4.*PI*r[k]*r[k]*NSYMK(k)*SQ(KS+co2[k]));
 	  s[N2+a][NE+indexv[1]] -= dummyd;
 
 #endif
@@ -4724,17 +9920,17 @@ if(k == 20){
 	  /* right hand side		*/
 
 	  tmp4  = vmaxit*1.e21;
-	  tmp4 /= (doh*4.*PI*r[k]*r[k]*(double)nsymrad);
+	  tmp4 /= (doh*4.*PI*r[k]*r[k]*NSYMK(k));
 	  tmp4 *= (1. - co2[k]/(KS+co2[k]));
 	  s[N2+a][jsf] -= (-1.)*tmp4;
 
 	  /*  derivatives dOH/dCO2 	*/
 
 	  dummyd  = (-1.)*vmaxit*KS*1.e21;
-	  dummyd /= (doh*2.*4.*PI*r[k]*r[k]*(double)nsymrad*SQ(KS+co2[k-1]));
+	  dummyd /= (doh*2.*4.*PI*r[k]*r[k]*NSYMK(k)*SQ(KS+co2[k-1]));
 	  s[N2+a][indexv[1]]    -= (-1.)*dummyd;
 	  dummyd  = (-1.)*vmaxit*KS*1.e21;
-	  dummyd /= (doh*2.*4.*PI*r[k]*r[k]*(double)nsymrad*SQ(KS+co2[k]));
+	  dummyd /= (doh*2.*4.*PI*r[k]*r[k]*NSYMK(k)*SQ(KS+co2[k]));
 	  s[N2+a][NE+indexv[1]] -= (-1.)*dummyd;
 
 #endif
@@ -5006,32 +10202,32 @@ if(k == 20){
 	s[N2+a][jsf] -= tmp1;
  #else
         a = 1;	/* CO2 */
-	tmp1 	      = 1.e21*SYMCO2UPT/dco2/4./PI/r[k]/r[k]/(double)nsymrad;
+	tmp1 	      = 1.e21*SYMCO2UPT/dco2/4./PI/r[k]/r[k]/NSYMK(k);
 	s[N2+a][jsf] -= tmp1;
  #endif
 #endif
 #endif
 	a = 2; 	/* HCO3- */
-	tmp2	      = 1.e21*SYMHCO3UPT/dhco3/4./PI/r[k]/r[k]/(double)nsymrad;
+	tmp2	      = 1.e21*SYMHCO3UPT/dhco3/4./PI/r[k]/r[k]/NSYMK(k);
 	s[N2+a][jsf] -= tmp2;
 
 	a = 4;  /* H+    */
-	tmp4	      = 1.e21*SYMHUPT/dh/4./PI/r[k]/r[k]/(double)nsymrad;
+	tmp4	      = 1.e21*SYMHUPT/dh/4./PI/r[k]/r[k]/NSYMK(k);
 	s[N2+a][jsf] -= tmp4;
 
 #ifdef C13ISTP
     a = EQCCO2;		/* 13CO2 */
-    tmp1cc  	  = 1.e21*symcco2upt/dcco2/4./PI/r[k]/r[k]/(double)nsymrad;
+    tmp1cc  	  = 1.e21*symcco2upt/dcco2/4./PI/r[k]/r[k]/NSYMK(k);
     s[N2+a][jsf] -= tmp1cc;
 
     a = EQHCCO3;	/* 13HCO3- */
-    tmp2cc  	  = 1.e21*symhcco3upt/dhcco3/4./PI/r[k]/r[k]/(double)nsymrad;
+    tmp2cc  	  = 1.e21*symhcco3upt/dhcco3/4./PI/r[k]/r[k]/NSYMK(k);
     s[N2+a][jsf] -= tmp2cc;
 
 
     /* H+ uptake for H13CO3 is included in total H+ uptake */
     /* a = 4;  		 H+
-    tmp4cc	  = 1.e21*symhcco3upt/dh/4./PI/r[k]/r[k]/(double)nsymrad;
+    tmp4cc	  = 1.e21*symhcco3upt/dh/4./PI/r[k]/r[k]/NSYMK(k);
     s[N2+a][jsf] -= tmp4cc; */
 
 #endif
@@ -5040,11 +10236,11 @@ if(k == 20){
 
 
 #ifdef FLSYMUPT
-	fpsyup    = fopen("syup.sv4","a");
+	fpsyup    = ctxopen("syup.sv4","a");
 	fprintf(fpsyup,"%d %e %e %e %e\n",k,tmp1,tmp2,tmp4,co2[k]);
 	fclose(fpsyup);
 #ifdef C13ISTP
-	fpsyup13    = fopen("syup13.sv4","a");
+	fpsyup13    = ctxopen("syup13.sv4","a");
 	fprintf(fpsyup13,"%d %e %e %e %e\n",k,tmp1cc,tmp2cc,0.,cco2[k]);
 	fclose(fpsyup13);
 #endif
@@ -5088,13 +10284,13 @@ if(k == 20){
 	}
 #else
 	a = EQCO3;
-	tmp2	      = 1.e21*SYMCO3UPT/dco3/4./PI/r[k]/r[k]/(double)nsymrad;
+	tmp2	      = 1.e21*SYMCO3UPT/dco3/4./PI/r[k]/r[k]/NSYMK(k);
 	s[N2+a][jsf] -= tmp2;
 #endif
 
 #else
         a = EQO2;
-        s[N2+a][jsf] -= 1.e21*SYMO2UPT/do2/4./PI/r[k]/r[k]/(double)nsymrad;
+        s[N2+a][jsf] -= 1.e21*SYMO2UPT/do2/4./PI/r[k]/r[k]/NSYMK(k);
 #endif
 #endif
 	} /* end if(k < nsymrad) */
@@ -5175,6 +10371,10 @@ if(k == 20){
      if(k < dumk1 || k >= dumk2){
 #endif
 
+#ifdef GENRXN
+     rxnres(k,jsf,s);
+#else
+
 #ifndef NOCO2
 
      /* -----                CO2                ----- */
@@ -5411,6 +10611,8 @@ if(k == 20){
 
 #endif
 
+#endif /* GENRXN */
+
 
 #ifdef CLPL
      }
@@ -5419,10 +10621,142 @@ if(k == 20){
    /* --- end of REACTION ---- */
 #endif
 
+#ifdef TIMESTEP
+      if(trdt > 0.0) trterm(k,jsf,indexv,s,y);
+#endif
+
+   }
+
+}
+
+
+#ifdef ISTPDEC
+/* ----------------------------------------------------------------
+
+   decoupled isotopologue solve (C13ISTP, BORISTP)
+
+   Given the main species, the 13C and 11B equations are (nearly)
+   linear. main() first solves the main species with the ratios
+   isotopologue/main species fixed (istpset()) and then the
+   isotopologues with the main species fixed (the F13_CO3 boundary
+   condition is updated by the Newton iteration of that small
+   system). With CISTP (B10B11) the isotopologue reactions are part
+   of the H+ and OH- balance: isotopologues held fixed themselves
+   would drive these reactions out of equilibrium in the main pass
+   and the passes would drift away from the coupled solution; with
+   the ratios fixed they follow the main species. Passes end when
+   the main species no longer change (ISTPIT: failed solve).
+   solvde() works on the subsystem through msub[] and difeqs().
+
+   ---------------------------------------------------------------- */
+
+CTX double **istpr=NULL;	/* ratios isotopologue/main species:
+				   rows a (y), N2+a (d/dr), see istpset() */
+
+int istpmain(a)		/* main species of isotopologue a, 0: none */
+int a;
+{
+#ifdef C13ISTP
+   if(a == EQCCO2)  return(EQCO2);
+   if(a == EQHCCO3) return(EQHCO3);
+   if(a == EQCCO3)  return(EQCO3);
+#endif
+#ifdef BORISTP
+   if(a == EQBBOH3) return(EQBOH3);
+   if(a == EQBBOH4) return(EQBOH4);
+#endif
+   return(0);
+}
+
+void istpset(y,get)	/* get 1: ratios from y; 0: isotopologues of y
+			   from the main species and the ratios */
+double **y;
+int get;
+{
+   int a,b,k;
+   double q;
+
+   if(istpr == NULL) istpr = dmatrix(1,NE,1,MMAX);
+   for(a=1; a <= N2; a++) {
+      if((b = istpmain(a)) == 0) continue;
+      for(k=1; k <= M; k++) {
+         if(get) {
+            if(y[b][k] == 0.0) continue;	/* keep the last ratio */
+            q = y[a][k]/y[b][k];
+            istpr[a][k]    = q;
+            istpr[N2+a][k] = (y[N2+a][k] - q*y[N2+b][k])/y[b][k];
+         } else {		/* (q c)' = q c' + q' c */
+            y[a][k]    = istpr[a][k]*y[b][k];
+            y[N2+a][k] = istpr[a][k]*y[N2+b][k] + istpr[N2+a][k]*y[b][k];
+         }
+      }
    }
+}
 
+int istpsub(iso,ivs)	/* set subsystem, returns number of species */
+int iso,ivs[];
+{
+   int a,i,n=0,isp[N2+1];
+
+   for(a=1; a <= N2; a++)
+      if((istpmain(a) != 0) == iso) isp[++n] = a;
+   for(i=1; i <= n; i++) {
+      msub[  i] = isp[i];
+      msub[n+i] = N2+isp[i];
+#ifdef UPTAKE
+      ivs[  i] = n+i;
+      ivs[n+i] = i;
+#else
+      ivs[  i] = i;
+      ivs[n+i] = n+i;
+#endif
+   }
+   nsub = n;
+   return(n);
 }
 
+void difeqs(k,k1,k2,jsf,is1,isf,indexv,ne,s,y)	/* difeq: subsystem */
+   int k,k1,k2,jsf,is1,isf,indexv[],ne;
+   double **s,**y;
+{
+   static CTX double **sf = NULL;
+   int a,b,i,j,o,kk;
+   double q,dq;
+
+   if(sf == NULL) sf = dmatrix(1,NE,1,NSJ);
+
+   difeq(k,k1,k2,NSJ,is1,isf,ivfull,NE,sf,y);
+
+   /* main species pass: isotopologue a = q*(main b), istpset(), i.e.
+      d/db += q d/da + q' d/da', d/db' += q d/da' (y[k-1]: o = 0, y[k]:
+      o = NE; boundaries: y[k] only, at k1 and k2) */
+
+   if(ne < NE && istpst != 1) for(a=1; a <= N2; a++) {
+      if((b = istpmain(a)) == 0) continue;
+      for(o=0; o <= NE; o+=NE) {
+         if(o == 0 && (k == k1 || k > k2)) continue;
+         kk = (o == 0) ? k-1 : ((k > k2) ? k2 : k);
+         q  = istpr[a][kk];
+         dq = istpr[N2+a][kk];
+         for(i=1; i <= NE; i++) {
+            sf[i][o+ivfull[b]]    += q*sf[i][o+ivfull[a]]
+                                   + dq*sf[i][o+ivfull[N2+a]];
+            sf[i][o+ivfull[N2+b]] += q*sf[i][o+ivfull[N2+a]];
+         }
+      }
+   }
+
+   /* rows/columns of the subsystem are a subset of the full ones */
+
+   for(i=is1; i <= isf; i++) {
+      for(j=1; j <= ne; j++) {
+         s[i][   j] = sf[msub[i]][   msub[j]];
+         s[i][ne+j] = sf[msub[i]][NE+msub[j]];
+      }
+      s[i][jsf] = sf[msub[i]][NSJ];
+   }
+}
+#endif
 
 
 void precision()
@@ -5433,7 +10767,7 @@ void precision()
 
    FILE *fppre;
 
-   fppre = fopen("pre.sv4","w");
+   fppre = ctxopen("pre.sv4","w");
 
    fprintf(fppre," precision test: double \n");
 
@@ -5446,21 +10780,202 @@ void precision()
 
    fclose(fppre);
 }
+/* ----------------------------------------------------------------
+
+   model parameters at runtime (ModelParams mp): -p file, lines
+   NAME value (# comment), and NAME=value arguments, in this order.
+   Organism presets (resources/presets, a .dat file per organism)
+   are such files, e.g. ./a.out -p FORAMGSL.dat PHBULK=8.1, or a
+   -p per scenario line (MTHREAD). ALKBULK > 0: the bulk
+   carbonate system from pH and ALK, DICBULK unused.
+
+   ---------------------------------------------------------------- */
+
+int mpset(name,v)	/* mp.name = v, 0: unknown name */
+char *name;
+double v;
+{
+   int i;
+   static char *nm[] = {"RADIUS","CO3UPT","CO2UPT","HCO3UPT","PHBULK",
+      "DICBULK","SYMCO2UPT","SYMHCO3UPT","SYMTCUPT","VMAX","SYMDIST",
+      "REDS","SALINITY","TEMP","BORTBULK","ALKBULK","O2BULK","KS","DVDIT",
+      "BOH4UPT","SLOWC",NULL};
+   double *pv[21];
+
+   pv[0]  = &mp.radius;    pv[1]  = &mp.co3upt;     pv[2]  = &mp.co2upt;
+   pv[3]  = &mp.hco3upt;   pv[4]  = &mp.phbulk;     pv[5]  = &mp.dicbulk;
+   pv[6]  = &mp.symco2upt; pv[7]  = &mp.symhco3upt; pv[8]  = &mp.symtcupt;
+   pv[9]  = &mp.vmax;      pv[10] = &mp.symdist;    pv[11] = &mp.reds;
+   pv[12] = &mp.salinity;  pv[13] = &mp.temp;       pv[14] = &mp.bortbulk;
+   pv[15] = &mp.alkbulk;   pv[16] = &mp.o2bulk;     pv[17] = &mp.ks;
+   pv[18] = &mp.dvdit;     pv[19] = &mp.boh4upt;    pv[20] = &mp.slowc;
+
+   if(strcmp(name,"ITMAX") == 0) {
+      mp.itmax = (int)v;
+      return(1);
+   }
+   for(i=0; nm[i] != NULL; i++)
+      if(strcmp(name,nm[i]) == 0) {
+         *pv[i] = v;
+         return(1);
+      }
+   return(0);
+}
+
+int mpval(s,v)		/* number s (blanks after it) -> *v, 0: none */
+char *s;
+double *v;
+{
+   char *end;
+
+   *v = strtod(s,&end);
+   return(end != s && end[strspn(end," \t\r\n")] == '\0');
+}
+
+int mpread(argc,argv)	/* returns the number of parameters set */
+int argc;
+char *argv[];
+{
+   int i,k,n=0;
+   double v;
+   char name[64],val[64],rest[2],line[256],*eq;
+   FILE *fp;
+
+   for(i=1; i < argc; i++) {
+      if(strcmp(argv[i],"-p") == 0 && i+1 < argc) {
+         if((fp = fopen(argv[++i],"r")) == NULL) {
+            fprintf(stderr,"no parameter file %s\n",argv[i]);
+            svfail(SVPARAM,"mpread(): model parameters");
+         }
+         while(fgets(line,sizeof(line),fp) != NULL) {
+            if(sscanf(line,"%63s",name) != 1 || name[0] == '#')
+               continue;		/* blank line, comment */
+            k = sscanf(line,"%63s %63s %1s",name,val,rest);
+            if(k < 2 || (k == 3 && rest[0] != '#') || !mpval(val,&v)) {
+               fprintf(stderr,"bad line in %s: %s",argv[i],line);
+               fclose(fp);
+               svfail(SVPARAM,"mpread(): model parameters");
+            }
+            if(!mpset(name,v)) {
+               fprintf(stderr,"unknown model parameter %s\n",name);
+               svfail(SVPARAM,"mpread(): model parameters");
+            }
+            n++;
+         }
+         fclose(fp);
+      }
+      else if((eq = strchr(argv[i],'=')) != NULL && eq - argv[i] < 64) {
+         strncpy(name,argv[i],eq - argv[i]);
+         name[eq - argv[i]] = '\0';
+         if(!mpval(eq+1,&v)) {
+            fprintf(stderr,"bad value of model parameter %s: %s\n",name,eq+1);
+            svfail(SVPARAM,"mpread(): model parameters");
+         }
+         if(!mpset(name,v)) {
+            fprintf(stderr,"unknown model parameter %s\n",name);
+            svfail(SVPARAM,"mpread(): model parameters");
+         }
+         n++;
+      }
+      else {
+         fprintf(stderr,"usage: %s [-p file] [NAME=value ...]\n",argv[0]);
+         svfail(SVPARAM,"mpread(): model parameters");
+      }
+   }
+   return(n);
+}
+
 /* =================    main (begin)    ======================= */
 
+void yinit(y)		/* initial guess at the current parameters */
+double **y;
+{
+   int k;
+   double x,a1,b1,a2,b2;
+#ifdef C13ISTP
+   double acc1,bcc1,acc2,bcc2;
+#endif
+
+   /* --- test: pure diffusion --- */
+
+   /*
+        c'' + 2/r c' = 0                  -> c(r) = a/r + b
+        dc/dr (r1) = alpha = - a / r1**2  -> a = -alpha * r1**2
+        c(r2) = beta = a/r2 + b           -> b = beta + alpha * r1**2 / r2
+   */
+
+      a1 = -co2flux * RADIUS * RADIUS;
+      b1 =  co2bulk - a1 / RBULK;
+
+      a2 = -hco3flux * RADIUS * RADIUS;
+      b2 =  hco3bulk - a2 / RBULK;
+
+#ifdef C13ISTP
+      acc1 = -cco2flux * RADIUS * RADIUS;
+      bcc1 = cco2bulk - acc1 / RBULK;
+
+      acc2 = -hcco3flux * RADIUS * RADIUS;
+      bcc2 = hcco3bulk - acc2 / RBULK;
+#endif
+
+   for(k=1; k<=M; k++) {
+     x = r[k];
+        y[EQCO2][k]  =  a1/x + b1;
+     y[N2+EQCO2][k]  = -a1/x/x;
+        y[EQHCO3][k] =  a2/x + b2;
+     y[N2+EQHCO3][k] = -a2/x/x;
+        y[EQCO3][k]  =  co3bulk;
+     y[N2+EQCO3][k]  =  0.0;
+        y[EQHP][k]   =   hbulk;
+        y[EQOH][k]   =  ohbulk;
+     y[N2+EQHP][k]   =  0.0;
+     y[N2+EQOH][k]   =  0.0;
+#ifdef C13ISTP
+        y[EQCCO2][k]   =  acc1/x + bcc1;
+     y[N2+EQCCO2][k]   = -acc1/x/x;
+        y[EQHCCO3][k]  =  acc2/x + bcc2;
+     y[N2+EQHCCO3][k]  = -acc2/x/x;
+        y[EQCCO3][k]   =  cco3bulk;
+     y[N2+EQCCO3][k]   =  0.0;
+#endif
+#ifdef BORON
+        y[EQBOH3][k]   = boh3bulk;
+     y[N2+EQBOH3][k]   = 0.0;
+        y[EQBOH4][k]   = boh4bulk;
+     y[N2+EQBOH4][k]   = 0.0;
+#ifdef BORISTP
+        y[EQBBOH3][k]   = bboh3bulk;
+     y[N2+EQBBOH3][k]   = 0.0;
+        y[EQBBOH4][k]   = bboh4bulk;
+     y[N2+EQBBOH4][k]   = 0.0;
+#endif
+#endif
+#ifdef OXYGEN
+        y[EQO2][k]   = o2bulk;
+     y[N2+EQO2][k]   = 0.0;
+#endif
+#ifdef CALCIUM
+        y[EQCA][k]   = cabulk;
+     y[N2+EQCA][k]   = 0.0;
+#endif
+   }
+}
+
 #ifdef CBNS
 void main(int argc,char *argv[])
+#elif defined (LIBSOLVDE)
+int lbmain(int argc,char *argv[])	/* one solve, see solvde_solve() */
 #else
-int main()
+int main(int argc,char *argv[])
 #endif
 {
 
-   int i,indexv[NE+1],j,k;
-   double scalv[NE+1],x, ***c, **s, **y, **dmatrix(),
-          a1,b1,a2,b2,a3,b3,err[NE+1];
-#ifdef C13ISTP
-   double acc1,bcc1,acc2,bcc2,acc3,bcc3;
+   int i,indexv[NE+1],j,k,nmp=0;
+#ifdef ISTPDEC
+   int indexvs[NE+1],nits=0;
 #endif
+   double scalv[NE+1], ***c, **s, **y, **dmatrix(),err[NE+1];
+   void yinit();
    double cr,cinfty,ca,ak;
 
 #ifdef CBNS
@@ -5481,50 +10996,85 @@ int main()
    phbulkarg  = atof(argv[1]);
 #endif
 
-   y = dmatrix(1,NE,1,M);
+#ifdef MTHREAD
+   if(ctxdir[0] == '\0') mthread(argc,argv);	/* first the scenarios */
+#endif
+
+#ifdef LIBSOLVDE
+   if(lbkeep && lbky != NULL) {	/* worker: arrays of its last solve */
+      y = lbky;
+      s = lbks;
+      c = lbkc;
+   }
+   else {
+#endif
+   y = dmatrix(1,NE,1,MMAX);
    s = dmatrix(1,NE,1,NSJ);
    c = (double ***)malloc((unsigned) NE*sizeof(double **))-1;
+#ifdef LIBSOLVDE
+      lbky   = y;
+      lbks   = s;
+      lbkc   = c;
+      lbknck = 0;
+   }
+#endif
+
+#ifndef CBNS
+   nmp = mpread(argc,argv);	/* model parameters at runtime */
+#endif
 
+#ifndef LIBSOLVDE
    setbuf(stdout,NULL);
+#endif
 
    /* ---------------------- open files --------------------- */
 
-   fppara     = fopen("par.sv4","w");
+   fppara     = ctxopen("par.sv4","w");
 
    setbuf(fppara,NULL);
 
-   fpks       = fopen("ks.sv4","w");
+   if(nmp > 0)
+      fprintf(fppara,"model parameters set at runtime %d \n",nmp);
+#ifdef MTHREAD
+   if(mtn > 0 && ctxdir[0] == '\0') {
+      fprintf(fppara,"--- scenarios in threads (MTHREAD) --- \n");
+      fprintf(fppara,"scenarios, threads     %d %d \n",mtn,MTNTHR);
+      fprintf(fppara,"wall time [s]          %e \n",mtwall);
+   }
+#endif
+
+   fpks       = ctxopen("ks.sv4","w");
 
-   fpr        = fopen("r.sv4","w");
+   fpr        = ctxopen("r.sv4","w");
 
-   fpco2   = fopen("co2.sv4","w");
-   fphco3  = fopen("hco3.sv4","w");
-   fpco3   = fopen("co3.sv4","w");
-   fph     = fopen("h.sv4","w");
-   fpoh    = fopen("oh.sv4","w");
+   fpco2   = ctxopen("co2.sv4","w");
+   fphco3  = ctxopen("hco3.sv4","w");
+   fpco3   = ctxopen("co3.sv4","w");
+   fph     = ctxopen("h.sv4","w");
+   fpoh    = ctxopen("oh.sv4","w");
 
-   fpdc    = fopen("dc.sv4","w");
+   fpdc    = ctxopen("dc.sv4","w");
 
 #ifdef C13ISTP
-   fpcco2   = fopen("cco2.sv4","w");
-   fphcco3  = fopen("hcco3.sv4","w");
-   fpcco3   = fopen("cco3.sv4","w");
-   fpdc13s  = fopen("dc13s.sv4","w");
-   fpdcc    = fopen("dcc.sv4","w");
+   fpcco2   = ctxopen("cco2.sv4","w");
+   fphcco3  = ctxopen("hcco3.sv4","w");
+   fpcco3   = ctxopen("cco3.sv4","w");
+   fpdc13s  = ctxopen("dc13s.sv4","w");
+   fpdcc    = ctxopen("dcc.sv4","w");
 
 #ifdef CBNSLOOP
-   fpdc13slp = fopen("dc13slp.sv4","w");
+   fpdc13slp = ctxopen("dc13slp.sv4","w");
  #ifdef READ
   #ifdef DDAT
    #ifndef LIDA
-   	fpread    = fopen("alkcd.dat","r");
+   	fpread    = ctxopen("alkcd.dat","r");
    	if (fpread == 0){
    		printf("file alkcd.dat not available.\n");
     		exit(1);
    	}
    #endif
    #ifdef LIDA
-   	fpread    = fopen("alkcl.dat","r");
+   	fpread    = ctxopen("alkcl.dat","r");
    	if (fpread == 0){
    		printf("file alkcl.dat not available.\n");
     		exit(1);
@@ -5532,7 +11082,7 @@ int main()
    #endif
   #endif
   #ifdef LDAT
-   fpread    = fopen("alkcl.dat","r");
+   fpread    = ctxopen("alkcl.dat","r");
    if (fpread == 0){
    	printf("file alkcl.dat not available.\n");
     	exit(1);
@@ -5544,18 +11094,18 @@ int main()
 #endif /* C13ISTP */
 
 #ifdef OXYGEN
-   fpo2    = fopen("o2.sv4","w");
+   fpo2    = ctxopen("o2.sv4","w");
 #endif
 #ifdef BORON
-   fpboh3  = fopen("boh3.sv4","w");
-   fpboh4  = fopen("boh4.sv4","w");
+   fpboh3  = ctxopen("boh3.sv4","w");
+   fpboh4  = ctxopen("boh4.sv4","w");
 #ifdef BORISTP
-   fpbboh3   = fopen("bboh3.sv4","w");
-   fpbboh4   = fopen("bboh4.sv4","w");
+   fpbboh3   = ctxopen("bboh3.sv4","w");
+   fpbboh4   = ctxopen("bboh4.sv4","w");
 #endif
 #endif
 #ifdef CALCIUM
-   fpca    = fopen("ca.sv4","w");
+   fpca    = ctxopen("ca.sv4","w");
 #endif
 
 
@@ -5591,6 +11141,10 @@ int main()
 
    initk();    /* initialize rate coefficients k */
 
+#ifdef AUTOMESH
+   automesh(); /* RBULK, M and mesh r[] */
+#endif
+
 #ifdef INITA
    dt = 0.005;    /* time step */
    inita();
@@ -5617,6 +11171,15 @@ int main()
 
    fclose(fpks);
 
+#ifdef LIBSOLVDE
+   if(lbkeep && lbknck != NCK) {	/* kept rows: first solve, other M */
+      if(lbknck > 0) for(i=NE; i >= 1; i--) free_dmatrix(c[i],1,NCJ,1,lbknck);
+      lbknck = 0;
+      for(i=1; i<=NE; i++) c[i] = dmatrix(1,NCJ,1,NCK);
+      lbknck = NCK;
+   }
+   if(!lbkeep)
+#endif
    for(i=1; i<=NE; i++) c[i] = dmatrix(1,NCJ,1,NCK);
 
    fprintf(fppara,"--- solvde4.c  --- \n");
@@ -5723,88 +11286,24 @@ int main()
    /* --- initial guess --- */
 
 
-   /* --- test: pure diffusion --- */
-
-   /*
-        c'' + 2/r c' = 0                  -> c(r) = a/r + b
-        dc/dr (r1) = alpha = - a / r1**2  -> a = -alpha * r1**2
-        c(r2) = beta = a/r2 + b           -> b = beta + alpha * r1**2 / r2
-   */
-
-      a1 = -co2flux * RADIUS * RADIUS;
-      b1 =  co2bulk - a1 / RBULK;
-
-      a2 = -hco3flux * RADIUS * RADIUS;
-      b2 =  hco3bulk - a2 / RBULK;
-
-      a3 = -co3flux * RADIUS * RADIUS;
-      b3 =  co3bulk - a3 / RBULK;
-
-#ifdef C13ISTP
-      acc1 = -cco2flux * RADIUS * RADIUS;
-      bcc1 = cco2bulk - acc1 / RBULK;
-
-      acc2 = -hcco3flux * RADIUS * RADIUS;
-      bcc2 = hcco3bulk - acc2 / RBULK;
-
-      acc3 = -cco3flux * RADIUS * RADIUS;
-      bcc3 =  cco3bulk - acc3 / RBULK;
-#endif
-
+#ifdef AUTOMESH
+      h = r[2] - r[1];	/* non-uniform mesh from automesh() */
+#else
       h = (RBULK - RADIUS)/(double)(M-1);
+#endif
       hh = 0.5 * h;
 
       fprintf(fppara,"h [mu] grid spacing       %e \n",h);
 
 #ifdef DEB05
    printf("--- before initial guess loop --- \n");
-   printf("%e  %e  a1,b1 \n",a1,b1);
-   printf("%e  %e  a2,b2 \n",a2,b2);
 #endif
 
    r[0] = 0.0;    /* not used */
-   for(k=1; k<=M; k++) {
-     x = RADIUS + h*(double)(k-1);
-     r[k] = x;
-        y[EQCO2][k]  =  a1/x + b1;
-     y[N2+EQCO2][k]  = -a1/x/x;
-        y[EQHCO3][k] =  a2/x + b2;
-     y[N2+EQHCO3][k] = -a2/x/x;
-        y[EQCO3][k]  =  co3bulk;
-     y[N2+EQCO3][k]  =  0.0;
-        y[EQHP][k]   =   hbulk;
-        y[EQOH][k]   =  ohbulk;
-     y[N2+EQHP][k]   =  0.0;
-     y[N2+EQOH][k]   =  0.0;
-#ifdef C13ISTP
-        y[EQCCO2][k]   =  acc1/x + bcc1;
-     y[N2+EQCCO2][k]   = -acc1/x/x;
-        y[EQHCCO3][k]  =  acc2/x + bcc2;
-     y[N2+EQHCCO3][k]  = -acc2/x/x;
-        y[EQCCO3][k]   =  cco3bulk;
-     y[N2+EQCCO3][k]   =  0.0;
-#endif
-#ifdef BORON
-        y[EQBOH3][k]   = boh3bulk;
-     y[N2+EQBOH3][k]   = 0.0;
-        y[EQBOH4][k]   = boh4bulk;
-     y[N2+EQBOH4][k]   = 0.0;
-#ifdef BORISTP
-        y[EQBBOH3][k]   = bboh3bulk;
-     y[N2+EQBBOH3][k]   = 0.0;
-        y[EQBBOH4][k]   = bboh4bulk;
-     y[N2+EQBBOH4][k]   = 0.0;
-#endif
-#endif
-#ifdef OXYGEN
-        y[EQO2][k]   = o2bulk;
-     y[N2+EQO2][k]   = 0.0;
-#endif
-#ifdef CALCIUM
-        y[EQCA][k]   = cabulk;
-     y[N2+EQCA][k]   = 0.0;
+#ifndef AUTOMESH
+   for(k=1; k<=M; k++) r[k] = RADIUS + h*(double)(k-1);
 #endif
-   }
+   yinit(y);
 
    fprintf(fppara,"------------------------- \n");
    fprintf(fppara,"%e   r[1]                 \n",r[1]);
@@ -5849,7 +11348,7 @@ int main()
 
      initdm();	/* init matrix of diffusion coefficients */
 
-   fpdifcofm = fopen("difcofm.sv4","w");
+   fpdifcofm = ctxopen("difcofm.sv4","w");
    for(k=1;k<=M;k++){
    	for(j=1;j<=N2;j++)
    		fprintf(fpdifcofm,"%e ",difcofm[j][k]*1.e-12);
@@ -5872,6 +11371,10 @@ int main()
 #ifdef PRINT
           printf("%d  %e   nsymrad,r[nsymrad] \n",nsymrad,r[nsymrad]);
 #endif /* PRINT */
+#ifdef AUTOMESH
+	  /* halo uptake per interval ~ interval length, see NSYMK */
+	  symlen = (double)nsymrad*(r[nsymrad]-r[1])/(double)(nsymrad-1);
+#endif
 	  /* write rmin and rmax of symbiont halo in file */
 	  fprintf(fpdc,"%e\n",RADIUS);
           fprintf(fpdc,"%e\n",r[nsymrad]);
@@ -5882,6 +11385,10 @@ int main()
 #endif
 
 
+#ifdef LININIT
+   lininit(indexv,y);	/* replaces the initial guess above */
+#endif
+
 #ifdef DEB05
    printf("--- after initial guess loop --- \n");
 #endif
@@ -5926,7 +11433,89 @@ int main()
          s[i][j] = 0.0;
       }}
 
+#if defined (TIMESTEP) && defined (MIMECO2SYM)
+   vmaxtr  = vmaxco2;		/* light, see bdfstep()	*/
+#ifdef TRANSIENT
+   vmaxco2 = TRV0*vmaxtr;	/* initial steady state	*/
+#else				/* mean: start of periodic() */
+   vmaxco2 = (TRV1*PDLIGHT + TRV0*(PDPER - PDLIGHT))/PDPER*vmaxtr;
+#endif
+#endif
+
+#ifdef SOLLIB
+   sllook(y);		/* replaces the initial guess above */
+#endif
+#ifdef LIBSOLVDE
+   lbstart(y);
+#endif
+
+#ifdef ISTPDEC
+   /* --- main species, then isotopologues, see istpsub() --- */
+   ivfull = indexv;
+   fprintf(fppara,"--- decoupled isotopologues (ISTPDEC) --- \n");
+   istpset(y,1);		/* ratios of the initial guess */
+   for(i=1; i <= ISTPIT; i++) {
+      istpst = (i == 1) ? 0 : 2;
+      j = istpsub(0,indexvs);
+      if(solvde(ITMAX,CONV,SLOWC,scalv,indexvs,2*j,j,M,y,c,s)) break;
+      nits += itsol;
+      fprintf(fppara,"pass %d main species  %d iterations \n",i,itsol);
+      if(i > 1 && itsol == 1) break;   /* main species unchanged */
+      istpst = 1;		/* (nearly) linear: undamped steps */
+      j = istpsub(1,indexvs);
+      if(j == 0) break;		/* no isotopologues */
+      if(solvde(ITMAX,CONV,1.0,scalv,indexvs,2*j,j,M,y,c,s)) break;
+      nits += itsol;
+      fprintf(fppara,"pass %d isotopologues %d iterations \n",i,itsol);
+      istpset(y,1);
+   }
+   if(svrc != SVOK) svit += nits;	/* failed pass: after the others */
+   if(i > ISTPIT && svrc == SVOK) {	/* main species still changing */
+      svrc = SVITMAX;
+      svit = nits;
+      svk  = 0;
+      strcpy(svmsg,"Too many main/isotopologue passes (ISTPDEC)");
+   }
+   itsol = nits;		/* all passes: par.sv4, solvde_solve() */
+   fprintf(fppara,"Newton iterations, all passes %d \n",nits);
+#else
    solvde(ITMAX,CONV,SLOWC,scalv,indexv,NE,NB,M,y,c,s);
+#endif
+   if(svrc != SVOK) {		/* failed solve: the status in svrc ... */
+#if defined (MTHREAD) || defined (LIBSOLVDE)
+#ifndef LIBSOLVDE
+      svdump(y);
+#endif
+      goto svdone;		/* to mtsolve(), lbrun(): no results */
+#else
+      svabort(y);
+#endif
+   }
+#ifdef SOLLIB
+   slstore(y);
+#endif
+
+#ifdef FIT
+   fit(indexv,scalv,y,c,s);
+#endif
+#ifdef CONTIN
+   contin(indexv,scalv,y);
+#endif
+#ifdef BATCH
+   batch(indexv,scalv,y,c,s);
+#endif
+#ifdef ROM
+   rom(indexv,scalv,y,c,s);
+#endif
+#ifdef SURR
+   surr(indexv,scalv,y,c,s);
+#endif
+#ifdef SENSIT
+   sensit(indexv,y);
+#endif
+#ifdef ADJOINT
+   adjoint(indexv,y);
+#endif
 
    #ifdef PRINT
    printf("--- after solvde --- \n");
@@ -6036,6 +11625,9 @@ int main()
         fprintf(fpdc13slp,"%e\n",tmp1);
       }		/* end of Carbon-system-loop */
 #endif
+#ifdef LIBSOLVDE
+      lbget(y);		/* results: the handle, no profile files */
+#else
       for(j=1;j<=M;j++) {
         fprintf(fpr,"%f\n",r[j]);
         fprintf(fpco2,"%e\n", y[EQCO2][j]);
@@ -6063,6 +11655,7 @@ int main()
         fprintf(fpca,"%e\n", y[EQCA][j]);
 #endif
       }
+#endif
 
 
 #ifdef ANASOL
@@ -6105,7 +11698,7 @@ int main()
    printf("%e ak     [mu]      \n",ak);
    printf("%e ca     [mumol/kg] \n",ca);
 
-   fpanasol = fopen("anasol.sv4","w");
+   fpanasol = ctxopen("anasol.sv4","w");
 
    for(j=1;j<=M;j++) {
      cr = cinfty + (ca - cinfty)*RADIUS/r[j]
@@ -6117,6 +11710,13 @@ int main()
 
 #endif
 
+#ifdef TRANSIENT
+   transient(indexv,scalv,y,c,s);
+#endif
+#ifdef PERIODIC
+   periodic(indexv,scalv,y,c,s);
+#endif
+
 #define FLUXTEST
 
 #ifdef FLUXTEST
@@ -6200,11 +11800,11 @@ int main()
 
    fprintf(fppara,"---   dc/dr bulk (solution)   --- \n");
 
-   co2flux = (y[EQCO2][M]  - y[EQCO2][M-1])  / (r[2] - r[1]);
-     hflux = (y[EQHP][M]   - y[EQHP][M-1] )  / (r[2] - r[1]);
-  hco3flux = (y[EQHCO3][M] - y[EQHCO3][M-1]) / (r[2] - r[1]);
-   co3flux = (y[EQCO3][M]  - y[EQCO3][M-1])  / (r[2] - r[1]);
-    ohflux = (y[EQOH][M]   - y[EQOH][M-1])   / (r[2] - r[1]);
+   co2flux = (y[EQCO2][M]  - y[EQCO2][M-1])  / (r[M] - r[M-1]);
+     hflux = (y[EQHP][M]   - y[EQHP][M-1] )  / (r[M] - r[M-1]);
+  hco3flux = (y[EQHCO3][M] - y[EQHCO3][M-1]) / (r[M] - r[M-1]);
+   co3flux = (y[EQCO3][M]  - y[EQCO3][M-1])  / (r[M] - r[M-1]);
+    ohflux = (y[EQOH][M]   - y[EQOH][M-1])   / (r[M] - r[M-1]);
 
    fprintf(fppara,"co2flux        %e \n",co2flux);
    fprintf(fppara,"hflux          %e \n",hflux);
@@ -6214,7 +11814,11 @@ int main()
 
   fprintf(fppara,"---  uptake --- \n");
 
+#ifdef EQFAR
+   surface = surface / RADIUS / RADIUS * r[M] * r[M];	/* interface */
+#else
    surface = surface / RADIUS / RADIUS * RBULK * RBULK;
+#endif
 
    co2flux  =  co2flux * surface * dco2  / 1.e21;
      hflux  =    hflux * surface * dh    / 1.e21;
@@ -6238,7 +11842,9 @@ int main()
 
 
 
-
+#if defined (MTHREAD) || defined (LIBSOLVDE)
+svdone:
+#endif
       fclose(fpr);
       fclose(fpco2);
       fclose(fphco3);
@@ -6271,8 +11877,6 @@ int main()
 #ifdef BORISTP
       fclose(fpbboh3);
       fclose(fpbboh4);
-      fclose(fpdbboh3);
-      fclose(fpdbboh4);
 #endif
 #endif
 #ifdef CALCIUM
@@ -6280,6 +11884,17 @@ int main()
 #endif
       fclose(fppara);
 
+#if defined (MTHREAD) || defined (LIBSOLVDE)	/* many solves per process */
+#ifdef LIBSOLVDE
+      if(lbkeep) return(svrc);	/* worker: arrays kept for its next solve */
+#endif
+      for(i=NE; i >= 1; i--) free_dmatrix(c[i],1,NCJ,1,NCK);
+      free((char *)(c+1));
+      free_dmatrix(s,1,NE,1,NSJ);
+      free_dmatrix(y,1,NE,1,MMAX);
+      return(svrc);
+#endif
+
 
 /* ====================    end of main   =============================== */
 
@@ -0,0 +1,184 @@
+/* ----------------------------------------------------------------
+
+   surrtab.c: queries of the surrogate table of solvde42 (SURR run,
+   surr.bin, see surr() there). Sparse-grid interpolant of the shell
+   values in nd parameters,
+
+     q(x) = sum_p alpha_p prod_j phi_pj(u_j),   u = (x - lo)/(hi - lo)
+
+   err: max |alpha_p| of the unrefined points whose basis covers u,
+   the error estimate per output. Arrays from 0 here (C callers,
+   ctypes, Julia ccall):
+
+     SURRTAB *t = surrload("surr.bin");
+     surreval(t,x,q,err);      x[nd] -> q[nout], err[nout] (or NULL)
+     surrfree(t);
+
+   surreval() returns the number of parameters outside [lo,hi]
+   (clamped to the box). t->pname, t->oname: names of the parameters
+   and outputs, t->tol: the tolerances of the refinement.
+
+     cc -O2 -shared -fPIC surrtab.c -o libsurrtab.so -lm
+     cc -O2 -DSURRMAIN surrtab.c -o surrq -lm;  surrq surr.bin x1 .. xnd
+
+   ---------------------------------------------------------------- */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#define SURRNAME 16	/* bytes per name in the table	*/
+
+typedef struct {
+   int nd,nout,npt,lmax;
+   char (*pname)[SURRNAME],(*oname)[SURRNAME];
+   double *lo,*hi,*tol;
+   double *c,*w;	/* centre, 1/half width per point and parameter,
+			   w = 0: constant (level 1)			*/
+   double *al;		/* surpluses per point and output		*/
+   int *leaf;
+} SURRTAB;
+
+void surrfree(t)
+SURRTAB *t;
+{
+   if(t == NULL) return;
+   free(t->leaf);
+   free(t->al);
+   free(t->w);
+   free(t->c);
+   free(t->tol);
+   free(t->hi);
+   free(t->lo);
+   free(t->oname);
+   free(t->pname);
+   free(t);
+}
+
+SURRTAB *surrload(fname)	/* NULL: no or bad file */
+char *fname;
+{
+   int i,j,l,p,r,hd[4],*pos;
+   size_t nd,no,np,ok=1;
+   SURRTAB *t;
+   FILE *fp;
+
+   if((fp = fopen(fname,"rb")) == NULL) return(NULL);
+   if(fread(hd,sizeof(int),4,fp) != 4 || hd[0] < 1 || hd[0] > 64
+      || hd[1] < 1 || hd[2] < 1 || hd[3] < 2 || hd[3] > 30) {
+      fclose(fp);
+      return(NULL);
+   }
+   t = (SURRTAB *)calloc(1,sizeof(SURRTAB));
+   t->nd = hd[0];  t->nout = hd[1];  t->npt = hd[2];  t->lmax = hd[3];
+   nd = t->nd;  no = t->nout;  np = t->npt;
+   t->pname = malloc(nd*SURRNAME);
+   t->oname = malloc(no*SURRNAME);
+   t->lo    = (double *)malloc(nd*sizeof(double));
+   t->hi    = (double *)malloc(nd*sizeof(double));
+   t->tol   = (double *)malloc(no*sizeof(double));
+   t->c     = (double *)malloc(np*nd*sizeof(double));
+   t->w     = (double *)malloc(np*nd*sizeof(double));
+   t->al    = (double *)malloc(np*no*sizeof(double));
+   t->leaf  = (int *)malloc(np*sizeof(int));
+   pos      = (int *)malloc(nd*sizeof(int));
+
+   ok = ok && fread(t->pname,SURRNAME,nd,fp) == nd;
+   ok = ok && fread(t->lo,sizeof(double),nd,fp) == nd;
+   ok = ok && fread(t->hi,sizeof(double),nd,fp) == nd;
+   ok = ok && fread(t->oname,SURRNAME,no,fp) == no;
+   ok = ok && fread(t->tol,sizeof(double),no,fp) == no;
+   r = 1 << (t->lmax - 1);		/* grid positions 0..r */
+   for(i=0; ok && i < t->npt; i++) {
+      ok = ok && fread(pos,sizeof(int),nd,fp) == nd;
+      ok = ok && fread(&t->leaf[i],sizeof(int),1,fp) == 1;
+      ok = ok && fread(&t->al[i*no],sizeof(double),no,fp) == no;
+      for(j=0; ok && j < t->nd; j++) {	/* level: as sglev() */
+         p = pos[j];
+         if(p == r/2)              l = 1;
+         else if(p == 0 || p == r) l = 2;
+         else for(l=t->lmax; p % 2 == 0; p /= 2) l--;
+         t->c[i*nd+j] = (double)pos[j]/(double)r;
+         t->w[i*nd+j] = (l == 1) ? 0.0 : (double)(1 << (l-1));
+      }
+   }
+   for(j=0; j < t->nd; j++) t->pname[j][SURRNAME-1] = '\0';
+   for(j=0; j < t->nout; j++) t->oname[j][SURRNAME-1] = '\0';
+   free(pos);
+   fclose(fp);
+   if(!ok) {
+      surrfree(t);
+      return(NULL);
+   }
+   return(t);
+}
+
+int surreval(t,x,q,err)		/* returns the number clamped to the box */
+SURRTAB *t;
+double x[],q[],err[];
+{
+   int i,j,o,nd=t->nd,no=t->nout,nout=0;
+   double u[64],f,d,*c,*w,*al;
+
+   for(j=0; j < nd; j++) {
+      u[j] = (x[j] - t->lo[j])/(t->hi[j] - t->lo[j]);
+      if(u[j] < 0.0 || u[j] > 1.0) {
+         u[j] = (u[j] < 0.0) ? 0.0 : 1.0;
+         nout++;
+      }
+   }
+   for(o=0; o < no; o++) q[o] = 0.0;
+   if(err != NULL) for(o=0; o < no; o++) err[o] = 0.0;
+   for(i=0; i < t->npt; i++) {
+      c = t->c + i*nd;
+      w = t->w + i*nd;
+      f = 1.0;
+      for(j=0; j < nd; j++) {
+         if(w[j] == 0.0) continue;
+         d = 1.0 - fabs(u[j] - c[j])*w[j];
+         if(d <= 0.0) break;
+         f *= d;
+      }
+      if(j < nd) continue;
+      al = t->al + i*no;
+      for(o=0; o < no; o++) q[o] += f*al[o];
+      if(err != NULL && t->leaf[i])
+         for(o=0; o < no; o++)
+            if(fabs(al[o]) > err[o]) err[o] = fabs(al[o]);
+   }
+   return(nout);
+}
+
+#ifdef SURRMAIN
+int main(argc,argv)
+int argc;
+char *argv[];
+{
+   int j,o;
+   double x[64],*q,*err;
+   SURRTAB *t;
+
+   if(argc < 2 || (t = surrload(argv[1])) == NULL) {
+      fprintf(stderr,"usage: surrq surr.bin x1 .. xnd (no table)\n");
+      return(1);
+   }
+   if(argc != t->nd + 2) {
+      fprintf(stderr,"surrq: %d parameters:",t->nd);
+      for(j=0; j < t->nd; j++) fprintf(stderr," %s",t->pname[j]);
+      fprintf(stderr,"\n");
+      return(1);
+   }
+   for(j=0; j < t->nd; j++) x[j] = atof(argv[j+2]);
+   q   = (double *)malloc(t->nout*sizeof(double));
+   err = (double *)malloc(t->nout*sizeof(double));
+   if(surreval(t,x,q,err) > 0)
+      fprintf(stderr,"surrq: outside the table, clamped\n");
+   printf("# output value err\n");
+   for(o=0; o < t->nout; o++)
+      printf("%-9s %e %e\n",t->oname[o],q[o],err[o]);
+   free(err);
+   free(q);
+   surrfree(t);
+   return(0);
+}
+#endif